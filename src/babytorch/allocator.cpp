@@ -0,0 +1,155 @@
+#include <algorithm>
+#include <bit>
+#include <mutex>
+#include <new>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <sys/mman.h>
+
+#include "allocator.hpp"
+
+namespace allocator {
+
+    // Smallest class, requests below share it
+    constexpr size_t MIN_BLOCK = 64;
+
+    struct Cache {
+        std::mutex mutex;
+        std::unordered_map<size_t, std::vector<void*>> free_blocks;
+        std::unordered_set<const void*> huge_blocks;
+        size_t huge_threshold = HUGE_PAGE_SIZE;
+        Stats stats;
+    };
+
+    // Never destroyed, storages of static tensors are released after
+    // every other static is gone
+    Cache& cache() {
+        static Cache* instance = new Cache();
+        return *instance;
+    }
+
+    size_t size_class(size_t bytes) {
+        if (bytes <= MIN_BLOCK)
+            return MIN_BLOCK;
+
+        size_t step = std::bit_floor(bytes - 1) / 4;
+        return (bytes + step - 1) / step * step;
+    }
+
+    std::align_val_t alignment(bool huge) {
+        return std::align_val_t{ huge ? HUGE_PAGE_SIZE : ALIGNMENT };
+    }
+
+    // Only advice, the block stays usable on regular pages when the
+    // kernel has transparent huge pages disabled
+    void advise_huge_pages([[maybe_unused]] void* ptr,
+                           [[maybe_unused]] size_t size) {
+#ifdef MADV_HUGEPAGE
+        madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+    }
+
+    void* allocate(size_t bytes) {
+        if (bytes == 0)
+            return nullptr;
+
+        size_t size = size_class(bytes);
+        Cache& c    = cache();
+        void* ptr   = nullptr;
+        bool huge   = false;
+
+        {
+            std::lock_guard lock(c.mutex);
+
+            auto& blocks = c.free_blocks[size];
+            if (!blocks.empty()) {
+                ptr = blocks.back();
+                blocks.pop_back();
+                c.stats.cached_bytes -= size;
+                c.stats.hits++;
+            }
+            else {
+                c.stats.misses++;
+                huge = size >= c.huge_threshold;
+            }
+
+            c.stats.allocated_bytes += size;
+            c.stats.peak_bytes = std::max(c.stats.peak_bytes,
+                                          c.stats.allocated_bytes);
+        }
+
+        if (!ptr) {
+            ptr = ::operator new(size, alignment(huge));
+
+            if (huge) {
+                advise_huge_pages(ptr, size);
+
+                std::lock_guard lock(c.mutex);
+                c.huge_blocks.insert(ptr);
+            }
+        }
+        return ptr;
+    }
+
+    void release(void* ptr, size_t bytes) {
+        if (!ptr)
+            return;
+
+        size_t size = size_class(bytes);
+        Cache& c    = cache();
+
+        std::lock_guard lock(c.mutex);
+        c.free_blocks[size].push_back(ptr);
+        c.stats.allocated_bytes -= size;
+        c.stats.cached_bytes += size;
+    }
+
+    Stats stats() {
+        Cache& c = cache();
+        std::lock_guard lock(c.mutex);
+        return c.stats;
+    }
+
+    void reset_stats() {
+        Cache& c = cache();
+        std::lock_guard lock(c.mutex);
+        c.stats.hits       = 0;
+        c.stats.misses     = 0;
+        c.stats.peak_bytes = c.stats.allocated_bytes;
+    }
+
+    void empty_cache() {
+        Cache& c = cache();
+        std::lock_guard lock(c.mutex);
+
+        for (auto& [size, blocks] : c.free_blocks)
+            for (void* ptr : blocks) {
+                bool huge = c.huge_blocks.erase(ptr);
+                ::operator delete(ptr, size, alignment(huge));
+            }
+
+        c.free_blocks.clear();
+        c.stats.cached_bytes = 0;
+    }
+
+    size_t huge_page_threshold() {
+        Cache& c = cache();
+        std::lock_guard lock(c.mutex);
+        return c.huge_threshold;
+    }
+
+    void set_huge_page_threshold(size_t bytes) {
+        Cache& c = cache();
+        std::lock_guard lock(c.mutex);
+        c.huge_threshold = bytes;
+    }
+
+    bool huge_pages(const void* ptr) {
+        Cache& c = cache();
+        std::lock_guard lock(c.mutex);
+        return c.huge_blocks.contains(ptr);
+    }
+
+}  // namespace allocator
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+
+namespace allocator {
+    // Size-class caching allocator for storage buffers.
+    //
+    // Requests are rounded up to a size class, four classes per power of
+    // two. Freed blocks are kept on a free list per class and handed out
+    // again by the next request of the same class, so steady-state
+    // training, which allocates the same shapes over and over, stops
+    // going through the system allocator. Cached blocks are only
+    // returned to the system by empty_cache().
+    //
+    // Blocks are not zero filled, Storage does that unless the caller
+    // overwrites every element anyway.
+    //
+    // Every block starts on a cache line, which covers the widest SIMD
+    // loads. Blocks of at least huge_page_threshold() bytes are placed on
+    // huge page boundaries and advised to the kernel as transparent huge
+    // pages, large tensors then need a fraction of the TLB entries.
+
+    constexpr size_t ALIGNMENT      = 64;
+    constexpr size_t HUGE_PAGE_SIZE = size_t{ 2 } << 20;
+
+    struct Stats {
+        size_t allocated_bytes = 0;  // in blocks held by storages
+        size_t cached_bytes    = 0;  // in freed blocks kept for reuse
+        size_t peak_bytes      = 0;  // high-water mark of allocated_bytes
+        size_t hits            = 0;  // requests served from the cache
+        size_t misses          = 0;  // requests that went to the system
+    };
+
+    // Bytes actually reserved for a request of `bytes`
+    size_t size_class(size_t bytes);
+
+    // A block of size_class(bytes), nullptr for 0 bytes. The same size
+    // has to be passed back to release().
+    void* allocate(size_t bytes);
+    void release(void* ptr, size_t bytes);
+
+    Stats stats();
+
+    // Clears hits and misses and restarts the high-water mark at the
+    // bytes currently allocated
+    void reset_stats();
+
+    // Returns every cached block to the system
+    void empty_cache();
+
+    // Smallest block taken on huge pages, HUGE_PAGE_SIZE by default. A
+    // new threshold applies to blocks taken from the system afterwards,
+    // cached blocks keep the pages they were given.
+    size_t huge_page_threshold();
+    void set_huge_page_threshold(size_t bytes);
+
+    // Whether the block at `ptr` was taken on huge pages
+    bool huge_pages(const void* ptr);
+
+}  // namespace allocator
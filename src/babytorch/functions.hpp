@@ -106,6 +106,31 @@ namespace functions {
         }
     };
 
+    struct Sub {
+        static double forward(Context&, const double self, const double other) {
+            return operators::sub(self, other);
+        }
+
+        static std::array<double, 2> backward(const Context&, const double deriv) {
+            return { deriv, -deriv };
+        }
+    };
+
+    struct Div {
+        static double forward(Context& ctx, const double self, const double other) {
+            ctx.save_for_backwards(self, other);
+            return operators::div(self, other);
+        }
+
+        static std::array<double, 2> backward(const Context& ctx,
+                                              const double deriv) {
+            double self  = ctx.saved_values[0];
+            double other = ctx.saved_values[1];
+            return { operators::div(deriv, other),
+                     operators::inv_back(other, self * deriv) };
+        }
+    };
+
     struct Mul {
         static double forward(Context& ctx, const double self, const double other) {
             ctx.save_for_backwards(self, other);
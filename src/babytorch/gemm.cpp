@@ -0,0 +1,761 @@
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include <immintrin.h>
+
+#include "gemm.hpp"
+#include "thread_pool.hpp"
+
+namespace gemm {
+
+    // Micro-kernels: tile = a_sliver (MR x kc) * b_sliver (kc x NR), where
+    // slivers are packed k-major and the tile is written row-major
+
+    template <typename T>
+    using MicroKernel = void (*)(size_t kc, const T* a, const T* b, T* tile);
+
+    template <typename T>
+    void micro_kernel_generic(size_t kc, const T* a, const T* b, T* tile) {
+        constexpr size_t MR = Tile<T>::MR, NR = Tile<T>::NR;
+
+        T c[MR][NR] = {};
+
+        for (size_t p = 0; p < kc; p++, a += MR, b += NR)
+            for (size_t i = 0; i < MR; i++)
+                for (size_t j = 0; j < NR; j++)
+                    c[i][j] += a[i] * b[j];
+
+        for (size_t i = 0; i < MR; i++)
+            for (size_t j = 0; j < NR; j++)
+                tile[i * NR + j] = c[i][j];
+    }
+
+    [[gnu::target("avx2,fma")]] void micro_kernel_avx2(size_t kc,
+                                                       const double* a,
+                                                       const double* b,
+                                                       double* tile) {
+        // 4 rows x 2 vectors of 4 doubles
+        __m256d c00 = _mm256_setzero_pd(), c01 = _mm256_setzero_pd();
+        __m256d c10 = _mm256_setzero_pd(), c11 = _mm256_setzero_pd();
+        __m256d c20 = _mm256_setzero_pd(), c21 = _mm256_setzero_pd();
+        __m256d c30 = _mm256_setzero_pd(), c31 = _mm256_setzero_pd();
+
+        constexpr size_t MR = Tile<double>::MR, NR = Tile<double>::NR;
+
+        for (size_t p = 0; p < kc; p++, a += MR, b += NR) {
+            __m256d b0 = _mm256_loadu_pd(b);
+            __m256d b1 = _mm256_loadu_pd(b + 4);
+
+            __m256d a0 = _mm256_broadcast_sd(a);
+            c00        = _mm256_fmadd_pd(a0, b0, c00);
+            c01        = _mm256_fmadd_pd(a0, b1, c01);
+
+            __m256d a1 = _mm256_broadcast_sd(a + 1);
+            c10        = _mm256_fmadd_pd(a1, b0, c10);
+            c11        = _mm256_fmadd_pd(a1, b1, c11);
+
+            __m256d a2 = _mm256_broadcast_sd(a + 2);
+            c20        = _mm256_fmadd_pd(a2, b0, c20);
+            c21        = _mm256_fmadd_pd(a2, b1, c21);
+
+            __m256d a3 = _mm256_broadcast_sd(a + 3);
+            c30        = _mm256_fmadd_pd(a3, b0, c30);
+            c31        = _mm256_fmadd_pd(a3, b1, c31);
+        }
+
+        _mm256_storeu_pd(tile + 0, c00);
+        _mm256_storeu_pd(tile + 4, c01);
+        _mm256_storeu_pd(tile + 8, c10);
+        _mm256_storeu_pd(tile + 12, c11);
+        _mm256_storeu_pd(tile + 16, c20);
+        _mm256_storeu_pd(tile + 20, c21);
+        _mm256_storeu_pd(tile + 24, c30);
+        _mm256_storeu_pd(tile + 28, c31);
+    }
+
+    [[gnu::target("avx512f")]] void micro_kernel_avx512(size_t kc,
+                                                        const double* a,
+                                                        const double* b,
+                                                        double* tile) {
+        constexpr size_t MR = Tile<double>::MR, NR = Tile<double>::NR;
+
+        // One vector of 8 doubles per row, k unrolled by two into separate
+        // accumulators to keep enough FMAs in flight
+        __m512d c0 = _mm512_setzero_pd(), d0 = _mm512_setzero_pd();
+        __m512d c1 = _mm512_setzero_pd(), d1 = _mm512_setzero_pd();
+        __m512d c2 = _mm512_setzero_pd(), d2 = _mm512_setzero_pd();
+        __m512d c3 = _mm512_setzero_pd(), d3 = _mm512_setzero_pd();
+
+        size_t p = 0;
+        for (; p + 2 <= kc; p += 2, a += 2 * MR, b += 2 * NR) {
+            __m512d b0 = _mm512_loadu_pd(b);
+            __m512d b1 = _mm512_loadu_pd(b + NR);
+
+            c0 = _mm512_fmadd_pd(_mm512_set1_pd(a[0]), b0, c0);
+            c1 = _mm512_fmadd_pd(_mm512_set1_pd(a[1]), b0, c1);
+            c2 = _mm512_fmadd_pd(_mm512_set1_pd(a[2]), b0, c2);
+            c3 = _mm512_fmadd_pd(_mm512_set1_pd(a[3]), b0, c3);
+
+            d0 = _mm512_fmadd_pd(_mm512_set1_pd(a[MR + 0]), b1, d0);
+            d1 = _mm512_fmadd_pd(_mm512_set1_pd(a[MR + 1]), b1, d1);
+            d2 = _mm512_fmadd_pd(_mm512_set1_pd(a[MR + 2]), b1, d2);
+            d3 = _mm512_fmadd_pd(_mm512_set1_pd(a[MR + 3]), b1, d3);
+        }
+
+        if (p < kc) {
+            __m512d b0 = _mm512_loadu_pd(b);
+            c0         = _mm512_fmadd_pd(_mm512_set1_pd(a[0]), b0, c0);
+            c1         = _mm512_fmadd_pd(_mm512_set1_pd(a[1]), b0, c1);
+            c2         = _mm512_fmadd_pd(_mm512_set1_pd(a[2]), b0, c2);
+            c3         = _mm512_fmadd_pd(_mm512_set1_pd(a[3]), b0, c3);
+        }
+
+        _mm512_storeu_pd(tile + 0 * NR, _mm512_add_pd(c0, d0));
+        _mm512_storeu_pd(tile + 1 * NR, _mm512_add_pd(c1, d1));
+        _mm512_storeu_pd(tile + 2 * NR, _mm512_add_pd(c2, d2));
+        _mm512_storeu_pd(tile + 3 * NR, _mm512_add_pd(c3, d3));
+    }
+
+    [[gnu::target("avx2,fma")]] void micro_kernel_avx2(size_t kc,
+                                                       const float* a,
+                                                       const float* b,
+                                                       float* tile) {
+        // 4 rows x 2 vectors of 8 floats
+        __m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps();
+        __m256 c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps();
+        __m256 c20 = _mm256_setzero_ps(), c21 = _mm256_setzero_ps();
+        __m256 c30 = _mm256_setzero_ps(), c31 = _mm256_setzero_ps();
+
+        constexpr size_t MR = Tile<float>::MR, NR = Tile<float>::NR;
+
+        for (size_t p = 0; p < kc; p++, a += MR, b += NR) {
+            __m256 b0 = _mm256_loadu_ps(b);
+            __m256 b1 = _mm256_loadu_ps(b + 8);
+
+            __m256 a0 = _mm256_broadcast_ss(a);
+            c00       = _mm256_fmadd_ps(a0, b0, c00);
+            c01       = _mm256_fmadd_ps(a0, b1, c01);
+
+            __m256 a1 = _mm256_broadcast_ss(a + 1);
+            c10       = _mm256_fmadd_ps(a1, b0, c10);
+            c11       = _mm256_fmadd_ps(a1, b1, c11);
+
+            __m256 a2 = _mm256_broadcast_ss(a + 2);
+            c20       = _mm256_fmadd_ps(a2, b0, c20);
+            c21       = _mm256_fmadd_ps(a2, b1, c21);
+
+            __m256 a3 = _mm256_broadcast_ss(a + 3);
+            c30       = _mm256_fmadd_ps(a3, b0, c30);
+            c31       = _mm256_fmadd_ps(a3, b1, c31);
+        }
+
+        _mm256_storeu_ps(tile + 0, c00);
+        _mm256_storeu_ps(tile + 8, c01);
+        _mm256_storeu_ps(tile + 16, c10);
+        _mm256_storeu_ps(tile + 24, c11);
+        _mm256_storeu_ps(tile + 32, c20);
+        _mm256_storeu_ps(tile + 40, c21);
+        _mm256_storeu_ps(tile + 48, c30);
+        _mm256_storeu_ps(tile + 56, c31);
+    }
+
+    [[gnu::target("avx512f")]] void micro_kernel_avx512(size_t kc,
+                                                        const float* a,
+                                                        const float* b,
+                                                        float* tile) {
+        constexpr size_t MR = Tile<float>::MR, NR = Tile<float>::NR;
+
+        // Same layout as the double kernel with 16 floats per row
+        __m512 c0 = _mm512_setzero_ps(), d0 = _mm512_setzero_ps();
+        __m512 c1 = _mm512_setzero_ps(), d1 = _mm512_setzero_ps();
+        __m512 c2 = _mm512_setzero_ps(), d2 = _mm512_setzero_ps();
+        __m512 c3 = _mm512_setzero_ps(), d3 = _mm512_setzero_ps();
+
+        size_t p = 0;
+        for (; p + 2 <= kc; p += 2, a += 2 * MR, b += 2 * NR) {
+            __m512 b0 = _mm512_loadu_ps(b);
+            __m512 b1 = _mm512_loadu_ps(b + NR);
+
+            c0 = _mm512_fmadd_ps(_mm512_set1_ps(a[0]), b0, c0);
+            c1 = _mm512_fmadd_ps(_mm512_set1_ps(a[1]), b0, c1);
+            c2 = _mm512_fmadd_ps(_mm512_set1_ps(a[2]), b0, c2);
+            c3 = _mm512_fmadd_ps(_mm512_set1_ps(a[3]), b0, c3);
+
+            d0 = _mm512_fmadd_ps(_mm512_set1_ps(a[MR + 0]), b1, d0);
+            d1 = _mm512_fmadd_ps(_mm512_set1_ps(a[MR + 1]), b1, d1);
+            d2 = _mm512_fmadd_ps(_mm512_set1_ps(a[MR + 2]), b1, d2);
+            d3 = _mm512_fmadd_ps(_mm512_set1_ps(a[MR + 3]), b1, d3);
+        }
+
+        if (p < kc) {
+            __m512 b0 = _mm512_loadu_ps(b);
+            c0        = _mm512_fmadd_ps(_mm512_set1_ps(a[0]), b0, c0);
+            c1        = _mm512_fmadd_ps(_mm512_set1_ps(a[1]), b0, c1);
+            c2        = _mm512_fmadd_ps(_mm512_set1_ps(a[2]), b0, c2);
+            c3        = _mm512_fmadd_ps(_mm512_set1_ps(a[3]), b0, c3);
+        }
+
+        _mm512_storeu_ps(tile + 0 * NR, _mm512_add_ps(c0, d0));
+        _mm512_storeu_ps(tile + 1 * NR, _mm512_add_ps(c1, d1));
+        _mm512_storeu_ps(tile + 2 * NR, _mm512_add_ps(c2, d2));
+        _mm512_storeu_ps(tile + 3 * NR, _mm512_add_ps(c3, d3));
+    }
+
+    template <typename T>
+    MicroKernel<T> select_micro_kernel() {
+        static const MicroKernel<T> kernel = [] -> MicroKernel<T> {
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx512f"))
+                return micro_kernel_avx512;
+            if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+                return micro_kernel_avx2;
+            return micro_kernel_generic<T>;
+        }();
+        return kernel;
+    }
+
+    // Packing: copy a block into sliver-major order, zero-padding the edges
+    // so the micro-kernel never needs bounds checks
+
+    template <typename T>
+    void pack_a(size_t mc, size_t kc, Matrix<const T> A, T* buf) {
+        constexpr size_t MR = Tile<T>::MR;
+
+        for (size_t ir = 0; ir < mc; ir += MR) {
+            size_t mr = std::min(MR, mc - ir);
+
+            for (size_t p = 0; p < kc; p++, buf += MR) {
+                for (size_t i = 0; i < mr; i++)
+                    buf[i] = *A.at(ir + i, p);
+                for (size_t i = mr; i < MR; i++)
+                    buf[i] = 0.0;
+            }
+        }
+    }
+
+    template <typename T>
+    void pack_b(size_t kc, size_t nc, Matrix<const T> B, T* buf) {
+        constexpr size_t NR = Tile<T>::NR;
+
+        for (size_t jr = 0; jr < nc; jr += NR) {
+            size_t nr = std::min(NR, nc - jr);
+
+            for (size_t p = 0; p < kc; p++, buf += NR) {
+                for (size_t j = 0; j < nr; j++)
+                    buf[j] = *B.at(p, jr + j);
+                for (size_t j = nr; j < NR; j++)
+                    buf[j] = 0.0;
+            }
+        }
+    }
+
+    size_t round_up(size_t value, size_t multiple) {
+        return (value + multiple - 1) / multiple * multiple;
+    }
+
+    // C[i] = A[i] * B for every i < batch. Each KC x NC panel of B is
+    // packed once and reused by the row blocks of every batch, which are
+    // handed out to the pool together.
+    template <typename T>
+    void gemm_shared_b(size_t batch,
+                       size_t M,
+                       size_t N,
+                       size_t K,
+                       const Matrix<const T>* A,
+                       Matrix<const T> B,
+                       const Matrix<T>* C,
+                       bool accumulate) {
+        constexpr size_t MR = Tile<T>::MR, NR = Tile<T>::NR;
+
+        if (batch == 0 || M == 0 || N == 0)
+            return;
+
+        if (K == 0) {
+            if (!accumulate)
+                for (size_t bi = 0; bi < batch; bi++)
+                    for (size_t i = 0; i < M; i++)
+                        for (size_t j = 0; j < N; j++)
+                            *C[bi].at(i, j) = 0.0;
+            return;
+        }
+
+        MicroKernel<T> kernel = select_micro_kernel<T>();
+
+        thread_local std::vector<T> b_pack;
+        b_pack.resize(round_up(std::min(NC, N), NR) * std::min(KC, K));
+
+        size_t m_blocks = (M + MC - 1) / MC;
+
+        for (size_t jc = 0; jc < N; jc += NC) {
+            size_t nc = std::min(NC, N - jc);
+
+            for (size_t pc = 0; pc < K; pc += KC) {
+                size_t kc = std::min(KC, K - pc);
+                bool add  = accumulate || pc > 0;
+
+                pack_b(kc, nc, B.block(pc, jc), b_pack.data());
+
+                // Captured by pointer, b_pack itself is thread local
+                const T* b_packed = b_pack.data();
+
+                // Row blocks of A are independent, hand them to the pool
+                // once there is enough arithmetic per block
+                size_t flops = MC * nc * kc;
+                size_t grain = std::max<size_t>(
+                    1, 8 * thread_pool::GRAIN_SIZE / flops);
+
+                auto row_blocks = [&](size_t begin, size_t end) {
+                    thread_local std::vector<T> a_pack;
+                    a_pack.resize(MC * KC);
+
+                    T tile[MR * NR];
+
+                    for (size_t blk = begin; blk < end; blk++) {
+                        size_t bi = blk / m_blocks;
+                        size_t ic = blk % m_blocks * MC;
+                        size_t mc = std::min(MC, M - ic);
+
+                        pack_a(mc, kc, A[bi].block(ic, pc), a_pack.data());
+
+                        for (size_t jr = 0; jr < nc; jr += NR) {
+                            size_t nr = std::min(NR, nc - jr);
+
+                            for (size_t ir = 0; ir < mc; ir += MR) {
+                                size_t mr = std::min(MR, mc - ir);
+
+                                kernel(kc,
+                                       a_pack.data() + ir * kc,
+                                       b_packed + jr * kc,
+                                       tile);
+
+                                Matrix<T> c = C[bi].block(ic + ir, jc + jr);
+                                for (size_t i = 0; i < mr; i++)
+                                    for (size_t j = 0; j < nr; j++) {
+                                        T& dst = *c.at(i, j);
+                                        dst = add ? dst + tile[i * NR + j]
+                                                  : tile[i * NR + j];
+                                    }
+                            }
+                        }
+                    }
+                };
+
+                thread_pool::parallel_for(
+                    0, batch * m_blocks, grain, row_blocks);
+            }
+        }
+    }
+
+    template <typename T>
+    void gemm(size_t M,
+              size_t N,
+              size_t K,
+              Matrix<const T> A,
+              Matrix<const T> B,
+              Matrix<T> C,
+              bool accumulate) {
+        gemm_shared_b(1, M, N, K, &A, B, &C, accumulate);
+    }
+
+    template <typename T>
+    bool all_same(const Matrix<T>* matrices, size_t n) {
+        return std::all_of(matrices, matrices + n, [&](const Matrix<T>& m) {
+            return m == matrices[0];
+        });
+    }
+
+    template <typename T>
+    void gemm_batched(size_t batch,
+                      size_t M,
+                      size_t N,
+                      size_t K,
+                      const Matrix<const T>* A,
+                      const Matrix<const T>* B,
+                      const Matrix<T>* C,
+                      bool accumulate) {
+        if (batch == 0)
+            return;
+
+        if (all_same(B, batch)) {
+            gemm_shared_b(batch, M, N, K, A, B[0], C, accumulate);
+            return;
+        }
+
+        if (all_same(A, batch)) {
+            // C^T = B^T * A^T turns the shared left operand into the
+            // packed one, transposing is just a stride swap
+            std::vector<Matrix<const T>> b_t(batch);
+            std::vector<Matrix<T>> c_t(batch);
+            for (size_t i = 0; i < batch; i++) {
+                b_t[i] = B[i].transposed();
+                c_t[i] = C[i].transposed();
+            }
+
+            gemm_shared_b(batch,
+                          N,
+                          M,
+                          K,
+                          b_t.data(),
+                          A[0].transposed(),
+                          c_t.data(),
+                          accumulate);
+            return;
+        }
+
+        // Independent products. With fewer batches than threads each
+        // product is split by rows instead.
+        auto products = [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+                gemm_shared_b(1, M, N, K, &A[i], B[i], &C[i], accumulate);
+        };
+
+        if (batch < thread_pool::num_threads()) {
+            products(0, batch);
+            return;
+        }
+
+        size_t flops = std::max<size_t>(1, M * N * K);
+        size_t grain = std::max<size_t>(1, thread_pool::GRAIN_SIZE / flops);
+        thread_pool::parallel_for(0, batch, grain, products);
+    }
+
+    // Int8 products. Slivers hold int16 pairs (k, k + 1) next to each
+    // other, a multiply-add of a broadcast pair of A against a vector of B
+    // pairs then yields one int32 partial sum per column.
+
+    using MicroKernelS8 = void (*)(size_t kp,
+                                   const int16_t* a,
+                                   const int16_t* b,
+                                   int32_t* tile);
+
+    void micro_kernel_s8_generic(size_t kp,
+                                 const int16_t* a,
+                                 const int16_t* b,
+                                 int32_t* tile) {
+        constexpr size_t MR = Tile<int8_t>::MR, NR = Tile<int8_t>::NR;
+
+        int32_t c[MR][NR] = {};
+
+        for (size_t p = 0; p < kp; p++, a += 2 * MR, b += 2 * NR)
+            for (size_t i = 0; i < MR; i++)
+                for (size_t j = 0; j < NR; j++)
+                    c[i][j] += a[2 * i] * b[2 * j]
+                               + a[2 * i + 1] * b[2 * j + 1];
+
+        for (size_t i = 0; i < MR; i++)
+            for (size_t j = 0; j < NR; j++)
+                tile[i * NR + j] = c[i][j];
+    }
+
+    // Pair of A as one 32-bit lane, ready to broadcast
+    inline int32_t load_pair(const int16_t* a) {
+        int32_t pair;
+        std::memcpy(&pair, a, sizeof(pair));
+        return pair;
+    }
+
+    [[gnu::target("avx2")]] void micro_kernel_s8_avx2(size_t kp,
+                                                      const int16_t* a,
+                                                      const int16_t* b,
+                                                      int32_t* tile) {
+        constexpr size_t MR = Tile<int8_t>::MR, NR = Tile<int8_t>::NR;
+
+        // 4 rows x 2 vectors of 8 int32 sums
+        __m256i c00 = _mm256_setzero_si256(), c01 = _mm256_setzero_si256();
+        __m256i c10 = _mm256_setzero_si256(), c11 = _mm256_setzero_si256();
+        __m256i c20 = _mm256_setzero_si256(), c21 = _mm256_setzero_si256();
+        __m256i c30 = _mm256_setzero_si256(), c31 = _mm256_setzero_si256();
+
+        for (size_t p = 0; p < kp; p++, a += 2 * MR, b += 2 * NR) {
+            auto* b_vec = reinterpret_cast<const __m256i*>(b);
+            __m256i b0  = _mm256_loadu_si256(b_vec);
+            __m256i b1  = _mm256_loadu_si256(b_vec + 1);
+
+            __m256i a0 = _mm256_set1_epi32(load_pair(a));
+            c00 = _mm256_add_epi32(c00, _mm256_madd_epi16(a0, b0));
+            c01 = _mm256_add_epi32(c01, _mm256_madd_epi16(a0, b1));
+
+            __m256i a1 = _mm256_set1_epi32(load_pair(a + 2));
+            c10 = _mm256_add_epi32(c10, _mm256_madd_epi16(a1, b0));
+            c11 = _mm256_add_epi32(c11, _mm256_madd_epi16(a1, b1));
+
+            __m256i a2 = _mm256_set1_epi32(load_pair(a + 4));
+            c20 = _mm256_add_epi32(c20, _mm256_madd_epi16(a2, b0));
+            c21 = _mm256_add_epi32(c21, _mm256_madd_epi16(a2, b1));
+
+            __m256i a3 = _mm256_set1_epi32(load_pair(a + 6));
+            c30 = _mm256_add_epi32(c30, _mm256_madd_epi16(a3, b0));
+            c31 = _mm256_add_epi32(c31, _mm256_madd_epi16(a3, b1));
+        }
+
+        auto* out = reinterpret_cast<__m256i*>(tile);
+        _mm256_storeu_si256(out + 0, c00);
+        _mm256_storeu_si256(out + 1, c01);
+        _mm256_storeu_si256(out + 2, c10);
+        _mm256_storeu_si256(out + 3, c11);
+        _mm256_storeu_si256(out + 4, c20);
+        _mm256_storeu_si256(out + 5, c21);
+        _mm256_storeu_si256(out + 6, c30);
+        _mm256_storeu_si256(out + 7, c31);
+    }
+
+    [[gnu::target("avx512f")]] inline __m512i broadcast_pair(const int16_t* a) {
+        return _mm512_set1_epi32(load_pair(a));
+    }
+
+    [[gnu::target("avx512f,avx512bw")]] inline __m512i madd_pair(
+        const int16_t* a,
+        __m512i b) {
+        return _mm512_madd_epi16(broadcast_pair(a), b);
+    }
+
+    [[gnu::target("avx512f,avx512bw")]] void micro_kernel_s8_avx512(
+        size_t kp,
+        const int16_t* a,
+        const int16_t* b,
+        int32_t* tile) {
+        constexpr size_t MR = Tile<int8_t>::MR, NR = Tile<int8_t>::NR;
+
+        // One vector of 16 sums per row, pairs unrolled by two into
+        // separate accumulators like the float kernels
+        __m512i c0 = _mm512_setzero_si512(), d0 = _mm512_setzero_si512();
+        __m512i c1 = _mm512_setzero_si512(), d1 = _mm512_setzero_si512();
+        __m512i c2 = _mm512_setzero_si512(), d2 = _mm512_setzero_si512();
+        __m512i c3 = _mm512_setzero_si512(), d3 = _mm512_setzero_si512();
+
+        size_t p = 0;
+        for (; p + 2 <= kp; p += 2, a += 4 * MR, b += 4 * NR) {
+            __m512i b0 = _mm512_loadu_si512(b);
+            __m512i b1 = _mm512_loadu_si512(b + 2 * NR);
+
+            c0 = _mm512_add_epi32(c0, madd_pair(a + 0, b0));
+            c1 = _mm512_add_epi32(c1, madd_pair(a + 2, b0));
+            c2 = _mm512_add_epi32(c2, madd_pair(a + 4, b0));
+            c3 = _mm512_add_epi32(c3, madd_pair(a + 6, b0));
+
+            d0 = _mm512_add_epi32(d0, madd_pair(a + 2 * MR + 0, b1));
+            d1 = _mm512_add_epi32(d1, madd_pair(a + 2 * MR + 2, b1));
+            d2 = _mm512_add_epi32(d2, madd_pair(a + 2 * MR + 4, b1));
+            d3 = _mm512_add_epi32(d3, madd_pair(a + 2 * MR + 6, b1));
+        }
+
+        if (p < kp) {
+            __m512i b0 = _mm512_loadu_si512(b);
+            c0         = _mm512_add_epi32(c0, madd_pair(a + 0, b0));
+            c1         = _mm512_add_epi32(c1, madd_pair(a + 2, b0));
+            c2         = _mm512_add_epi32(c2, madd_pair(a + 4, b0));
+            c3         = _mm512_add_epi32(c3, madd_pair(a + 6, b0));
+        }
+
+        _mm512_storeu_si512(tile + 0 * NR, _mm512_add_epi32(c0, d0));
+        _mm512_storeu_si512(tile + 1 * NR, _mm512_add_epi32(c1, d1));
+        _mm512_storeu_si512(tile + 2 * NR, _mm512_add_epi32(c2, d2));
+        _mm512_storeu_si512(tile + 3 * NR, _mm512_add_epi32(c3, d3));
+    }
+
+    [[gnu::target("avx512f,avx512vnni")]] void micro_kernel_s8_vnni(
+        size_t kp,
+        const int16_t* a,
+        const int16_t* b,
+        int32_t* tile) {
+        constexpr size_t MR = Tile<int8_t>::MR, NR = Tile<int8_t>::NR;
+
+        // As above with the multiply and add fused into one instruction
+        __m512i c0 = _mm512_setzero_si512(), d0 = _mm512_setzero_si512();
+        __m512i c1 = _mm512_setzero_si512(), d1 = _mm512_setzero_si512();
+        __m512i c2 = _mm512_setzero_si512(), d2 = _mm512_setzero_si512();
+        __m512i c3 = _mm512_setzero_si512(), d3 = _mm512_setzero_si512();
+
+        size_t p = 0;
+        for (; p + 2 <= kp; p += 2, a += 4 * MR, b += 4 * NR) {
+            __m512i b0 = _mm512_loadu_si512(b);
+            __m512i b1 = _mm512_loadu_si512(b + 2 * NR);
+
+            c0 = _mm512_dpwssd_epi32(c0, broadcast_pair(a + 0), b0);
+            c1 = _mm512_dpwssd_epi32(c1, broadcast_pair(a + 2), b0);
+            c2 = _mm512_dpwssd_epi32(c2, broadcast_pair(a + 4), b0);
+            c3 = _mm512_dpwssd_epi32(c3, broadcast_pair(a + 6), b0);
+
+            d0 = _mm512_dpwssd_epi32(d0, broadcast_pair(a + 2 * MR + 0), b1);
+            d1 = _mm512_dpwssd_epi32(d1, broadcast_pair(a + 2 * MR + 2), b1);
+            d2 = _mm512_dpwssd_epi32(d2, broadcast_pair(a + 2 * MR + 4), b1);
+            d3 = _mm512_dpwssd_epi32(d3, broadcast_pair(a + 2 * MR + 6), b1);
+        }
+
+        if (p < kp) {
+            __m512i b0 = _mm512_loadu_si512(b);
+            c0         = _mm512_dpwssd_epi32(c0, broadcast_pair(a + 0), b0);
+            c1         = _mm512_dpwssd_epi32(c1, broadcast_pair(a + 2), b0);
+            c2         = _mm512_dpwssd_epi32(c2, broadcast_pair(a + 4), b0);
+            c3         = _mm512_dpwssd_epi32(c3, broadcast_pair(a + 6), b0);
+        }
+
+        _mm512_storeu_si512(tile + 0 * NR, _mm512_add_epi32(c0, d0));
+        _mm512_storeu_si512(tile + 1 * NR, _mm512_add_epi32(c1, d1));
+        _mm512_storeu_si512(tile + 2 * NR, _mm512_add_epi32(c2, d2));
+        _mm512_storeu_si512(tile + 3 * NR, _mm512_add_epi32(c3, d3));
+    }
+
+    MicroKernelS8 select_micro_kernel_s8() {
+        static const MicroKernelS8 kernel = [] -> MicroKernelS8 {
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx512vnni"))
+                return micro_kernel_s8_vnni;
+            if (__builtin_cpu_supports("avx512bw"))
+                return micro_kernel_s8_avx512;
+            if (__builtin_cpu_supports("avx2"))
+                return micro_kernel_s8_avx2;
+            return micro_kernel_s8_generic;
+        }();
+        return kernel;
+    }
+
+    // Packing widens to int16 and pads k to an even count
+    void pack_a_s8(size_t mc, size_t kc, Matrix<const int8_t> A, int16_t* buf) {
+        constexpr size_t MR = Tile<int8_t>::MR;
+
+        for (size_t ir = 0; ir < mc; ir += MR) {
+            size_t mr = std::min(MR, mc - ir);
+
+            for (size_t p = 0; p < kc; p += 2, buf += 2 * MR)
+                for (size_t i = 0; i < MR; i++) {
+                    bool odd       = i < mr && p + 1 < kc;
+                    buf[2 * i]     = i < mr ? *A.at(ir + i, p) : 0;
+                    buf[2 * i + 1] = odd ? *A.at(ir + i, p + 1) : 0;
+                }
+        }
+    }
+
+    void pack_b_s8(size_t kc, size_t nc, Matrix<const int8_t> B, int16_t* buf) {
+        constexpr size_t NR = Tile<int8_t>::NR;
+
+        for (size_t jr = 0; jr < nc; jr += NR) {
+            size_t nr = std::min(NR, nc - jr);
+
+            for (size_t p = 0; p < kc; p += 2, buf += 2 * NR)
+                for (size_t j = 0; j < NR; j++) {
+                    bool odd       = j < nr && p + 1 < kc;
+                    buf[2 * j]     = j < nr ? *B.at(p, jr + j) : 0;
+                    buf[2 * j + 1] = odd ? *B.at(p + 1, jr + j) : 0;
+                }
+        }
+    }
+
+    void gemm_s8(size_t M,
+                 size_t N,
+                 size_t K,
+                 Matrix<const int8_t> A,
+                 Matrix<const int8_t> B,
+                 Matrix<int32_t> C,
+                 bool accumulate) {
+        constexpr size_t MR = Tile<int8_t>::MR, NR = Tile<int8_t>::NR;
+
+        if (M == 0 || N == 0)
+            return;
+
+        if (K == 0) {
+            if (!accumulate)
+                for (size_t i = 0; i < M; i++)
+                    for (size_t j = 0; j < N; j++)
+                        *C.at(i, j) = 0;
+            return;
+        }
+
+        MicroKernelS8 kernel = select_micro_kernel_s8();
+
+        thread_local std::vector<int16_t> b_pack;
+        b_pack.resize(round_up(std::min(NC, N), NR)
+                      * round_up(std::min(KC, K), 2));
+
+        size_t m_blocks = (M + MC - 1) / MC;
+
+        for (size_t jc = 0; jc < N; jc += NC) {
+            size_t nc = std::min(NC, N - jc);
+
+            for (size_t pc = 0; pc < K; pc += KC) {
+                size_t kc = std::min(KC, K - pc);
+                size_t kp = (kc + 1) / 2;
+                bool add  = accumulate || pc > 0;
+
+                pack_b_s8(kc, nc, B.block(pc, jc), b_pack.data());
+
+                const int16_t* b_packed = b_pack.data();
+
+                size_t flops = MC * nc * kc;
+                size_t grain = std::max<size_t>(
+                    1, 8 * thread_pool::GRAIN_SIZE / flops);
+
+                auto row_blocks = [&](size_t begin, size_t end) {
+                    thread_local std::vector<int16_t> a_pack;
+                    a_pack.resize(MC * round_up(KC, 2));
+
+                    int32_t tile[MR * NR];
+
+                    for (size_t blk = begin; blk < end; blk++) {
+                        size_t ic = blk * MC;
+                        size_t mc = std::min(MC, M - ic);
+
+                        pack_a_s8(mc, kc, A.block(ic, pc), a_pack.data());
+
+                        for (size_t jr = 0; jr < nc; jr += NR) {
+                            size_t nr = std::min(NR, nc - jr);
+
+                            for (size_t ir = 0; ir < mc; ir += MR) {
+                                size_t mr = std::min(MR, mc - ir);
+
+                                kernel(kp,
+                                       a_pack.data() + ir * 2 * kp,
+                                       b_packed + jr * 2 * kp,
+                                       tile);
+
+                                Matrix<int32_t> c = C.block(ic + ir, jc + jr);
+                                for (size_t i = 0; i < mr; i++)
+                                    for (size_t j = 0; j < nr; j++) {
+                                        int32_t& dst = *c.at(i, j);
+                                        dst = add ? dst + tile[i * NR + j]
+                                                  : tile[i * NR + j];
+                                    }
+                            }
+                        }
+                    }
+                };
+
+                thread_pool::parallel_for(0, m_blocks, grain, row_blocks);
+            }
+        }
+    }
+
+    template void gemm(size_t,
+                       size_t,
+                       size_t,
+                       ConstMatrix,
+                       ConstMatrix,
+                       MutMatrix,
+                       bool);
+    template void gemm(size_t,
+                       size_t,
+                       size_t,
+                       Matrix<const float>,
+                       Matrix<const float>,
+                       Matrix<float>,
+                       bool);
+
+    template void gemm_batched(size_t,
+                               size_t,
+                               size_t,
+                               size_t,
+                               const ConstMatrix*,
+                               const ConstMatrix*,
+                               const MutMatrix*,
+                               bool);
+    template void gemm_batched(size_t,
+                               size_t,
+                               size_t,
+                               size_t,
+                               const Matrix<const float>*,
+                               const Matrix<const float>*,
+                               const Matrix<float>*,
+                               bool);
+
+}  // namespace gemm
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace gemm {
+    // Cache-blocked, register-tiled matrix multiply for double and float.
+    //
+    // Follows the usual Goto/BLIS decomposition: B is packed into KC x NC
+    // panels of NR-wide column slivers, A into MC x KC blocks of MR-tall row
+    // slivers, and an MR x NR micro-kernel keeps its tile of C in registers
+    // while streaming both packed slivers. Operands are described by row and
+    // column strides, so transposed or otherwise strided inputs are consumed
+    // directly by the packing routines.
+
+    // Micro-kernel tile, MR rows by NR columns. Float tiles are twice as
+    // wide and fill the same vector registers.
+    template <typename T>
+    struct Tile;
+
+    template <>
+    struct Tile<double> {
+        static constexpr size_t MR = 4;
+        static constexpr size_t NR = 8;
+    };
+
+    template <>
+    struct Tile<float> {
+        static constexpr size_t MR = 4;
+        static constexpr size_t NR = 16;
+    };
+
+    // Integer tile of int8 x int8 -> int32 products. Operands are packed
+    // as int16 pairs along k so one multiply-add covers two steps of k.
+    template <>
+    struct Tile<int8_t> {
+        static constexpr size_t MR = 4;
+        static constexpr size_t NR = 16;
+    };
+
+    constexpr size_t KC = 256;
+    constexpr size_t MC = 96;
+    constexpr size_t NC = 1024;
+
+    // Strided view of a matrix: element (i, j) lives at ptr[i * rs + j * cs]
+    template <typename T>
+    struct Matrix {
+        T* ptr;
+        std::ptrdiff_t rs;
+        std::ptrdiff_t cs;
+
+        T* at(size_t i, size_t j) const {
+            return ptr + static_cast<std::ptrdiff_t>(i) * rs
+                   + static_cast<std::ptrdiff_t>(j) * cs;
+        }
+
+        Matrix block(size_t i, size_t j) const {
+            return { at(i, j), rs, cs };
+        }
+
+        Matrix transposed() const {
+            return { ptr, cs, rs };
+        }
+
+        bool operator==(const Matrix&) const = default;
+    };
+
+    using ConstMatrix = Matrix<const double>;
+    using MutMatrix   = Matrix<double>;
+
+    // C = A * B, or C += A * B when `accumulate` is set.
+    // A is M x K, B is K x N and C is M x N.
+    template <typename T>
+    void gemm(size_t M,
+              size_t N,
+              size_t K,
+              Matrix<const T> A,
+              Matrix<const T> B,
+              Matrix<T> C,
+              bool accumulate = false);
+
+    // C[i] = A[i] * B[i] for i < batch, all products sharing M, N and K.
+    // When every B[i] (or every A[i]) is the same matrix its packed panels
+    // are built once and shared by the whole batch, otherwise batches are
+    // distributed over the thread pool.
+    template <typename T>
+    void gemm_batched(size_t batch,
+                      size_t M,
+                      size_t N,
+                      size_t K,
+                      const Matrix<const T>* A,
+                      const Matrix<const T>* B,
+                      const Matrix<T>* C,
+                      bool accumulate = false);
+
+    // C = A * B, or C += A * B, for int8 operands with exact int32 sums.
+    // Sums stay in range for K up to 2^17.
+    void gemm_s8(size_t M,
+                 size_t N,
+                 size_t K,
+                 Matrix<const int8_t> A,
+                 Matrix<const int8_t> B,
+                 Matrix<int32_t> C,
+                 bool accumulate = false);
+
+}  // namespace gemm
@@ -5,6 +5,7 @@
 #include <concepts>
 #include <functional>
 #include <numeric>
+#include <ranges>
 #include <vector>
 
 namespace generic_operators {
@@ -37,6 +38,33 @@ namespace generic_operators {
         return x + y;
     }
 
+    template <Arithmetic T>
+    auto sub(const T& x, const T& y) {
+        return x - y;
+    }
+
+    template <Arithmetic T>
+    auto div(const T& x, const T& y) {
+        return x / (y + static_cast<T>(EPS));
+    }
+
+    // Operand-swapped variants, used when the tensor is the right-hand side
+    // of an operation with a constant
+    template <Arithmetic T>
+    auto rsub(const T& x, const T& c) {
+        return c - x;
+    }
+
+    template <Arithmetic T>
+    auto rdiv(const T& x, const T& c) {
+        return c / (x + static_cast<T>(EPS));
+    }
+
+    template <Arithmetic T>
+    auto gt(const T& x, const T& y) {
+        return x > y ? 1 : 0;
+    }
+
     template <Arithmetic T>
     auto neg(const T& x) {
         return -x;
@@ -135,20 +163,23 @@ namespace generic_operators {
         return result;
     }
 
-    template <typename F, Arithmetic T>
-    auto reduce(F fn, T start, const std::vector<T>& ls) {
+    // Over any range, shapes are small vectors rather than std::vector
+    template <typename F, Arithmetic T, std::ranges::input_range R>
+    auto reduce(F fn, T start, const R& ls) {
         return std::accumulate(ls.begin(), ls.end(), start, fn);
     }
 
     // Utility functions using high order function defined above
 
-    template <Arithmetic T>
-    auto sum(const std::vector<T>& ls) {
+    template <std::ranges::input_range R,
+              Arithmetic T = std::ranges::range_value_t<R>>
+    auto sum(const R& ls) {
         return std::accumulate(ls.begin(), ls.end(), T(0));
     }
 
-    template <Arithmetic T>
-    auto prod(const std::vector<T>& ls) {
+    template <std::ranges::input_range R,
+              Arithmetic T = std::ranges::range_value_t<R>>
+    auto prod(const R& ls) {
         return reduce(std::multiplies<T>(), T(1), ls);
     }
 
@@ -0,0 +1,73 @@
+#include <immintrin.h>
+
+#include "half.hpp"
+
+namespace half {
+
+    bool has_f16c() {
+        static const bool supported = [] {
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx")
+                   && __builtin_cpu_supports("f16c");
+        }();
+        return supported;
+    }
+
+    [[gnu::target("avx,f16c")]] void to_float_f16c(const Half* in,
+                                                   float* out,
+                                                   size_t n) {
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            auto* src = reinterpret_cast<const __m128i*>(in + i);
+            __m128i h = _mm_loadu_si128(src);
+            _mm256_storeu_ps(out + i, _mm256_cvtph_ps(h));
+        }
+        for (; i < n; i++)
+            out[i] = in[i];
+    }
+
+    [[gnu::target("avx,f16c")]] void from_float_f16c(const float* in,
+                                                     Half* out,
+                                                     size_t n) {
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(in + i),
+                                        _MM_FROUND_TO_NEAREST_INT);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), h);
+        }
+        for (; i < n; i++)
+            out[i] = in[i];
+    }
+
+    void to_float(const Half* in, float* out, size_t n) {
+        if (has_f16c()) {
+            to_float_f16c(in, out, n);
+            return;
+        }
+        for (size_t i = 0; i < n; i++)
+            out[i] = in[i];
+    }
+
+    void from_float(const float* in, Half* out, size_t n) {
+        if (has_f16c()) {
+            from_float_f16c(in, out, n);
+            return;
+        }
+        for (size_t i = 0; i < n; i++)
+            out[i] = in[i];
+    }
+
+    // BFloat16 conversions are integer shifts and adds, which the
+    // compiler vectorizes without any special instructions
+
+    void to_float(const BFloat16* in, float* out, size_t n) {
+        for (size_t i = 0; i < n; i++)
+            out[i] = in[i];
+    }
+
+    void from_float(const float* in, BFloat16* out, size_t n) {
+        for (size_t i = 0; i < n; i++)
+            out[i] = in[i];
+    }
+
+}  // namespace half
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+namespace half {
+    // 16-bit floating point storage types.
+    //
+    // Half is IEEE binary16 (fp16), BFloat16 keeps the float exponent with
+    // a 7-bit mantissa. Both are storage only: values convert to float on
+    // load and round to nearest even on store, arithmetic and accumulation
+    // stay in float or wider. Bulk conversions use F16C when the CPU has
+    // it and an exact software fallback otherwise.
+
+    inline float half_bits_to_float(uint16_t h) {
+        uint32_t sign = static_cast<uint32_t>(h & 0x8000u) << 16;
+        uint32_t exp  = (h >> 10) & 0x1fu;
+        uint32_t mant = h & 0x3ffu;
+
+        if (exp == 0x1f)  // inf or nan
+            return std::bit_cast<float>(sign | 0x7f800000u | (mant << 13));
+        if (exp != 0)
+            return std::bit_cast<float>(sign | ((exp + 112) << 23)
+                                        | (mant << 13));
+
+        // Zero or subnormal, mant * 2^-24 is exact in float
+        float value = static_cast<float>(mant) * 0x1p-24f;
+        return sign ? -value : value;
+    }
+
+    inline uint16_t float_to_half_bits(float f) {
+        uint32_t x    = std::bit_cast<uint32_t>(f);
+        uint32_t sign = (x >> 16) & 0x8000u;
+        uint32_t abs  = x & 0x7fffffffu;
+
+        if (abs > 0x7f800000u)  // nan, kept quiet
+            return static_cast<uint16_t>(sign | 0x7e00u);
+        if (abs >= 0x477ff000u)  // rounds past 65504
+            return static_cast<uint16_t>(sign | 0x7c00u);
+
+        if (abs < 0x38800000u) {
+            // Below the smallest normal, round the value in units of 2^-24
+            float units = std::bit_cast<float>(abs) * 0x1p24f;
+            return static_cast<uint16_t>(sign | std::lrint(units));
+        }
+
+        // Rebias the exponent and round the mantissa to nearest even, a
+        // carry out of the mantissa correctly bumps the exponent
+        uint32_t rounded = abs + 0xfffu + ((abs >> 13) & 1u);
+        return static_cast<uint16_t>(sign | ((rounded - (112u << 23)) >> 13));
+    }
+
+    inline float bfloat16_bits_to_float(uint16_t b) {
+        return std::bit_cast<float>(static_cast<uint32_t>(b) << 16);
+    }
+
+    inline uint16_t float_to_bfloat16_bits(float f) {
+        uint32_t x = std::bit_cast<uint32_t>(f);
+
+        if ((x & 0x7fffffffu) > 0x7f800000u)  // nan, kept quiet
+            return static_cast<uint16_t>((x >> 16) | 0x40u);
+
+        return static_cast<uint16_t>((x + 0x7fffu + ((x >> 16) & 1u)) >> 16);
+    }
+
+    struct Half {
+        uint16_t bits = 0;
+
+        Half() = default;
+
+        Half(float value)
+            : bits(float_to_half_bits(value)) {
+        }
+
+        static Half from_bits(uint16_t bits) {
+            Half h;
+            h.bits = bits;
+            return h;
+        }
+
+        operator float() const {
+            return half_bits_to_float(bits);
+        }
+
+        bool operator==(const Half&) const = default;
+    };
+
+    struct BFloat16 {
+        uint16_t bits = 0;
+
+        BFloat16() = default;
+
+        BFloat16(float value)
+            : bits(float_to_bfloat16_bits(value)) {
+        }
+
+        static BFloat16 from_bits(uint16_t bits) {
+            BFloat16 b;
+            b.bits = bits;
+            return b;
+        }
+
+        operator float() const {
+            return bfloat16_bits_to_float(bits);
+        }
+
+        bool operator==(const BFloat16&) const = default;
+    };
+
+    template <typename T>
+    constexpr bool is_half = std::is_same_v<T, Half>
+                             || std::is_same_v<T, BFloat16>;
+
+    bool has_f16c();
+
+    // Bulk conversions used by the load and store stages of kernels
+    void to_float(const Half* in, float* out, size_t n);
+    void to_float(const BFloat16* in, float* out, size_t n);
+    void from_float(const float* in, Half* out, size_t n);
+    void from_float(const float* in, BFloat16* out, size_t n);
+
+}  // namespace half
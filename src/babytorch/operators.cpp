@@ -22,6 +22,14 @@ namespace operators {
         return x + y;
     }
 
+    double sub(const double x, const double y) {
+        return x - y;
+    }
+
+    double div(const double x, const double y) {
+        return x / (y + EPS);
+    }
+
     double neg(const double x) {
         return -x;
     }
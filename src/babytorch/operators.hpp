@@ -15,6 +15,8 @@ namespace operators {
     double exp_func(const double x);
     double mul(const double x, const double y);
     double add(const double x, const double y);
+    double sub(const double x, const double y);
+    double div(const double x, const double y);
     double lt(const double x, const double y);
     double eq(const double x, const double y);
     double max(const double x, const double y);
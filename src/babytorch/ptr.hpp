@@ -2,12 +2,170 @@
 #ifndef COMMON_ALIASES_H
 #define COMMON_ALIASES_H
 
+#include <atomic>
+#include <cstdint>
 #include <memory>
+#include <utility>
 
 template <typename T, typename Deleter = std::default_delete<T>>
 using uptr = std::unique_ptr<T, Deleter>;
 
+// Reference count embedded in the object, managed by iptr. Copies of
+// the object start out unreferenced.
+//
+// Builds with BABYTORCH_NONATOMIC_REFCOUNT count references with plain
+// increments, for programs that never share tensors between threads.
+class RefCounted {
+public:
+    RefCounted() = default;
+
+    RefCounted(const RefCounted&) noexcept {
+    }
+
+    RefCounted& operator=(const RefCounted&) noexcept {
+        return *this;
+    }
+
+#ifdef BABYTORCH_NONATOMIC_REFCOUNT
+    size_t use_count() const noexcept {
+        return refs;
+    }
+#else
+    size_t use_count() const noexcept {
+        return refs.load(std::memory_order_relaxed);
+    }
+#endif
+
+protected:
+    ~RefCounted() = default;
+
+private:
+    template <typename T>
+    friend class iptr;
+
+#ifdef BABYTORCH_NONATOMIC_REFCOUNT
+    mutable uint32_t refs = 0;
+
+    void retain() const noexcept {
+        refs++;
+    }
+
+    // Whether this was the last reference
+    bool release() const noexcept {
+        return --refs == 0;
+    }
+#else
+    mutable std::atomic<uint32_t> refs = 0;
+
+    void retain() const noexcept {
+        refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Whether this was the last reference
+    bool release() const noexcept {
+        return refs.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    }
+#endif
+};
+
+// Intrusive counterpart of std::shared_ptr for RefCounted types. Moves
+// only hand the pointer over, and a handle can be made from a raw
+// pointer to an object that is already referenced.
+template <typename T>
+class iptr {
+public:
+    iptr() noexcept = default;
+
+    iptr(std::nullptr_t) noexcept {
+    }
+
+    explicit iptr(T* ptr) noexcept
+        : ptr(ptr) {
+        if (ptr)
+            ptr->retain();
+    }
+
+    iptr(const iptr& other) noexcept
+        : iptr(other.ptr) {
+    }
+
+    iptr(iptr&& other) noexcept
+        : ptr(std::exchange(other.ptr, nullptr)) {
+    }
+
+    iptr& operator=(iptr other) noexcept {
+        std::swap(ptr, other.ptr);
+        return *this;
+    }
+
+    ~iptr() {
+        if (ptr && ptr->release())
+            delete ptr;
+    }
+
+    void reset() noexcept {
+        iptr().swap(*this);
+    }
+
+    void swap(iptr& other) noexcept {
+        std::swap(ptr, other.ptr);
+    }
+
+    T* get() const noexcept {
+        return ptr;
+    }
+
+    T& operator*() const noexcept {
+        return *ptr;
+    }
+
+    T* operator->() const noexcept {
+        return ptr;
+    }
+
+    explicit operator bool() const noexcept {
+        return ptr != nullptr;
+    }
+
+    size_t use_count() const noexcept {
+        return ptr ? ptr->use_count() : 0;
+    }
+
+    // Templates, so that operators T declares on its handles win
+    template <typename U>
+    friend bool operator==(const iptr& a, const iptr<U>& b) noexcept {
+        return a.get() == b.get();
+    }
+
+    friend bool operator==(const iptr& a, std::nullptr_t) noexcept {
+        return a.ptr == nullptr;
+    }
+
+private:
+    T* ptr = nullptr;
+};
+
+template <typename T, typename... Args>
+iptr<T> make_iptr(Args&&... args) {
+    return iptr<T>(new T(std::forward<Args>(args)...));
+}
+
+namespace tensor {
+    class Tensor;
+}
+
+// Shared handle of a type, tensors are intrusively counted
+template <typename T>
+struct shared_handle {
+    using type = std::shared_ptr<T>;
+};
+
+template <>
+struct shared_handle<tensor::Tensor> {
+    using type = iptr<tensor::Tensor>;
+};
+
 template <typename T>
-using sptr = std::shared_ptr<T>;
+using sptr = typename shared_handle<T>::type;
 
 #endif  // COMMON_ALIASES_H
@@ -0,0 +1,456 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "gemm.hpp"
+#include "quantize.hpp"
+#include "tensor.hpp"
+#include "tensor_iterator.hpp"
+#include "thread_pool.hpp"
+
+namespace quantize {
+
+    using tensor_data::IndexingError;
+    using tensor_data::Shape;
+    using tensor_data::Strides;
+    using tensor_data::TensorDataInfo;
+    using tensor_data::visit_float_dtype;
+
+    using tensor_iterator::broadcast_strides;
+    using tensor_iterator::StridedIterator;
+
+    using thread_pool::GRAIN_SIZE;
+    using thread_pool::parallel_for;
+
+    constexpr int32_t QMIN = std::numeric_limits<int8_t>::min();
+    constexpr int32_t QMAX = std::numeric_limits<int8_t>::max();
+
+    int8_t saturate(float value) {
+        return static_cast<int8_t>(
+            std::clamp<float>(std::nearbyint(value), QMIN, QMAX));
+    }
+
+    // Calls fn(out, in) for every element, with `out` the row-major index
+    // of the element and `in` its position in strided storage
+    template <typename Fn>
+    void for_each_element(const Shape& shape,
+                          const Strides& strides,
+                          const Fn& fn,
+                          bool parallel = true) {
+        Strides out_strides = tensor_data::strides_from_shape(shape);
+
+        StridedIterator<2> it(shape,
+                              { broadcast_strides(shape, out_strides, shape),
+                                broadcast_strides(shape, strides, shape) });
+
+        if (it.empty())
+            return;
+
+        auto [out_step, in_step] = it.inner_stride;
+
+        auto rows = [&](size_t b, size_t e) {
+            StridedIterator<2> row_it = it;
+            row_it.seek(b);
+
+            for (size_t row = b; row < e; row++, row_it.next()) {
+                auto [out_pos, in_pos] = row_it.pos;
+                for (std::ptrdiff_t i = 0; i < row_it.inner; i++)
+                    fn(out_pos + i * out_step, in_pos + i * in_step);
+            }
+        };
+
+        size_t grain = std::max<size_t>(1, GRAIN_SIZE / it.inner);
+
+        if (parallel)
+            parallel_for(0, it.rows(), grain, rows);
+        else
+            rows(0, it.rows());
+    }
+
+    // Maps a row-major element index to its channel
+    struct Channels {
+        size_t inner = 1;
+        size_t count = 1;
+
+        Channels(const QuantParams& params, const Shape& shape) {
+            if (!params.per_channel())
+                return;
+
+            count = shape[params.axis];
+            for (size_t d = params.axis + 1; d < shape.size(); d++)
+                inner *= shape[d];
+        }
+
+        size_t operator()(size_t index) const {
+            return count == 1 ? 0 : index / inner % count;
+        }
+    };
+
+    void check_params(const QuantParams& params, const Shape& shape) {
+        size_t channels = params.per_channel()
+                              && size_t(params.axis) < shape.size()
+                              ? shape[params.axis]
+                              : 1;
+
+        if (params.scales.size() != channels
+            || params.zero_points.size() != channels
+            || (params.per_channel() && size_t(params.axis) >= shape.size()))
+            throw IndexingError(
+                "IndexingError: Quantization parameters do not match the "
+                "tensor shape.");
+    }
+
+    const QuantParams& params_of(const sptr<Tensor>& q) {
+        q->realize();
+        if (!q->data->qparams)
+            throw IndexingError("IndexingError: Tensor is not quantized.");
+        return *q->data->qparams;
+    }
+
+    const QuantParams& per_tensor_params_of(const sptr<Tensor>& q) {
+        const QuantParams& params = params_of(q);
+        if (params.per_channel() || q->dtype() != DType::Int8)
+            throw IndexingError(
+                "IndexingError: Expected an int8 tensor quantized per tensor.");
+        return params;
+    }
+
+    sptr<Tensor> quantized_zeros(const Shape& shape,
+                                 DType dtype,
+                                 QuantParams params) {
+        auto out = Tensor::zeros(shape, dtype);
+        out->data->qparams = std::make_shared<const QuantParams>(
+            std::move(params));
+        return out;
+    }
+
+    QuantParams calibrate(const sptr<Tensor>& x, int axis) {
+        auto [storage, shape, strides] = x->info();
+        tensor_data::check_floating(storage.dtype());
+
+        if (axis >= static_cast<int>(shape.size()))
+            throw IndexingError(
+                "IndexingError: Quantization axis out of range.");
+
+        QuantParams params;
+        params.axis = axis < 0 ? -1 : axis;
+
+        Channels channel(params, shape);
+        std::vector<double> lo(channel.count, 0.0), hi(channel.count, 0.0);
+
+        visit_float_dtype(storage.dtype(), [&]<typename T>() {
+            const T* in = storage.as<T>();
+            for_each_element(
+                shape,
+                strides,
+                [&](size_t out, std::ptrdiff_t pos) {
+                    size_t c = channel(out);
+                    lo[c]    = std::min(lo[c], double(in[pos]));
+                    hi[c]    = std::max(hi[c], double(in[pos]));
+                },
+                false);
+        });
+
+        for (size_t c = 0; c < channel.count; c++) {
+            if (params.per_channel()) {
+                double bound = std::max(-lo[c], hi[c]);
+                params.scales.push_back(bound > 0 ? bound / QMAX : 1.0);
+                params.zero_points.push_back(0);
+                continue;
+            }
+
+            // The range always holds 0, so zero stays exact
+            double range = hi[c] - lo[c];
+            double scale = range > 0 ? range / (QMAX - QMIN) : 1.0;
+            auto zero    = static_cast<int32_t>(
+                std::nearbyint(QMIN - lo[c] / scale));
+            params.scales.push_back(scale);
+            params.zero_points.push_back(std::clamp(zero, QMIN, QMAX));
+        }
+
+        return params;
+    }
+
+    sptr<Tensor> quantize(const sptr<Tensor>& x, const QuantParams& params) {
+        auto [storage, shape, strides] = x->info();
+        tensor_data::check_floating(storage.dtype());
+        check_params(params, shape);
+
+        auto out  = quantized_zeros(shape, DType::Int8, params);
+        int8_t* q = out->data->_storage.as<int8_t>();
+
+        Channels channel(params, shape);
+        std::vector<float> inv_scales(params.scales.size());
+        for (size_t c = 0; c < params.scales.size(); c++)
+            inv_scales[c] = static_cast<float>(1.0 / params.scales[c]);
+
+        visit_float_dtype(storage.dtype(), [&]<typename T>() {
+            const T* in = storage.as<T>();
+            for_each_element(
+                shape, strides, [&](size_t index, std::ptrdiff_t pos) {
+                    size_t c = channel(index);
+                    q[index] = saturate(float(in[pos]) * inv_scales[c]
+                                      + params.zero_points[c]);
+                });
+        });
+
+        return out;
+    }
+
+    sptr<Tensor> quantize(const sptr<Tensor>& x, int axis) {
+        return quantize(x, calibrate(x, axis));
+    }
+
+    template <typename Q, typename T>
+    void dequantize_into(const TensorDataInfo& in,
+                         const QuantParams& params,
+                         T* out) {
+        auto& [storage, shape, strides] = in;
+        const Q* q = storage.as<Q>();
+
+        Channels channel(params, shape);
+
+        for_each_element(
+            shape, strides, [&](size_t index, std::ptrdiff_t pos) {
+                size_t c   = channel(index);
+                out[index] = static_cast<T>(
+                    params.scales[c]
+                    * (int64_t(q[pos]) - params.zero_points[c]));
+            });
+    }
+
+    sptr<Tensor> dequantize(const sptr<Tensor>& q, DType dtype) {
+        const QuantParams& params = params_of(q);
+        tensor_data::check_floating(dtype);
+
+        auto out = Tensor::zeros(q->shape(), dtype);
+
+        visit_float_dtype(dtype, [&]<typename T>() {
+            T* values = out->data->_storage.template as<T>();
+            if (q->dtype() == DType::Int8)
+                dequantize_into<int8_t>(q->info(), params, values);
+            else
+                dequantize_into<int32_t>(q->info(), params, values);
+        });
+
+        return out;
+    }
+
+    sptr<Tensor> matmul(const sptr<Tensor>& a, const sptr<Tensor>& b) {
+        const QuantParams& a_params = per_tensor_params_of(a);
+        const QuantParams& b_params = params_of(b);
+
+        auto [a_storage, a_shape, a_strides] = a->info();
+        auto [b_storage, b_shape, b_strides] = b->info();
+
+        if (b->dtype() != DType::Int8 || b_shape.size() != 2
+            || (b_params.per_channel() && b_params.axis != 1))
+            throw IndexingError(
+                "IndexingError: Quantized matmul expects a 2-d int8 right "
+                "operand, quantized per tensor or per column.");
+
+        if (a_shape.size() < 2)
+            throw IndexingError(
+                "IndexingError: Matrix multiply expects at least 2-d tensors.");
+
+        size_t a_dims = a_shape.size();
+        size_t M = a_shape[a_dims - 2], K = a_shape[a_dims - 1];
+        size_t N = b_shape[1];
+
+        if (b_shape[0] != K)
+            throw IndexingError(
+                "IndexingError: Inner dimensions of matrix multiply differ.");
+
+        // Output scales, per column when b is
+        QuantParams params;
+        params.axis = b_params.per_channel() ? static_cast<int>(a_dims - 1)
+                                             : -1;
+        for (double scale : b_params.scales) {
+            params.scales.push_back(a_params.scales[0] * scale);
+            params.zero_points.push_back(0);
+        }
+
+        Shape out_shape = a_shape;
+        out_shape.back() = N;
+
+        auto out     = quantized_zeros(out_shape, DType::Int32, params);
+        int32_t* acc = out->data->_storage.as<int32_t>();
+
+        gemm::Matrix<const int8_t> b_mat{ b_storage.as<int8_t>(),
+                                          b_strides[0],
+                                          b_strides[1] };
+
+        // Zero points are folded out of the int32 sums afterwards:
+        // sum (a - za)(b - zb) = sum ab - zb sum a - za sum b + K za zb.
+        // The terms without sum a are one offset per column, the row term
+        // vanishes for symmetric weights.
+        int32_t za = a_params.zero_points[0];
+
+        std::vector<int32_t> zb(N), column(N);
+        for (size_t j = 0; j < N; j++)
+            zb[j] = b_params.zero_points[b_params.per_channel() ? j : 0];
+
+        for (size_t j = 0; j < N; j++) {
+            int32_t b_sum = 0;
+            for (size_t k = 0; k < K; k++)
+                b_sum += *b_mat.at(k, j);
+            column[j] = static_cast<int32_t>(K) * za * zb[j] - za * b_sum;
+        }
+
+        bool row_term = std::ranges::any_of(zb, [](int32_t z) {
+            return z != 0;
+        });
+
+        // Leading dimensions of a are walked like the batches of matmul
+        Shape batch_shape(a_shape.begin(), a_shape.end() - 2);
+        size_t batch = generic_operators::prod(batch_shape);
+
+        tensor_data::Index counter(batch_shape.size(), 0);
+        for (size_t i = 0; i < batch; i++) {
+            std::ptrdiff_t offset = 0;
+            for (size_t d = 0; d < counter.size(); d++)
+                offset += static_cast<std::ptrdiff_t>(counter[d])
+                          * a_strides[d];
+
+            gemm::Matrix<const int8_t> a_mat{ a_storage.as<int8_t>() + offset,
+                                              a_strides[a_dims - 2],
+                                              a_strides[a_dims - 1] };
+            int32_t* c = acc + i * M * N;
+
+            gemm::gemm_s8(M,
+                          N,
+                          K,
+                          a_mat,
+                          b_mat,
+                          { c, static_cast<std::ptrdiff_t>(N), 1 });
+
+            for (size_t r = 0; r < M; r++) {
+                int32_t a_sum = 0;
+                if (row_term)
+                    for (size_t k = 0; k < K; k++)
+                        a_sum += *a_mat.at(r, k);
+
+                int32_t* c_row = c + r * N;
+                for (size_t j = 0; j < N; j++)
+                    c_row[j] += column[j] - zb[j] * a_sum;
+            }
+
+            for (size_t d = counter.size(); d-- > 0;) {
+                if (++counter[d] < batch_shape[d])
+                    break;
+                counter[d] = 0;
+            }
+        }
+
+        return out;
+    }
+
+    // Elementwise kernel over broadcast int8 operands, fn maps the zero
+    // point adjusted operands to the real result divided by the output
+    // scale
+    template <typename Fn>
+    sptr<Tensor> zip_quantized(const Fn& fn,
+                               const sptr<Tensor>& a,
+                               const sptr<Tensor>& b,
+                               const QuantParams& params) {
+        const QuantParams& a_params = per_tensor_params_of(a);
+        const QuantParams& b_params = per_tensor_params_of(b);
+
+        auto [a_storage, a_shape, a_strides] = a->info();
+        auto [b_storage, b_shape, b_strides] = b->info();
+
+        Shape out_shape = tensor_data::shape_broadcast(a_shape, b_shape);
+        check_params(params, out_shape);
+        if (params.per_channel())
+            throw IndexingError(
+                "IndexingError: Expected per tensor output parameters.");
+
+        auto out = quantized_zeros(out_shape, DType::Int8, params);
+
+        StridedIterator<3> it(
+            out_shape,
+            { broadcast_strides(out_shape, out->data->strides, out_shape),
+              broadcast_strides(a_shape, a_strides, out_shape),
+              broadcast_strides(b_shape, b_strides, out_shape) });
+
+        if (it.empty())
+            return out;
+
+        const int8_t* a_ptr = a_storage.as<int8_t>();
+        const int8_t* b_ptr = b_storage.as<int8_t>();
+        int8_t* out_ptr     = out->data->_storage.as<int8_t>();
+
+        int32_t za = a_params.zero_points[0], zb = b_params.zero_points[0];
+        float zo   = static_cast<float>(params.zero_points[0]);
+
+        auto [out_step, a_step, b_step] = it.inner_stride;
+
+        size_t grain = std::max<size_t>(1, GRAIN_SIZE / it.inner);
+
+        parallel_for(0, it.rows(), grain, [&](size_t s, size_t e) {
+            StridedIterator<3> rows = it;
+            rows.seek(s);
+
+            for (size_t row = s; row < e; row++, rows.next()) {
+                auto [out_pos, a_pos, b_pos] = rows.pos;
+                for (std::ptrdiff_t i = 0; i < rows.inner; i++)
+                    out_ptr[out_pos + i * out_step] = saturate(
+                        fn(a_ptr[a_pos + i * a_step] - za,
+                           b_ptr[b_pos + i * b_step] - zb)
+                        + zo);
+            }
+        });
+
+        return out;
+    }
+
+    sptr<Tensor> add(const sptr<Tensor>& a,
+                     const sptr<Tensor>& b,
+                     const QuantParams& out) {
+        auto ka = static_cast<float>(params_of(a).scales[0] / out.scales.at(0));
+        auto kb = static_cast<float>(params_of(b).scales[0] / out.scales.at(0));
+
+        auto fn = [ka, kb](int32_t x, int32_t y) {
+            return ka * x + kb * y;
+        };
+        return zip_quantized(fn, a, b, out);
+    }
+
+    sptr<Tensor> mul(const sptr<Tensor>& a,
+                     const sptr<Tensor>& b,
+                     const QuantParams& out) {
+        auto k = static_cast<float>(params_of(a).scales[0]
+                                    * params_of(b).scales[0]
+                                    / out.scales.at(0));
+
+        auto fn = [k](int32_t x, int32_t y) {
+            return k * float(x * y);
+        };
+        return zip_quantized(fn, a, b, out);
+    }
+
+    sptr<Tensor> relu(const sptr<Tensor>& q) {
+        const QuantParams& params = params_of(q);
+        if (q->dtype() != DType::Int8)
+            throw IndexingError("IndexingError: Expected an int8 tensor.");
+
+        auto [storage, shape, strides] = q->info();
+
+        auto out         = quantized_zeros(shape, DType::Int8, params);
+        const int8_t* in = storage.as<int8_t>();
+        int8_t* values   = out->data->_storage.as<int8_t>();
+
+        Channels channel(params, shape);
+
+        for_each_element(
+            shape, strides, [&](size_t index, std::ptrdiff_t pos) {
+                auto zero = static_cast<int8_t>(
+                    params.zero_points[channel(index)]);
+                values[index] = std::max(in[pos], zero);
+            });
+
+        return out;
+    }
+
+}  // namespace quantize
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "ptr.hpp"
+#include "tensor_data.hpp"
+
+namespace tensor {
+    class Tensor;
+}
+
+namespace quantize {
+    // Int8 quantized inference.
+    //
+    // A quantized tensor stores int8 values q and carries QuantParams on
+    // its data, value = scale * (q - zero_point), either for the whole
+    // tensor or per channel along one axis. Activations are usually
+    // quantized per tensor with a zero point, weights per output channel
+    // and symmetric. Products run as int8 x int8 -> int32 GEMMs, the int32
+    // result carries the combined scales so dequantize() turns it back
+    // into floats. None of these ops are recorded by autograd.
+
+    using tensor::Tensor;
+    using tensor_data::DType;
+    using tensor_data::QuantParams;
+
+    // Parameters covering the range of `x`. Per tensor when axis < 0,
+    // asymmetric over [min, max]. Per channel along `axis` otherwise,
+    // symmetric over [-max |x|, max |x|] with zero points of 0.
+    QuantParams calibrate(const sptr<Tensor>& x, int axis = -1);
+
+    sptr<Tensor> quantize(const sptr<Tensor>& x, const QuantParams& params);
+    sptr<Tensor> quantize(const sptr<Tensor>& x, int axis = -1);
+
+    // Real values of an int8 or int32 quantized tensor
+    sptr<Tensor> dequantize(const sptr<Tensor>& q,
+                            DType dtype = DType::Float32);
+
+    // Product of [..., M, K] and [K, N] int8 tensors into int32. `a` is
+    // quantized per tensor, `b` per tensor or per column (axis 1). The
+    // result has zero points of 0 and scale(a) * scale(b), per column when
+    // `b` is per column.
+    sptr<Tensor> matmul(const sptr<Tensor>& a, const sptr<Tensor>& b);
+
+    // Elementwise ops on per-tensor quantized operands, which broadcast
+    // like their float counterparts. Results are requantized to `out`.
+    sptr<Tensor> add(const sptr<Tensor>& a,
+                     const sptr<Tensor>& b,
+                     const QuantParams& out);
+    sptr<Tensor> mul(const sptr<Tensor>& a,
+                     const sptr<Tensor>& b,
+                     const QuantParams& out);
+
+    // Keeps the parameters of `q`, real zero is the zero point
+    sptr<Tensor> relu(const sptr<Tensor>& q);
+
+}  // namespace quantize
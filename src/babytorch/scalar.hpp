@@ -109,37 +109,37 @@ namespace scalar {
         // -
 
         friend auto operator-(const sptr<Scalar> self, const sptr<Scalar> other) {
-            return self + ScalarFunction::apply<Neg>(other);
+            return ScalarFunction::apply<Sub>(self, other);
         }
 
         template <typename T>
         friend auto operator-(const sptr<Scalar> self, const T& rhs) {
             auto other = Scalar::create(rhs);
-            return self + ScalarFunction::apply<Neg>(other);
+            return ScalarFunction::apply<Sub>(self, other);
         }
 
         template <typename T>
         friend auto operator-(const T& lhs, const sptr<Scalar> other) {
             auto self = Scalar::create(lhs);
-            return self + ScalarFunction::apply<Neg>(other);
+            return ScalarFunction::apply<Sub>(self, other);
         }
 
         // /
 
         friend auto operator/(const sptr<Scalar> self, const sptr<Scalar> other) {
-            return self * ScalarFunction::apply<Inv>(other);
+            return ScalarFunction::apply<Div>(self, other);
         }
 
         template <typename T>
         friend auto operator/(const sptr<Scalar> self, const T& rhs) {
             auto other = Scalar::create(rhs);
-            return self * ScalarFunction::apply<Inv>(other);
+            return ScalarFunction::apply<Div>(self, other);
         }
 
         template <typename T>
         friend auto operator/(const T& lhs, const sptr<Scalar> other) {
             auto self = Scalar::create(lhs);
-            return self * ScalarFunction::apply<Inv>(other);
+            return ScalarFunction::apply<Div>(self, other);
         }
 
         // <
@@ -0,0 +1,299 @@
+#pragma once
+
+#include <algorithm>
+#include <compare>
+#include <cstddef>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+namespace utils {
+
+    // std::vector look-alike for trivially copyable elements that keeps
+    // up to N of them inline and only goes to the heap beyond that.
+    // Shapes, strides and indices hardly ever have more than a handful of
+    // dimensions, so building and copying them doesn't allocate.
+    template <typename T, size_t N>
+    class SmallVector {
+        static_assert(std::is_trivially_copyable_v<T>);
+
+    public:
+        using value_type             = T;
+        using size_type              = size_t;
+        using difference_type        = std::ptrdiff_t;
+        using reference              = T&;
+        using const_reference        = const T&;
+        using pointer                = T*;
+        using const_pointer          = const T*;
+        using iterator               = T*;
+        using const_iterator         = const T*;
+        using reverse_iterator       = std::reverse_iterator<iterator>;
+        using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+        SmallVector() noexcept = default;
+
+        explicit SmallVector(size_t count, const T& value = T()) {
+            assign(count, value);
+        }
+
+        SmallVector(std::initializer_list<T> values) {
+            assign(values.begin(), values.end());
+        }
+
+        template <std::input_iterator It>
+        SmallVector(It first, It last) {
+            assign(first, last);
+        }
+
+        SmallVector(const SmallVector& other) {
+            assign(other.begin(), other.end());
+        }
+
+        SmallVector(SmallVector&& other) noexcept {
+            take(other);
+        }
+
+        SmallVector& operator=(const SmallVector& other) {
+            if (this != &other)
+                assign(other.begin(), other.end());
+            return *this;
+        }
+
+        SmallVector& operator=(SmallVector&& other) noexcept {
+            if (this != &other) {
+                release();
+                take(other);
+            }
+            return *this;
+        }
+
+        SmallVector& operator=(std::initializer_list<T> values) {
+            assign(values.begin(), values.end());
+            return *this;
+        }
+
+        ~SmallVector() {
+            release();
+        }
+
+        void assign(size_t count, const T& value) {
+            clear();
+            reserve(count);
+            std::uninitialized_fill_n(_data, count, value);
+            _size = count;
+        }
+
+        template <std::input_iterator It>
+        void assign(It first, It last) {
+            clear();
+            if constexpr (std::forward_iterator<It>)
+                reserve(std::distance(first, last));
+            for (; first != last; ++first)
+                push_back(*first);
+        }
+
+        size_t size() const noexcept {
+            return _size;
+        }
+
+        bool empty() const noexcept {
+            return _size == 0;
+        }
+
+        size_t capacity() const noexcept {
+            return _capacity;
+        }
+
+        // Whether the elements still fit inline
+        bool is_inline() const noexcept {
+            return _data == buffer;
+        }
+
+        T* data() noexcept {
+            return _data;
+        }
+
+        const T* data() const noexcept {
+            return _data;
+        }
+
+        T& operator[](size_t i) noexcept {
+            return _data[i];
+        }
+
+        const T& operator[](size_t i) const noexcept {
+            return _data[i];
+        }
+
+        T& front() noexcept {
+            return _data[0];
+        }
+
+        const T& front() const noexcept {
+            return _data[0];
+        }
+
+        T& back() noexcept {
+            return _data[_size - 1];
+        }
+
+        const T& back() const noexcept {
+            return _data[_size - 1];
+        }
+
+        iterator begin() noexcept {
+            return _data;
+        }
+
+        const_iterator begin() const noexcept {
+            return _data;
+        }
+
+        iterator end() noexcept {
+            return _data + _size;
+        }
+
+        const_iterator end() const noexcept {
+            return _data + _size;
+        }
+
+        const_iterator cbegin() const noexcept {
+            return begin();
+        }
+
+        const_iterator cend() const noexcept {
+            return end();
+        }
+
+        reverse_iterator rbegin() noexcept {
+            return reverse_iterator(end());
+        }
+
+        const_reverse_iterator rbegin() const noexcept {
+            return const_reverse_iterator(end());
+        }
+
+        reverse_iterator rend() noexcept {
+            return reverse_iterator(begin());
+        }
+
+        const_reverse_iterator rend() const noexcept {
+            return const_reverse_iterator(begin());
+        }
+
+        void reserve(size_t count) {
+            if (count <= _capacity)
+                return;
+
+            T* grown = std::allocator<T>().allocate(count);
+            std::copy_n(_data, _size, grown);
+            release();
+            _data     = grown;
+            _capacity = count;
+        }
+
+        void resize(size_t count, const T& value = T()) {
+            if (count > _size) {
+                reserve(count);
+                std::uninitialized_fill(_data + _size, _data + count, value);
+            }
+            _size = count;
+        }
+
+        void clear() noexcept {
+            _size = 0;
+        }
+
+        // By value, `value` may be an element moved by the growth
+        void push_back(T value) {
+            if (_size == _capacity)
+                reserve(2 * _capacity);
+            _data[_size++] = value;
+        }
+
+        template <typename... Args>
+        T& emplace_back(Args&&... args) {
+            push_back(T(std::forward<Args>(args)...));
+            return back();
+        }
+
+        void pop_back() noexcept {
+            _size--;
+        }
+
+        iterator insert(const_iterator pos, T value) {
+            size_t at = pos - _data;
+            if (_size == _capacity)
+                reserve(2 * _capacity);
+
+            std::copy_backward(_data + at, _data + _size, _data + _size + 1);
+            _data[at] = value;
+            _size++;
+            return _data + at;
+        }
+
+        template <std::forward_iterator It>
+        iterator insert(const_iterator pos, It first, It last) {
+            size_t at    = pos - _data;
+            size_t count = std::distance(first, last);
+            if (_size + count > _capacity)
+                reserve(std::max(_size + count, 2 * _capacity));
+
+            std::copy_backward(
+                _data + at, _data + _size, _data + _size + count);
+            std::copy(first, last, _data + at);
+            _size += count;
+            return _data + at;
+        }
+
+        iterator erase(const_iterator pos) {
+            return erase(pos, pos + 1);
+        }
+
+        iterator erase(const_iterator first, const_iterator last) {
+            size_t at    = first - _data;
+            size_t count = last - first;
+            std::copy(_data + at + count, _data + _size, _data + at);
+            _size -= count;
+            return _data + at;
+        }
+
+        friend bool operator==(const SmallVector& a, const SmallVector& b) {
+            return std::ranges::equal(a, b);
+        }
+
+        friend auto operator<=>(const SmallVector& a, const SmallVector& b) {
+            return std::lexicographical_compare_three_way(
+                a.begin(), a.end(), b.begin(), b.end());
+        }
+
+    private:
+        T* _data         = buffer;
+        size_t _size     = 0;
+        size_t _capacity = N;
+        T buffer[N];
+
+        void release() noexcept {
+            if (!is_inline())
+                std::allocator<T>().deallocate(_data, _capacity);
+            _data     = buffer;
+            _capacity = N;
+        }
+
+        // Moves the elements of `other` in and leaves it empty
+        void take(SmallVector& other) noexcept {
+            if (other.is_inline()) {
+                std::copy_n(other.buffer, other._size, buffer);
+                _data = buffer;
+            }
+            else {
+                _data     = std::exchange(other._data, other.buffer);
+                _capacity = std::exchange(other._capacity, N);
+            }
+            _size = std::exchange(other._size, 0);
+        }
+    };
+
+}  // namespace utils
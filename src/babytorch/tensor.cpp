@@ -11,43 +11,410 @@
 namespace tensor {
     using namespace tensor_autodiff;
 
+    // Lets a captured step recompute `node`, see tensor_capture.hpp
+    template <typename Recompute>
+    void record(const sptr<Tensor>& node, Recompute recompute) {
+        if (auto* graph = tensor_capture::capturing())
+            graph->record(node, std::move(recompute));
+    }
+
+    // Node whose data `make` computes from `input` alone, a view or a
+    // conversion. While lazy mode is on and `input` is still pending it
+    // is deferred as a Call like the kernels of apply_lazy, `shape` then
+    // gives the shape it will have. A captured step replays `into`, or
+    // assigns the view `make` takes again.
+    template <typename Make, typename ShapeFn, typename Into>
+    sptr<Tensor> derive(const sptr<Tensor>& input,
+                        History history,
+                        DType dtype,
+                        ShapeFn shape,
+                        Make make,
+                        Into into) {
+        sptr<Tensor> result;
+
+        if (tensor_fusion::lazy() && input->pending) {
+            tensor_fusion::Kernel kernel;
+            kernel.operands.emplace_back(input);
+            kernel.run = [input, make] {
+                return std::make_unique<TensorData>(make(*input));
+            };
+
+            result          = make_iptr<Tensor>();
+            result->pending = tensor_fusion::call(
+                shape(), dtype, std::move(kernel));
+        }
+        else {
+            input->realize();
+            result = Tensor::create(std::make_unique<TensorData>(make(*input)));
+            record(result, [input, into](TensorData& out) {
+                into(*input, out);
+            });
+        }
+
+        result->history = std::move(history);
+        return result;
+    }
+
+    template <typename Make, typename ShapeFn>
+    sptr<Tensor> derive(const sptr<Tensor>& input,
+                        History history,
+                        DType dtype,
+                        ShapeFn shape,
+                        Make make) {
+        auto into = [make](const Tensor& from, TensorData& out) {
+            out = make(from);
+        };
+        return derive(input, std::move(history), dtype, shape, make, into);
+    }
+
+    // Single element broadcast to the shape of `input`. Views of it have
+    // the shape the same view of the data will have, without the data.
+    TensorData shape_probe(const Tensor& input) {
+        return TensorData(Storage(1, input.dtype())).expand(input.shape());
+    }
+
+    // Data of `input` in a buffer of its own size, shared when it
+    // already is
+    TensorData contiguous_data(const Tensor& input) {
+        if (input.data->is_contiguous()
+            && input.data->_storage.size() == input.data->size)
+            return *input.data;
+
+        // The kernel directly, recording the copy as an in-place op
+        // would run it twice in a replay
+        auto copy = Tensor::empty(input.shape(), input.dtype());
+        tensor_ops::copy_inplace(*copy->data, input.info());
+        return std::move(*copy->data);
+    }
+
+    // Runs an in-place kernel on the data of `tensor`. A captured step
+    // runs it again after the node it updates was recomputed.
+    template <typename Kernel>
+    sptr<Tensor> update(Tensor& tensor, Kernel kernel) {
+        tensor.realize();
+        kernel(*tensor.data);
+
+        if (auto* graph = tensor_capture::capturing())
+            graph->record_update(tensor.self(), std::move(kernel));
+        return tensor.self();
+    }
+
     Shape Tensor::shape() const {
-        return this->data->shape;
+        return this->pending ? this->pending->shape : this->data->shape;
+    }
+
+    DType Tensor::dtype() const {
+        return this->pending ? this->pending->dtype : this->data->dtype();
+    }
+
+    // Converted copy of the data, without history
+    sptr<Tensor> cast(const Tensor& tensor, DType dtype) {
+        auto [storage, shape, strides] = tensor.info();
+        return Tensor::create(
+            std::make_unique<TensorData>(storage.to(dtype), shape, strides));
     }
 
-    sptr<Tensor> Tensor::zeros(Shape shape) {
-        auto tensor_data = std::make_unique<TensorData>(utils::zeros(shape),
+    sptr<Tensor> Tensor::to(DType dtype) {
+        if (dtype == this->dtype())
+            return self();
+
+        // Integer data needs its quantization parameters, see quantize.hpp
+        check_floating(this->dtype());
+        check_floating(dtype);
+
+        // Gradients flow back in the dtype of the input
+        History history;
+        history.inputs.emplace_back(self());
+        history.backward = [from = this->dtype()](Context&, sptr<Tensor> d_out)
+            -> std::array<sptr<Tensor>, 2> { return { cast(*d_out, from) }; };
+
+        return derive(
+            self(),
+            std::move(history),
+            dtype,
+            [&] { return shape(); },
+            [dtype](const Tensor& input) {
+                return std::move(*cast(input, dtype)->data);
+            },
+            [](const Tensor& input, TensorData& out) {
+                tensor_ops::copy_inplace(out, input.info());
+            });
+    }
+
+    sptr<Tensor> Tensor::zeros(Shape shape, DType dtype) {
+        Storage storage(generic_operators::prod(shape), dtype);
+        auto tensor_data = std::make_unique<TensorData>(std::move(storage),
+                                                        shape);
+        return Tensor::create(std::move(tensor_data));
+    }
+
+    sptr<Tensor> Tensor::empty(Shape shape, DType dtype) {
+        Storage storage = Storage::uninitialized(generic_operators::prod(shape),
+                                                 dtype);
+        auto tensor_data = std::make_unique<TensorData>(std::move(storage),
                                                         shape);
         return Tensor::create(std::move(tensor_data));
     }
 
     sptr<Tensor> Tensor::zeros() const {
-        return Tensor::zeros(this->shape());
+        return Tensor::zeros(this->shape(), this->dtype());
+    }
+
+    sptr<Tensor> Tensor::permute(ReOrderIndex order) {
+        ReOrderIndex inverse(order.size());
+        for (size_t i = 0; i < order.size(); i++)
+            inverse[order[i]] = i;
+
+        History history;
+        history.inputs.emplace_back(self());
+        history.backward = [inverse](Context&, sptr<Tensor> d_out)
+            -> std::array<sptr<Tensor>, 2> {
+            // A plain view, backward builds no graph of its own
+            d_out->realize();
+            return { Tensor::create(
+                std::make_unique<TensorData>(d_out->data->permute(inverse))) };
+        };
+
+        return derive(
+            self(),
+            std::move(history),
+            dtype(),
+            [&] { return shape_probe(*this).permute(order).shape; },
+            [order](const Tensor& input) {
+                return input.data->permute(order);
+            });
+    }
+
+    sptr<Tensor> Tensor::view(Shape shape) {
+        History history;
+        history.inputs.emplace_back(self());
+        history.backward = [from = this->shape()](Context&, sptr<Tensor> d_out)
+            -> std::array<sptr<Tensor>, 2> {
+            d_out->realize();
+            return { Tensor::create(std::make_unique<TensorData>(
+                contiguous_data(*d_out).reshape(from))) };
+        };
+
+        // Contiguity is only known once a pending input is realized,
+        // the element count is checked right away
+        auto deferred_shape = [&] {
+            if (generic_operators::prod(shape)
+                != generic_operators::prod(this->shape()))
+                throw IndexingError(
+                    "IndexingError: View shape does not match the number of "
+                    "elements.");
+            return shape;
+        };
+
+        return derive(
+            self(),
+            std::move(history),
+            dtype(),
+            deferred_shape,
+            [shape](const Tensor& input) {
+                return input.data->reshape(shape);
+            });
+    }
+
+    sptr<Tensor> Tensor::contiguous() {
+        if (!this->pending || !tensor_fusion::lazy()) {
+            realize();
+            if (this->data->is_contiguous()
+                && this->data->_storage.size() == this->data->size)
+                return self();
+        }
+
+        History history;
+        history.inputs.emplace_back(self());
+        history.backward = [](Context&, sptr<Tensor> d_out)
+            -> std::array<sptr<Tensor>, 2> { return { d_out }; };
+
+        return derive(
+            self(),
+            std::move(history),
+            dtype(),
+            [&] { return shape(); },
+            contiguous_data,
+            [](const Tensor& input, TensorData& out) {
+                tensor_ops::copy_inplace(out, input.info());
+            });
+    }
+
+    // View of `input` whose gradient is scattered back through the same
+    // view of zeros, every input element is selected at most once
+    template <typename ViewFn>
+    sptr<Tensor> strided_view(const sptr<Tensor>& input, ViewFn view) {
+        History history;
+        history.inputs.emplace_back(input);
+        history.backward = [shape = input->shape(), view](Context&,
+                                                          sptr<Tensor> d_out)
+            -> std::array<sptr<Tensor>, 2> {
+            auto grad = Tensor::zeros(shape, d_out->dtype());
+            Tensor::create(std::make_unique<TensorData>(view(*grad->data)))
+                ->copy_(d_out);
+            return { grad };
+        };
+
+        return derive(
+            input,
+            std::move(history),
+            input->dtype(),
+            [&] { return view(shape_probe(*input)).shape; },
+            [view](const Tensor& from) { return view(*from.data); });
+    }
+
+    sptr<Tensor> Tensor::slice(size_t dim,
+                               size_t start,
+                               size_t stop,
+                               size_t step) {
+        return strided_view(self(), [=](const TensorData& data) {
+            return data.slice(dim, start, stop, step);
+        });
+    }
+
+    sptr<Tensor> Tensor::narrow(size_t dim, size_t start, size_t length) {
+        return strided_view(self(), [=](const TensorData& data) {
+            return data.narrow(dim, start, length);
+        });
+    }
+
+    sptr<Tensor> Tensor::select(size_t dim, size_t index) {
+        return strided_view(self(), [=](const TensorData& data) {
+            return data.select(dim, index);
+        });
+    }
+
+    sptr<Tensor> Tensor::flip(const std::vector<size_t>& dims) {
+        return strided_view(self(), [=](const TensorData& data) {
+            return data.flip(dims);
+        });
+    }
+
+    sptr<Tensor> Tensor::expand(Shape shape) {
+        // Expanded elements are read more than once, their gradients sum
+        History history;
+        history.inputs.emplace_back(self());
+        history.backward = [from = this->shape()](Context&, sptr<Tensor> d_out)
+            -> std::array<sptr<Tensor>, 2> {
+            return { tensor_functions::sum_to_shape(d_out, from) };
+        };
+
+        return derive(
+            self(),
+            std::move(history),
+            dtype(),
+            [&] { return shape_probe(*this).expand(shape).shape; },
+            [shape](const Tensor& input) {
+                return input.data->expand(shape);
+            });
     }
 
     TensorDataInfo Tensor::info() const {
+        realize();
         return this->data->info();
     }
 
-    std::vector<sptr<Tensor>> Tensor::parents() const {
+    void Tensor::realize() const {
+        if (!this->pending)
+            return;
+
+        tensor_fusion::schedule(*this->pending);
+
+        // A deferred kernel computed the value itself
+        const auto& expr = *this->pending;
+        if (expr.op == tensor_fusion::Op::Load)
+            this->data = std::make_unique<TensorData>(*expr.input->data);
+        else
+            this->data = tensor_fusion::realize(expr);
+        this->pending.reset();
+    }
+
+    sptr<tensor_fusion::Expr> Tensor::expr() {
+        return this->pending ? this->pending
+                             : tensor_fusion::load(self());
+    }
+
+    const TensorList& Tensor::parents() const {
         return this->history.inputs;
     }
 
     bool Tensor::is_leaf() {
-        return parents().empty();
+        return parents().empty() && !this->history.released;
+    }
+
+    sptr<Tensor> Tensor::add_(const sptr<Tensor>& other, double alpha) {
+        return update(*this, [other, alpha](TensorData& data) {
+            tensor_ops::add_inplace(data, other->info(), alpha);
+        });
+    }
+
+    sptr<Tensor> Tensor::mul_(const sptr<Tensor>& other) {
+        return update(*this, [other](TensorData& data) {
+            tensor_ops::mul_inplace(data, other->info());
+        });
+    }
+
+    sptr<Tensor> Tensor::copy_(const sptr<Tensor>& other) {
+        return update(*this, [other](TensorData& data) {
+            tensor_ops::copy_inplace(data, other->info());
+        });
+    }
+
+    sptr<Tensor> Tensor::fill_(double value) {
+        return update(*this, [value](TensorData& data) {
+            tensor_ops::fill_inplace(data, value);
+        });
+    }
+
+    size_t Tensor::version() const {
+        return this->data ? this->data->_storage.version() : 0;
     }
 
     void Tensor::accumulate_grad(sptr<Tensor>&& deriv) {
-        if (this->grad == nullptr)
-            this->grad = zeros();
-        this->grad = this->grad + deriv;
-        return;
+        // The first gradient is adopted when nothing else refers to it,
+        // later ones are summed into it in place
+        if (deriv->dtype() != dtype())
+            deriv = cast(*deriv, dtype());
+
+        if (this->grad == nullptr) {
+            if (deriv->shape() != shape())
+                this->grad = backend->add_zip(zeros(), deriv);
+            else {
+                deriv->realize();
+
+                // Views share their storage, they are copied as well
+                if (deriv->exclusive())
+                    this->grad = std::move(deriv);
+                else {
+                    auto copy      = std::make_unique<TensorData>(*deriv->data);
+                    copy->_storage = copy->_storage.clone();
+                    this->grad     = Tensor::create(std::move(copy));
+                }
+            }
+            return;
+        }
+
+        if (shape_broadcast(grad->shape(), deriv->shape()) == grad->shape())
+            this->grad->add_(deriv);
+        else
+            this->grad = backend->add_zip(this->grad, deriv);
     }
 
     std::vector<std::tuple<sptr<Tensor>, sptr<Tensor>>> Tensor::chain_rule(
         sptr<Tensor> deriv) {
-        auto backward_fn = this->history.backward;
-        auto grads       = backward_fn(this->history.ctx, deriv);
+        if (this->history.released)
+            throw AutodiffError(
+                "AutodiffError: Backward through a graph that was already "
+                "freed, pass retain_graph = true to the first backward.");
+
+        auto& ctx = this->history.ctx;
+        for (size_t i = 0; i < ctx.saved_versions.size(); i++)
+            if (ctx.saved_values[i]->version() != ctx.saved_versions[i])
+                throw AutodiffError(
+                    "AutodiffError: A tensor needed for backward was modified "
+                    "by an in-place operation.");
+
+        auto grads = this->history.backward(ctx, std::move(deriv));
 
         std::vector<std::tuple<sptr<Tensor>, sptr<Tensor>>> zip_inputs_grads;
         for (size_t i = 0; i < history.inputs.size() && i < 2; i++)
@@ -56,10 +423,26 @@ namespace tensor {
         return zip_inputs_grads;
     }
 
-    void Tensor::backward() {
-        auto deriv = Tensor::create({ 1.0 });
-        auto self  = shared_from_this();
-        tensor_autodiff::backpropagate(self, deriv);
+    void Tensor::release_history() {
+        this->history.ctx.saved_values.clear();
+        this->history.ctx.saved_versions.clear();
+        this->history.inputs.clear();
+        this->history.backward = nullptr;
+        this->history.released = true;
+        this->backward_order.clear();
+    }
+
+    void Tensor::backward(bool retain_graph) {
+        // Gradients are computed eagerly, pending saved values are
+        // realized as backward functions read them. Realizing the root
+        // first runs every kernel deferred in lazy mode it depends on.
+        tensor_fusion::LazyScope eager(false);
+        realize();
+
+        // A constant, captured steps have nothing to replay for it
+        auto deriv = Tensor::zeros({ 1 }, dtype());
+        tensor_ops::fill_inplace(*deriv->data, 1.0);
+        tensor_autodiff::backpropagate(self(), deriv, retain_graph);
         return;
     }
 }  // namespace tensor
@@ -11,9 +11,12 @@
 
 #include "generic_operators.hpp"
 #include "tensor_autodiff.hpp"
+#include "tensor_capture.hpp"
 #include "tensor_data.hpp"
 #include "tensor_functions.hpp"
+#include "tensor_fusion.hpp"
 #include "tensor_ops.hpp"
+#include "thread_pool.hpp"
 #include "utils.hpp"
 
 namespace tensor_ops {
@@ -34,48 +37,89 @@ namespace tensor {
     struct TensorFunction {
         template <typename Fn, typename... Args>
         static sptr<Tensor> apply(Args&&... args);
+
+        template <typename Fn, typename... Args>
+        static sptr<Tensor> apply_fused(Args&&... args);
+
+        // Defers the kernel of Fn in lazy mode, see tensor_fusion.hpp
+        template <typename Fn, typename... Args>
+        static sptr<Tensor> apply_lazy(Args&&... args);
+
+        // Function of a tensor and a constant, e.g. x * 0.5
+        template <typename Fn>
+        static sptr<Tensor> apply_scalar(const sptr<Tensor>& self,
+                                         double constant);
+
+        // Kernels a captured step recomputes the output of Fn with, in
+        // place, see tensor_capture.hpp
+        template <typename Fn, typename... Args>
+        static tensor_capture::Recompute replay(const Args&... args);
+
+        template <typename Fn>
+        static tensor_capture::Recompute replay_scalar(const sptr<Tensor>& self,
+                                                       double constant);
     };
 
     struct History {
         Context ctx;
-        std::vector<sptr<Tensor>> inputs;
-        std::function<std::array<sptr<Tensor>, 2>(Context&, sptr<Tensor>)> backward;
+        TensorList inputs{ graph_resource() };
+        std::function<std::array<sptr<Tensor>, 2>(Context&, sptr<Tensor>)>
+            backward;
+
+        // Set once backward freed the node, see Tensor::backward
+        bool released = false;
     };
 
-    class Tensor : public std::enable_shared_from_this<Tensor> {
+    class Tensor : public RefCounted {
     public:
         // members
 
         size_t id;
 
-        uptr<TensorData> data;
+        // Both filled in lazily when a pending fused expression is realized
+        mutable uptr<TensorData> data;
+        mutable sptr<tensor_fusion::Expr> pending;
+
         sptr<Tensor> grad;
         History history;
+
+        // Nodes below this one in the order backward() visits them, kept
+        // after the first call
+        std::vector<sptr<Tensor>> backward_order;
         static inline sptr<TensorBackend> backend;
         static inline size_t next_id = 0;
 
         // static functions
 
+        template <typename Backend = TensorBackend>
         static void set_backend() {
-            backend = std::make_shared<TensorBackend>();
+            backend = std::make_shared<Backend>();
+        }
+
+        // Same as above, also resizing the kernel thread pool
+        // (defaults to BABYTORCH_NUM_THREADS or all cores)
+        template <typename Backend = TensorBackend>
+        static void set_backend(size_t n_threads) {
+            thread_pool::set_num_threads(n_threads);
+            backend = std::make_shared<Backend>();
         }
 
         template <typename... Args>
             requires(std::is_same_v<int, Args> && ...)
         static sptr<Tensor> create(Args&&... args) {
-            return std::make_shared<Tensor>(std::forward<Args>(args)...);
+            return make_iptr<Tensor>(std::forward<Args>(args)...);
         }
 
         static sptr<Tensor> create(uptr<TensorData> data) {
-            return std::make_shared<Tensor>(std::move(data));
+            return make_iptr<Tensor>(std::move(data));
         }
 
-        static sptr<Tensor> create(std::vector<double> data) {
-            return std::make_shared<Tensor>(std::move(data));
+        static sptr<Tensor> create(Storage data) {
+            return make_iptr<Tensor>(std::move(data));
         }
 
         static sptr<Tensor> create(History hist, uptr<TensorData> data) {
-            return std::make_shared<Tensor>(std::move(data), std::move(hist));
+            return make_iptr<Tensor>(std::move(data), std::move(hist));
         }
 
         // constructors
@@ -94,8 +138,7 @@ namespace tensor {
             , history(std::move(hist)) {
         }
 
-        template <typename T>
-        Tensor(std::vector<T> input_arr)
+        Tensor(Storage input_arr)
             : id(next_id++) {
             this->data = std::make_unique<TensorData>(std::move(input_arr));
         }
@@ -113,10 +156,11 @@ namespace tensor {
         }
 
         Tensor(const Tensor& other)
-            : std::enable_shared_from_this<Tensor>()
+            : RefCounted()
             , id(next_id++)
             , data(other.data ? std::make_unique<TensorData>(*other.data)
                               : nullptr)
+            , pending(other.pending)
             , grad(other.grad)
             , history(other.history) {
         }
@@ -124,6 +168,7 @@ namespace tensor {
         Tensor(Tensor&& other) noexcept
             : id(next_id++)
             , data(std::move(other.data))
+            , pending(std::move(other.pending))
             , grad(std::move(other.grad))
             , history(std::move(other.history)) {
         }
@@ -132,6 +177,8 @@ namespace tensor {
         size_t size();
         size_t dims();
         Shape shape() const;
+        DType dtype() const;
+        sptr<Tensor> to(DType dtype);
         sptr<Tensor> adjust_for_broadcast(sptr<Tensor> other);
         sptr<Tensor> is_close();
         sptr<Tensor> sigmoid();
@@ -141,35 +188,75 @@ namespace tensor {
         sptr<Tensor> item();
         sptr<Tensor> sum(size_t dim);
         sptr<Tensor> mean(size_t dim);
+        // view() and permute() share the storage of this tensor,
+        // contiguous() only copies when the strides require it
         sptr<Tensor> contiguous();
         sptr<Tensor> view(Shape shape);
         sptr<Tensor> permute(ReOrderIndex order);
+
+        // Strided views, see TensorData. Negative strides let flip()
+        // share the storage as well.
+        sptr<Tensor> slice(size_t dim,
+                           size_t start,
+                           size_t stop,
+                           size_t step = 1);
+        sptr<Tensor> narrow(size_t dim, size_t start, size_t length);
+        sptr<Tensor> select(size_t dim, size_t index);
+        sptr<Tensor> flip(const std::vector<size_t>& dims);
+        sptr<Tensor> expand(Shape shape);
         TensorDataInfo info() const;
+        void realize() const;
+        sptr<tensor_fusion::Expr> expr();
         sptr<Tensor> zeros() const;
-        static sptr<Tensor> zeros(Shape shape);
+        static sptr<Tensor> zeros(Shape shape, DType dtype = DType::Float64);
 
+        // Uninitialized, for kernels that write every element
+        static sptr<Tensor> empty(Shape shape, DType dtype = DType::Float64);
+
+        // In-place operations, not recorded by autograd
+        sptr<Tensor> add_(const sptr<Tensor>& other, double alpha = 1.0);
+        sptr<Tensor> mul_(const sptr<Tensor>& other);
+        sptr<Tensor> copy_(const sptr<Tensor>& other);
+        sptr<Tensor> fill_(double value);
+        size_t version() const;
+
+        // Sole owner of both the handle and the buffer, so it may be
+        // written in place without another tensor seeing the change
+        bool exclusive() const {
+            realize();
+            return use_count() == 1 && data->_storage.unique();
+        }
+
+        // Leaves are tensors without history, nodes freed by backward
+        // are not
         bool is_leaf();
-        void backward();
+
+        // Handle on this tensor, which must already be owned by one
+        sptr<Tensor> self() {
+            if (use_count() == 0)
+                throw std::bad_weak_ptr();
+            return sptr<Tensor>(this);
+        }
+        // Unless the graph is retained, every node drops its saved
+        // tensors, inputs and gradient as soon as its chain rule ran, so
+        // intermediates are freed during the pass. A second backward
+        // through a freed node throws.
+        void backward(bool retain_graph = false);
         void accumulate_grad(sptr<Tensor>&& d_x);
-        std::vector<sptr<Tensor>> parents() const;
+        const TensorList& parents() const;
         std::vector<std::tuple<sptr<Tensor>, sptr<Tensor>>> chain_rule(
             sptr<Tensor> deriv);
+        void release_history();
 
         template <typename... size_t>
         sptr<Tensor> at(const size_t... dims) {
             Index ix;
             (ix.push_back(dims), ...);
 
-            TensorStorageView storage_view = this->data->view(ix);
-
-            // Copy a view to a Tensor
-            Storage new_storage = { storage_view.begin(), storage_view.end() };
+            realize();
 
-            auto shape_view = this->data->shape | std::views::drop(ix.size());
-            Shape new_shape = { shape_view.begin(), shape_view.end() };
-
-            return Tensor::create(
-                std::make_unique<TensorData>(std::move(new_storage), new_shape));
+            // The view shares the storage of this tensor
+            return Tensor::create(std::make_unique<TensorData>(data->at(ix)));
         }
 
         // overloads
@@ -179,167 +266,149 @@ namespace tensor {
             Index ix;
             (ix.push_back(dims), ...);
 
-            TensorStorageView storage_view = this->data->view(ix);
-
-            // Copy a view to a Tensor
-            Storage new_storage = { storage_view.begin(), storage_view.end() };
+            realize();
 
-            auto shape_view = this->data->shape | std::views::drop(ix.size());
-            Shape new_shape = { shape_view.begin(), shape_view.end() };
-
-            return Tensor(
-                std::make_unique<TensorData>(std::move(new_storage), new_shape));
+            return Tensor(std::make_unique<TensorData>(data->at(ix)));
         }
 
-        friend auto operator+(sptr<Tensor> self, sptr<Tensor> other) {
+        friend auto operator+(const sptr<Tensor>& self,
+                              const sptr<Tensor>& other) {
             return TensorFunction::apply<Add>(self, other);
         }
 
         template <typename T>
             requires std::is_arithmetic_v<T>
-        friend auto operator+(sptr<Tensor> self, T&& rhs) {
-            auto val   = Storage{ static_cast<double>(rhs) };
-            auto other = Tensor::create(val);
-            return TensorFunction::apply<Add>(self, other);
+        friend auto operator+(const sptr<Tensor>& self, T&& rhs) {
+            return TensorFunction::apply_scalar<AddScalar>(self, rhs);
         }
 
         template <typename T>
             requires std::is_arithmetic_v<T>
-        friend auto operator+(T&& lhs, sptr<Tensor> other) {
-            auto val  = Storage{ static_cast<double>(lhs) };
-            auto self = Tensor::create(val);
-            return TensorFunction::apply<Add>(self, other);
+        friend auto operator+(T&& lhs, const sptr<Tensor>& other) {
+            return TensorFunction::apply_scalar<AddScalar>(other, lhs);
         }
 
         // *
 
-        friend auto operator*(sptr<Tensor> self, sptr<Tensor> other) {
+        friend auto operator*(const sptr<Tensor>& self,
+                              const sptr<Tensor>& other) {
             return TensorFunction::apply<Mul>(self, other);
         }
 
         template <typename T>
             requires std::is_arithmetic_v<T>
-        friend auto operator*(sptr<Tensor> self, T&& rhs) {
-            auto val   = Storage{ static_cast<double>(rhs) };
-            auto other = Tensor::create(val);
-            return TensorFunction::apply<Mul>(self, other);
+        friend auto operator*(const sptr<Tensor>& self, T&& rhs) {
+            return TensorFunction::apply_scalar<MulScalar>(self, rhs);
         }
 
         template <typename T>
             requires std::is_arithmetic_v<T>
-        friend auto operator*(T&& lhs, sptr<Tensor> other) {
-            auto val  = Storage{ static_cast<double>(lhs) };
-            auto self = Tensor::create(val);
-            return TensorFunction::apply<Mul>(self, other);
+        friend auto operator*(T&& lhs, const sptr<Tensor>& other) {
+            return TensorFunction::apply_scalar<MulScalar>(other, lhs);
         }
 
         // -
 
-        friend auto operator-(sptr<Tensor> self, sptr<Tensor> other) {
-            return self + TensorFunction::apply<Neg>(other);
+        friend auto operator-(const sptr<Tensor>& self,
+                              const sptr<Tensor>& other) {
+            return TensorFunction::apply<Sub>(self, other);
         }
 
         template <typename T>
             requires std::is_arithmetic_v<T>
-        friend auto operator-(sptr<Tensor> self, T&& rhs) {
-            auto val   = Storage{ static_cast<double>(rhs) };
-            auto other = Tensor::create(val);
-            return self + TensorFunction::apply<Neg>(other);
+        friend auto operator-(const sptr<Tensor>& self, T&& rhs) {
+            double negated = -static_cast<double>(rhs);
+            return TensorFunction::apply_scalar<AddScalar>(self, negated);
         }
 
         template <typename T>
             requires std::is_arithmetic_v<T>
-        friend auto operator-(T&& lhs, sptr<Tensor> other) {
-            auto val  = Storage{ static_cast<double>(lhs) };
-            auto self = Tensor::create(val);
-            return self + TensorFunction::apply<Neg>(other);
+        friend auto operator-(T&& lhs, const sptr<Tensor>& other) {
+            return TensorFunction::apply_scalar<RSubScalar>(other, lhs);
         }
 
         // /
 
-        friend auto operator/(sptr<Tensor> self, sptr<Tensor> other) {
-            return self * TensorFunction::apply<Inv>(other);
+        friend auto operator/(const sptr<Tensor>& self,
+                              const sptr<Tensor>& other) {
+            return TensorFunction::apply<Div>(self, other);
         }
 
         template <typename T>
             requires std::is_arithmetic_v<T>
-        friend auto operator/(sptr<Tensor> self, T&& rhs) {
-            auto val   = Storage{ static_cast<double>(rhs) };
-            auto other = Tensor::create(val);
-            return self * TensorFunction::apply<Inv>(other);
+        friend auto operator/(const sptr<Tensor>& self, T&& rhs) {
+            // x / c == x * inv(c), up to rounding
+            return TensorFunction::apply_scalar<MulScalar>(
+                self, generic_operators::inv(static_cast<double>(rhs)));
         }
 
         template <typename T>
             requires std::is_arithmetic_v<T>
-        friend auto operator/(T&& lhs, sptr<Tensor> other) {
-            auto val  = Storage{ static_cast<double>(lhs) };
-            auto self = Tensor::create(val);
-            return self * TensorFunction::apply<Inv>(other);
+        friend auto operator/(T&& lhs, const sptr<Tensor>& other) {
+            return TensorFunction::apply_scalar<RDivScalar>(other, lhs);
+        }
+
+        // @
+
+        friend auto matmul(sptr<Tensor> self, sptr<Tensor> other) {
+            return TensorFunction::apply<MatMul>(self, other);
         }
 
         // <
 
-        friend auto operator<(sptr<Tensor> self, sptr<Tensor> other) {
+        friend auto operator<(const sptr<Tensor>& self,
+                              const sptr<Tensor>& other) {
             return TensorFunction::apply<Lt>(self, other);
         }
 
         template <typename T>
             requires std::is_arithmetic_v<T>
-        friend auto operator<(sptr<Tensor> self, T&& rhs) {
-            auto val   = Storage{ static_cast<double>(rhs) };
-            auto other = Tensor::create(val);
-            return TensorFunction::apply<Lt>(self, other);
+        friend auto operator<(const sptr<Tensor>& self, T&& rhs) {
+            return TensorFunction::apply_scalar<LtScalar>(self, rhs);
         }
 
         template <typename T>
             requires std::is_arithmetic_v<T>
-        friend auto operator<(T&& lhs, sptr<Tensor> other) {
-            auto val  = Storage{ static_cast<double>(lhs) };
-            auto self = Tensor::create(val);
-            return TensorFunction::apply<Lt>(self, other);
+        friend auto operator<(T&& lhs, const sptr<Tensor>& other) {
+            return TensorFunction::apply_scalar<GtScalar>(other, lhs);
         }
 
         // >
 
-        friend auto operator>(sptr<Tensor> self, sptr<Tensor> other) {
+        friend auto operator>(const sptr<Tensor>& self,
+                              const sptr<Tensor>& other) {
             return TensorFunction::apply<Lt>(other, self);
         }
 
         template <typename T>
             requires std::is_arithmetic_v<T>
-        friend auto operator>(sptr<Tensor> self, T&& rhs) {
-            auto val   = Storage{ static_cast<double>(rhs) };
-            auto other = Tensor::create(val);
-            return TensorFunction::apply<Lt>(other, self);
+        friend auto operator>(const sptr<Tensor>& self, T&& rhs) {
+            return TensorFunction::apply_scalar<GtScalar>(self, rhs);
         }
 
         template <typename T>
-        friend auto operator>(T&& lhs, sptr<Tensor> other) {
-            auto val  = Storage{ static_cast<double>(lhs) };
-            auto self = Tensor::create(val);
-            return TensorFunction::apply<Lt>(other, self);
+            requires std::is_arithmetic_v<T>
+        friend auto operator>(T&& lhs, const sptr<Tensor>& other) {
+            return TensorFunction::apply_scalar<LtScalar>(other, lhs);
         }
 
         // ==
 
-        friend auto operator==(sptr<Tensor> self, sptr<Tensor> other) {
+        friend auto operator==(const sptr<Tensor>& self,
+                               const sptr<Tensor>& other) {
             return TensorFunction::apply<Eq>(self, other);
         }
 
         template <typename T>
             requires std::is_arithmetic_v<T>
-        friend auto operator==(sptr<Tensor> self, T&& rhs) {
-            auto val   = Storage{ static_cast<double>(rhs) };
-            auto other = Tensor::create(val);
-            return TensorFunction::apply<Eq>(self, other);
+        friend auto operator==(const sptr<Tensor>& self, T&& rhs) {
+            return TensorFunction::apply_scalar<EqScalar>(self, rhs);
         }
 
         template <typename T>
             requires std::is_arithmetic_v<T>
-        friend auto operator==(T&& lhs, sptr<Tensor> other) {
-            auto val  = Storage{ static_cast<double>(lhs) };
-            auto self = Tensor::create(val);
-            return TensorFunction::apply<Eq>(other, self);
+        friend auto operator==(T&& lhs, const sptr<Tensor>& other) {
+            return TensorFunction::apply_scalar<EqScalar>(other, lhs);
         }
 
         Tensor& operator=(Tensor&& other) noexcept = default;
@@ -347,17 +416,179 @@ namespace tensor {
 
     template <typename Fn, typename... Args>
     sptr<Tensor> TensorFunction::apply(Args&&... args) {
+        if constexpr (requires { Fn::fused_op; })
+            if (tensor_fusion::enabled())
+                return apply_fused<Fn>(args...);
+
+        if constexpr (requires { Fn::output_shape; })
+            if (tensor_fusion::lazy() && (is_floating(args->dtype()) && ...))
+                return apply_lazy<Fn>(args...);
+
+        (args->realize(), ...);
+
         Context ctx;
 
         auto result = Fn::forward(ctx, args...);
 
+        for (auto& saved : ctx.saved_values)
+            ctx.saved_versions.push_back(saved->version());
+
         History history;
         history.ctx      = std::move(ctx);
         history.backward = Fn::backward;
 
         (history.inputs.emplace_back(args), ...);
 
-        return Tensor::create(std::move(history), std::move(result->data));
+        auto output = Tensor::create(std::move(history),
+                                     std::move(result->data));
+
+        if (auto* graph = tensor_capture::capturing())
+            graph->record(output, replay<Fn>(args...));
+
+        return output;
+    }
+
+    template <typename Fn, typename... Args>
+    sptr<Tensor> TensorFunction::apply_fused(Args&&... args) {
+        // Keep each fused kernel within its input budget by realizing
+        // the arguments once the expression grows too wide
+        size_t inputs = ((args->pending ? args->pending->inputs : 1) + ...);
+        if (inputs > tensor_fusion::MAX_INPUTS)
+            (args->realize(), ...);
+
+        // The kernel does not run, backward gets the inputs themselves
+        Context ctx;
+        ctx.save_for_backwards(args...);
+
+        for (auto& saved : ctx.saved_values)
+            ctx.saved_versions.push_back(saved->version());
+
+        History history;
+        history.ctx      = std::move(ctx);
+        history.backward = Fn::backward;
+
+        (history.inputs.emplace_back(args), ...);
+
+        auto result     = make_iptr<Tensor>();
+        result->pending = tensor_fusion::apply(Fn::fused_op, args->expr()...);
+        result->history = std::move(history);
+
+        return result;
+    }
+
+    template <typename Fn, typename... Args>
+    sptr<Tensor> TensorFunction::apply_lazy(Args&&... args) {
+        // Forward only saves its inputs, backward gets them without the
+        // kernel running here
+        Context ctx;
+        ctx.save_for_backwards(args...);
+
+        for (auto& saved : ctx.saved_values)
+            ctx.saved_versions.push_back(saved->version());
+
+        History history;
+        history.ctx      = std::move(ctx);
+        history.backward = Fn::backward;
+
+        (history.inputs.emplace_back(args), ...);
+
+        tensor_fusion::Kernel kernel;
+        (kernel.operands.emplace_back(args), ...);
+        kernel.run = [... args = sptr<Tensor>(args)] {
+            Context scratch;
+            return std::move(Fn::forward(scratch, args...)->data);
+        };
+
+        auto result     = make_iptr<Tensor>();
+        result->pending = tensor_fusion::call(
+            Fn::output_shape(args->shape()...),
+            promote_types(args->dtype()...),
+            std::move(kernel));
+        result->history = std::move(history);
+
+        return result;
+    }
+
+    template <typename Fn>
+    sptr<Tensor> TensorFunction::apply_scalar(const sptr<Tensor>& self,
+                                              double constant) {
+        Context ctx;
+        ctx.constant = constant;
+
+        History history;
+        history.backward = Fn::backward;
+        history.inputs.emplace_back(self);
+
+        sptr<Tensor> result;
+
+        if (tensor_fusion::enabled()) {
+            // Backward may need the input, the kernel does not run
+            ctx.save_for_backwards(self);
+
+            auto lhs = self->expr();
+            auto rhs = tensor_fusion::constant(constant);
+            if constexpr (Fn::reversed)
+                std::swap(lhs, rhs);
+
+            result          = make_iptr<Tensor>();
+            result->pending = tensor_fusion::apply(Fn::fused_op, lhs, rhs);
+        }
+        else {
+            self->realize();
+            auto data = std::move(Fn::forward(ctx, self, constant)->data);
+            result    = Tensor::create(std::move(data));
+
+            if (auto* graph = tensor_capture::capturing())
+                graph->record(result, replay_scalar<Fn>(self, constant));
+        }
+
+        for (auto& saved : ctx.saved_values)
+            ctx.saved_versions.push_back(saved->version());
+
+        history.ctx     = std::move(ctx);
+        result->history = std::move(history);
+
+        return result;
+    }
+
+    template <typename Fn, typename... Args>
+    tensor_capture::Recompute TensorFunction::replay(const Args&... args) {
+        // Elementwise functions evaluate an expression compiled once
+        if constexpr (requires { Fn::fused_op; })
+            if ((is_floating(args->dtype()) && ...))
+                return tensor_fusion::compile_into(*tensor_fusion::apply(
+                    Fn::fused_op, tensor_fusion::load(args)...));
+
+        if constexpr (requires { Fn::forward_into; })
+            return [... args = sptr<Tensor>(args)](TensorData& out) {
+                Fn::forward_into(out, args...);
+            };
+        else
+            return [... args = sptr<Tensor>(args)](TensorData& out) {
+                auto& scratch = tensor_capture::scratch_context();
+                out           = std::move(*Fn::forward(scratch, args...)->data);
+            };
+    }
+
+    template <typename Fn>
+    tensor_capture::Recompute TensorFunction::replay_scalar(
+        const sptr<Tensor>& self,
+        double constant) {
+        if (is_floating(self->dtype())) {
+            auto lhs = tensor_fusion::load(self);
+            auto rhs = tensor_fusion::constant(constant);
+            if constexpr (Fn::reversed)
+                std::swap(lhs, rhs);
+
+            return tensor_fusion::compile_into(
+                *tensor_fusion::apply(Fn::fused_op, lhs, rhs));
+        }
+
+        return [self, constant](TensorData& out) {
+            auto& scratch = tensor_capture::scratch_context();
+            auto output   = Fn::forward(scratch, self, constant);
+            out           = std::move(*output->data);
+        };
     }
 
     // helper functions
@@ -366,6 +597,7 @@ namespace tensor {
 template <>
 struct fmt::formatter<tensor::Tensor> : formatter<string_view> {
     auto format(const tensor::Tensor& s, format_context& ctx) const {
+        s.realize();
         std::string tensor_view = s.data->string_view();
         return fmt::format_to(ctx.out(), "Tensor({})\n", tensor_view);
     }
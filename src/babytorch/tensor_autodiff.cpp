@@ -1,58 +1,270 @@
-#include <stack>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <new>
 #include <unordered_map>
-#include <unordered_set>
 #include <vector>
 
 #include "ptr.hpp"
 #include "tensor.hpp"
+#include "tensor_capture.hpp"
 
 namespace tensor_autodiff {
 
     using namespace tensor;
 
+    // Bump allocator over chunks that are kept from one step to the next.
+    // Deallocation only counts the blocks still in use in their chunk, a
+    // chunk comes back all at once when its count drops to zero.
+    class Arena : public std::pmr::memory_resource {
+    public:
+        // Smallest chunk, later ones double in size
+        static constexpr size_t CHUNK_SIZE = 64 * 1024;
+
+        // Far beyond what any step needs at doubling sizes
+        static constexpr size_t MAX_CHUNKS = 48;
+
+        size_t depth = 0;  // nested GraphArena scopes
+
+        // The next allocation starts over at the first chunk none of
+        // whose blocks are in use. Chunks holding blocks of nodes that
+        // outlived their step are skipped until those are gone.
+        void rewind() {
+            cursor = nullptr;
+            end    = nullptr;
+        }
+
+        size_t bytes() const {
+            size_t total = 0;
+            for (size_t i = 0; i < count.load(); i++)
+                total += chunks[i].size;
+            return total;
+        }
+
+    private:
+        struct Chunk {
+            std::unique_ptr<std::byte[]> data;
+            size_t size = 0;
+
+            // Blocks can be released by tensors dying on other threads
+            std::atomic<size_t> live = 0;
+
+            bool contains(const void* ptr) const {
+                auto* byte = static_cast<const std::byte*>(ptr);
+                return byte >= data.get() && byte < data.get() + size;
+            }
+        };
+
+        // Fixed slots, so that other threads can look up the chunk of a
+        // block while this one adds chunks
+        std::array<Chunk, MAX_CHUNKS> chunks;
+        std::atomic<size_t> count = 0;
+
+        size_t current    = 0;
+        std::byte* cursor = nullptr;
+        std::byte* end    = nullptr;
+
+        void* bump(size_t bytes, size_t alignment) {
+            void* ptr    = cursor;
+            size_t space = end - cursor;
+            if (!cursor || !std::align(alignment, bytes, ptr, space))
+                return nullptr;
+
+            cursor = static_cast<std::byte*>(ptr) + bytes;
+            return ptr;
+        }
+
+        // Moves on to the next free chunk that fits, allocating one if
+        // needed
+        void next_chunk(size_t bytes) {
+            size_t n = count.load();
+            current  = cursor ? current + 1 : 0;
+            while (current < n
+                   && (chunks[current].size < bytes
+                       || chunks[current].live.load() != 0))
+                current++;
+
+            if (current == n) {
+                if (n == MAX_CHUNKS)
+                    throw std::bad_alloc();
+
+                size_t size = n == 0 ? CHUNK_SIZE : 2 * chunks[n - 1].size;
+                size        = std::max(size, bytes);
+                chunks[n].data = std::make_unique<std::byte[]>(size);
+                chunks[n].size = size;
+                count.store(n + 1);
+            }
+
+            cursor = chunks[current].data.get();
+            end    = cursor + chunks[current].size;
+        }
+
+        void* do_allocate(size_t bytes, size_t alignment) override {
+            void* ptr = bump(bytes, alignment);
+            if (!ptr) {
+                next_chunk(bytes + alignment);
+                ptr = bump(bytes, alignment);
+            }
+
+            chunks[current].live++;
+            return ptr;
+        }
+
+        void do_deallocate(void* ptr, size_t, size_t) override {
+            for (size_t i = 0; i < count.load(); i++)
+                if (chunks[i].contains(ptr)) {
+                    chunks[i].live--;
+                    return;
+                }
+        }
+
+        bool do_is_equal(
+            const std::pmr::memory_resource& other) const noexcept override {
+            return this == &other;
+        }
+    };
+
+    // Created on first use and never destroyed, graph nodes may be
+    // released after the thread is gone
+    thread_local Arena* thread_arena                 = nullptr;
+    thread_local std::pmr::memory_resource* resource = nullptr;
+
+    GraphArena::GraphArena() {
+        if (!thread_arena)
+            thread_arena = new Arena();
+
+        if (thread_arena->depth++ == 0)
+            resource = thread_arena;
+    }
+
+    GraphArena::~GraphArena() {
+        if (--thread_arena->depth > 0)
+            return;
+
+        resource = nullptr;
+        thread_arena->rewind();
+    }
+
+    std::pmr::memory_resource* graph_resource() {
+        return resource ? resource : std::pmr::get_default_resource();
+    }
+
+    size_t graph_arena_bytes() {
+        return thread_arena ? thread_arena->bytes() : 0;
+    }
+
     std::vector<sptr<Tensor>> topological_sort(sptr<Tensor> root) {
-        //
-        std::unordered_set<size_t> visited;
-        std::vector<sptr<Tensor>> order;
-        std::stack<sptr<Tensor>> stack;
+        if (root->is_leaf())
+            return {};
 
-        stack.push(root);
+        // Consumers of every node below the root, counted per edge, x * x
+        // reads x twice and hands it two gradients
+        std::unordered_map<size_t, size_t> consumers;
+        std::vector<const Tensor*> stack{ root.get() };
 
         while (!stack.empty()) {
-            sptr<Tensor> cur_tensor = stack.top();
-            stack.pop();
+            const Tensor* node = stack.back();
+            stack.pop_back();
 
-            if (visited.contains(cur_tensor->id) || cur_tensor->is_leaf())
-                continue;
+            for (const sptr<Tensor>& parent : node->parents())
+                if (!parent->is_leaf() && consumers[parent->id]++ == 0)
+                    stack.push_back(parent.get());
+        }
 
-            visited.insert(cur_tensor->id);
-            order.emplace_back(cur_tensor);
+        // Kahn's algorithm, a node is ready once all of its consumers
+        // passed their gradient on
+        std::vector<sptr<Tensor>> order{ root };
 
-            for (sptr<Tensor> parent : cur_tensor->parents())
-                stack.push(parent);
-        }
+        for (size_t next = 0; next < order.size(); next++)
+            for (const sptr<Tensor>& parent : order[next]->parents())
+                if (!parent->is_leaf() && --consumers[parent->id] == 0)
+                    order.push_back(parent);
 
         return order;
     }
 
-    void backpropagate(sptr<Tensor> variable, sptr<Tensor> deriv) {
-        auto order = topological_sort(variable);
+    // Sum a gradient into a table entry, in place unless the entry is
+    // shared, e.g. Add hands the same d_out to both of its inputs, or its
+    // buffer is, e.g. the gradient of a permute is a view of its d_out
+    void accumulate(sptr<Tensor>& total, const sptr<Tensor>& grad) {
+        bool fits = shape_broadcast(total->shape(), grad->shape())
+                    == total->shape();
+
+        grad->realize();
+        if (fits && total->exclusive()
+            && !total->data->_storage.shares(grad->data->_storage))
+            total->add_(grad);
+        else
+            total = total->backend->add_zip(total, grad);
+    }
 
-        std::unordered_map<size_t, sptr<Tensor>> grad_table;
-        grad_table[variable->id] = deriv;
+    void backpropagate(sptr<Tensor> variable,
+                       sptr<Tensor> deriv,
+                       bool retain_graph) {
+        if (variable->is_leaf())
+            return;
 
-        for (auto curr_node : order) {
-            sptr<Tensor> d_out = grad_table[curr_node->id];
+        // The graph below a node never changes, later calls reuse the
+        // order. The root itself is left out, it would keep itself alive.
+        auto& order = variable->backward_order;
+        if (order.empty()) {
+            order = topological_sort(variable);
+            order.erase(order.begin());
+        }
 
-            for (auto [input, grad] : curr_node->chain_rule(d_out))
+        // A captured step replays the pass over the same nodes, the
+        // functions it runs are not recorded on their own. Replays go
+        // through the same History, the graph is kept.
+        if (auto* graph = tensor_capture::capturing()) {
+            graph->record_backward(variable, deriv, order);
+            retain_graph = true;
+        }
+        tensor_capture::CapturePause paused;
+
+        if (retain_graph)
+            propagate(order, variable, std::move(deriv));
+        else {
+            // Nodes are freed along the way, the order must not keep
+            // them alive
+            auto nodes = std::move(order);
+            propagate(nodes, variable, std::move(deriv), false);
+        }
+    }
+
+    void propagate(std::vector<sptr<Tensor>>& order,
+                   const sptr<Tensor>& variable,
+                   sptr<Tensor> deriv,
+                   bool retain_graph) {
+        std::pmr::unordered_map<size_t, sptr<Tensor>> grad_table(
+            graph_resource());
+        grad_table[variable->id] = std::move(deriv);
+
+        auto visit = [&](Tensor& node) {
+            // Every consumer of the node was visited before it, its
+            // gradient is complete
+            sptr<Tensor> d_out = std::move(grad_table[node.id]);
+            grad_table.erase(node.id);
+
+            for (auto& [input, grad] : node.chain_rule(std::move(d_out)))
                 if (input->is_leaf())
                     input->accumulate_grad(std::move(grad));
                 else if (!grad_table.contains(input->id))
                     grad_table[input->id] = std::move(grad);
-                else if (grad_table.contains(input->id))
-                    grad_table[input->id] = grad_table[input->id] + grad;
+                else
+                    accumulate(grad_table[input->id], grad);
+
+            // Its consumers already let go of it, dropping its own
+            // references frees whatever only this node still held
+            if (!retain_graph)
+                node.release_history();
+        };
+
+        visit(*variable);
+        for (auto& node : order) {
+            visit(*node);
+            if (!retain_graph)
+                node.reset();
         }
-        return;
     }
 
 }
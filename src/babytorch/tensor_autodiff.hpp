@@ -1,5 +1,7 @@
 #pragma once
 
+#include <memory_resource>
+#include <stdexcept>
 #include <vector>
 
 #include "ptr.hpp"
@@ -12,13 +14,69 @@ namespace tensor_autodiff {
 
     using namespace tensor;
 
+    struct AutodiffError : std::runtime_error {
+        using std::runtime_error::runtime_error;
+    };
+
+    // Opt-in arena for the graph side of one training step.
+    //
+    // While a GraphArena is alive on a thread, the node-side vectors of
+    // every History and Context built on it are bump-allocated from a
+    // per-thread arena instead of the heap, as are the temporaries of
+    // backward. When the outermost scope ends the arena is rewound in
+    // one shot and its chunks are reused by the next step. Tensors that
+    // outlive the scope keep their graph valid, the chunks holding their
+    // nodes are skipped by later steps until those nodes are gone.
+    //
+    //     for (...) {
+    //         GraphArena arena;
+    //         auto loss = model(x);
+    //         loss->backward();
+    //     }
+    class GraphArena {
+    public:
+        GraphArena();
+        ~GraphArena();
+
+        GraphArena(const GraphArena&)            = delete;
+        GraphArena& operator=(const GraphArena&) = delete;
+    };
+
+    // Resource for graph-side allocations, the arena inside a GraphArena
+    // scope and the default resource otherwise
+    std::pmr::memory_resource* graph_resource();
+
+    // Bytes held in chunks by the arena of this thread
+    size_t graph_arena_bytes();
+
+    using TensorList = std::pmr::vector<sptr<Tensor>>;
+
+    // Non-leaf nodes from `v` down, each after every node that reads it
     std::vector<sptr<Tensor>> topological_sort(sptr<Tensor> v);
 
     void backpropagate(sptr<Tensor> variable);
-    void backpropagate(sptr<Tensor> variable, sptr<Tensor> deriv);
+    void backpropagate(sptr<Tensor> variable,
+                       sptr<Tensor> deriv,
+                       bool retain_graph = false);
+
+    // Backward from `variable` on to the nodes below it, in the order
+    // topological_sort(variable) puts them after it. Without
+    // retain_graph every node is released once its chain rule ran and
+    // its entry in `order` reset.
+    void propagate(std::vector<sptr<Tensor>>& order,
+                   const sptr<Tensor>& variable,
+                   sptr<Tensor> deriv,
+                   bool retain_graph = true);
 
     struct Context {
-        std::vector<sptr<Tensor>> saved_values;
+        TensorList saved_values{ graph_resource() };
+
+        // Versions of saved_values when they were saved, an in-place update
+        // in between makes their gradient invalid
+        std::pmr::vector<size_t> saved_versions{ graph_resource() };
+
+        // Constant operand of tensor-with-constant functions
+        double constant = 0.0;
 
         template <typename... Args>
         void save_for_backwards(Args&&... args) {
@@ -0,0 +1,76 @@
+#include <utility>
+
+#include "tensor.hpp"
+#include "tensor_capture.hpp"
+
+namespace tensor_capture {
+
+    thread_local Graph* graph = nullptr;
+
+    Graph* capturing() {
+        return graph;
+    }
+
+    CaptureScope::CaptureScope(Graph& capture)
+        : previous(graph) {
+        graph = &capture;
+    }
+
+    CaptureScope::~CaptureScope() {
+        graph = previous;
+    }
+
+    CapturePause::CapturePause()
+        : previous(graph) {
+        graph = nullptr;
+    }
+
+    CapturePause::~CapturePause() {
+        graph = previous;
+    }
+
+    Context& scratch_context() {
+        thread_local Context ctx;
+        ctx.saved_values.clear();
+        return ctx;
+    }
+
+    void Graph::record(sptr<Tensor> node, Recompute recompute) {
+        steps.push_back([node = std::move(node),
+                         recompute = std::move(recompute)] {
+            recompute(*node->data);
+
+            // Inputs were recomputed or updated in place since the
+            // capture, backward checks against their versions now
+            auto& ctx = node->history.ctx;
+            for (size_t i = 0; i < ctx.saved_versions.size(); i++)
+                ctx.saved_versions[i] = ctx.saved_values[i]->version();
+        });
+    }
+
+    void Graph::record_update(sptr<Tensor> tensor, Update update) {
+        steps.push_back([tensor = std::move(tensor),
+                         update = std::move(update)] {
+            update(*tensor->data);
+        });
+    }
+
+    void Graph::record_backward(sptr<Tensor> root,
+                                sptr<Tensor> deriv,
+                                std::vector<sptr<Tensor>> order) {
+        steps.push_back([root = std::move(root),
+                         deriv = std::move(deriv),
+                         order = std::move(order)]() mutable {
+            tensor_autodiff::propagate(order, root, deriv);
+        });
+    }
+
+    void Graph::replay() {
+        CapturePause paused;
+        tensor_fusion::LazyScope eager(false);
+
+        for (auto& step : steps)
+            step();
+    }
+
+}  // namespace tensor_capture
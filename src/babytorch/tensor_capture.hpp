@@ -0,0 +1,116 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+
+#include "ptr.hpp"
+#include "tensor_autodiff.hpp"
+#include "tensor_data.hpp"
+#include "tensor_fusion.hpp"
+
+namespace tensor {
+    class Tensor;
+}
+
+namespace tensor_capture {
+    // Capture and replay of fixed-shape steps.
+    //
+    // A training step usually builds the same graph every iteration, the
+    // same functions on the same shapes with new values. While a
+    // CaptureScope is active every graph node records how its data is
+    // computed from its inputs, and backward() records the nodes it
+    // visits. Graph::replay() runs the step again on the tensors of that
+    // first pass. Forward kernels write into the buffers of the captured
+    // nodes: elementwise functions through an expression compiled at
+    // capture, matmul straight into gemm, and views are taken again.
+    // Functions without such a kernel run their forward and hand over
+    // its data. Backward goes through the History and Context of the
+    // nodes as they are. Its functions allocate their gradients as they
+    // do eagerly, but no node or History is built.
+    //
+    // Inputs and parameters keep their identity, they are updated in
+    // place (copy_, add_, fill_) between replays. In-place ops run inside
+    // the scope are replayed in order with the rest. Gradients are summed
+    // into the grads of the previous pass, zeroing them in place reuses
+    // their buffers. A step whose graph depends on the values needs a
+    // new capture. Functions are not fused or deferred while capturing.
+    //
+    //     tensor_capture::Graph step;
+    //     {
+    //         tensor_capture::CaptureScope capture(step);
+    //         loss = model(x);
+    //         loss->backward();
+    //     }
+    //
+    //     for (auto& batch : batches) {
+    //         x->copy_(batch);
+    //         w->grad->fill_(0.0);
+    //         step.replay();
+    //         w->add_(w->grad, -lr);
+    //     }
+
+    using tensor::Tensor;
+    using tensor_autodiff::Context;
+    using tensor_data::TensorData;
+
+    // Writes the data of a node, computed from the current data of its
+    // inputs, into the data it has
+    using Recompute = std::function<void(TensorData&)>;
+
+    // In-place kernel, applied to the data a tensor has at replay
+    using Update = std::function<void(TensorData&)>;
+
+    class Graph {
+    public:
+        void replay();
+
+        // Recorded kernels and backward passes
+        size_t size() const {
+            return steps.size();
+        }
+
+        void record(sptr<Tensor> node, Recompute recompute);
+        void record_update(sptr<Tensor> tensor, Update update);
+        void record_backward(sptr<Tensor> root,
+                             sptr<Tensor> deriv,
+                             std::vector<sptr<Tensor>> order);
+
+    private:
+        std::vector<std::function<void()>> steps;
+    };
+
+    // Graph captured on this thread, nullptr outside a CaptureScope
+    Graph* capturing();
+
+    // Records into `graph` for the lifetime of the scope
+    class CaptureScope {
+    public:
+        explicit CaptureScope(Graph& graph);
+        ~CaptureScope();
+
+        CaptureScope(const CaptureScope&)            = delete;
+        CaptureScope& operator=(const CaptureScope&) = delete;
+
+    private:
+        Graph* previous;
+        tensor_fusion::LazyScope eager{ false };
+    };
+
+    // Stops recording for the lifetime of the scope, backward records
+    // itself as a whole rather than the functions it runs
+    class CapturePause {
+    public:
+        CapturePause();
+        ~CapturePause();
+
+        CapturePause(const CapturePause&)            = delete;
+        CapturePause& operator=(const CapturePause&) = delete;
+
+    private:
+        Graph* previous;
+    };
+
+    // Context for forward passes whose saved values are not needed
+    Context& scratch_context();
+
+}  // namespace tensor_capture
@@ -1,12 +1,161 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
 #include <ranges>
 #include <sstream>
 
 #include <fmt/ranges.h>
 
+#include "allocator.hpp"
 #include "tensor_data.hpp"
 
 namespace tensor_data {
 
+    size_t dtype_size(DType dtype) {
+        return visit_dtype(dtype, []<typename T>() { return sizeof(T); });
+    }
+
+    std::string_view dtype_name(DType dtype) {
+        switch (dtype) {
+            case DType::Float32:
+                return "float32";
+            case DType::Float16:
+                return "float16";
+            case DType::BFloat16:
+                return "bfloat16";
+            case DType::Int8:
+                return "int8";
+            case DType::Int32:
+                return "int32";
+            default:
+                return "float64";
+        }
+    }
+
+    DType promote_types(DType a, DType b) {
+        if (a == b)
+            return a;
+        check_floating(a);
+        check_floating(b);
+        if (dtype_size(a) == dtype_size(b))
+            return DType::Float32;
+        return dtype_size(a) > dtype_size(b) ? a : b;
+    }
+
+    void check_floating(DType dtype) {
+        if (!is_floating(dtype))
+            throw IndexingError(fmt::format(
+                "IndexingError: {} tensors only support quantized ops, "
+                "dequantize them first.",
+                dtype_name(dtype)));
+    }
+
+    // Conversion of a stored value, integers round to nearest and
+    // saturate instead of wrapping
+    template <typename T, typename From>
+    T convert(From value) {
+        if constexpr (std::is_integral_v<T>) {
+            double rounded = std::nearbyint(double(value));
+            return static_cast<T>(
+                std::clamp<double>(rounded,
+                                   std::numeric_limits<T>::min(),
+                                   std::numeric_limits<T>::max()));
+        }
+        else
+            return static_cast<T>(value);
+    }
+
+    Storage::Block::Block(size_t bytes)
+        : ptr(allocator::allocate(bytes))
+        , bytes(bytes) {
+    }
+
+    Storage::Block::~Block() {
+        allocator::release(ptr, bytes);
+    }
+
+    size_t Storage::alignment() const {
+        auto address = reinterpret_cast<std::uintptr_t>(block->ptr)
+                       + _offset * dtype_size(_dtype);
+        if (!address)
+            return allocator::ALIGNMENT;
+        return std::min<size_t>(address & -address, allocator::ALIGNMENT);
+    }
+
+    bool Storage::huge_pages() const {
+        return allocator::huge_pages(block->ptr);
+    }
+
+    Storage Storage::uninitialized(size_t size, DType dtype) {
+        return Storage(
+            dtype, size, std::make_shared<Block>(size * dtype_size(dtype)));
+    }
+
+    Storage::Storage(size_t size, DType dtype)
+        : Storage(uninitialized(size, dtype)) {
+        if (size)
+            std::memset(block->ptr, 0, block->bytes);
+    }
+
+    double Storage::get(std::ptrdiff_t i) const {
+        return visit_dtype(_dtype, [&]<typename T>() {
+            return double(as<T>()[i]);
+        });
+    }
+
+    void Storage::set(std::ptrdiff_t i, double value) {
+        visit_dtype(_dtype, [&]<typename T>() {
+            as<T>()[i] = convert<T>(value);
+        });
+    }
+
+    Storage Storage::to(DType dtype) const {
+        Storage out = uninitialized(length, dtype).view(_first, length, _first);
+
+        visit_dtype(_dtype, [&]<typename From>() {
+            visit_dtype(dtype, [&]<typename T>() {
+                std::ranges::transform(as<From>() - _first,
+                                       as<From>() - _first + length,
+                                       out.as<T>() - _first,
+                                       [](From x) { return convert<T>(x); });
+            });
+        });
+
+        return out;
+    }
+
+    Storage Storage::view(std::ptrdiff_t offset,
+                          size_t length,
+                          size_t first) const {
+        // Window bounds relative to the start of this window
+        auto begin = static_cast<std::ptrdiff_t>(_first) + offset
+                     - static_cast<std::ptrdiff_t>(first);
+        if (begin < 0 || static_cast<size_t>(begin) + length > this->length)
+            throw IndexingError("IndexingError: View outside of its storage.");
+
+        Storage out = *this;
+        out._offset += offset;
+        out._first = first;
+        out.length = length;
+        return out;
+    }
+
+    Storage Storage::clone() const {
+        return to(_dtype);
+    }
+
+    bool Storage::operator==(const Storage& other) const {
+        if (_dtype != other._dtype || length != other.length)
+            return false;
+
+        return visit_dtype(_dtype, [&]<typename T>() {
+            const T* a = as<T>() - _first;
+            const T* b = other.as<T>() - other._first;
+            return std::equal(a, a + length, b);
+        });
+    }
+
     Index broadcast_index(const Index& to_index,
                           const Shape& to_shape,
                           const Shape& from_shape) {
@@ -25,8 +174,10 @@ namespace tensor_data {
     }
 
     Shape shape_broadcast(const Shape& shape1, const Shape& shape2) {
-        Shape max_shape = shape1.size() >= shape2.size() ? shape1 : shape2;
-        Shape min_shape = shape1.size() < shape2.size() ? shape1 : shape2;
+        const Shape& max_shape = shape1.size() >= shape2.size() ? shape1
+                                                                : shape2;
+        const Shape& min_shape = shape1.size() < shape2.size() ? shape1
+                                                               : shape2;
 
         int min_size = min_shape.size();
         int max_size = max_shape.size();
@@ -64,29 +215,42 @@ namespace tensor_data {
         return _tensor_idx;
     }
 
-    size_t index_to_position(const Index& index, const Strides& strides) {
-        size_t pos = 0;
+    std::ptrdiff_t index_to_position(const Index& index,
+                                     const Strides& strides) {
+        std::ptrdiff_t pos = 0;
 
         for (auto i : std::ranges::views::iota(0ull, index.size()))
-            pos += index[i] * strides[i];
+            pos += static_cast<std::ptrdiff_t>(index[i]) * strides[i];
         return pos;
     }
 
     Strides strides_from_shape(const Shape& shape) {
-        Strides strides{ 1 };
-        size_t offset = 1;
+        // Filled from the back, scalars still get a stride of 1
+        Strides strides(std::max<size_t>(shape.size(), 1), 1);
+        std::ptrdiff_t offset = 1;
 
-        for (auto s : shape                      //
-                          | std::views::drop(1)  //
-                          | std::views::reverse) {
-            strides.insert(strides.begin(), s * offset);
-            offset *= s;
+        for (size_t i = shape.size(); i-- > 1;) {
+            offset *= static_cast<std::ptrdiff_t>(shape[i]);
+            strides[i - 1] = offset;
         }
 
         return strides;
     }
 
-    size_t TensorData::index(const Index& index) const {
+    bool is_contiguous(const Shape& shape, const Strides& strides) {
+        // Row-major layout without gaps, i.e. strides == strides_from_shape
+        // (dimensions of size 1 can have any stride)
+        std::ptrdiff_t expected = 1;
+
+        for (size_t i = shape.size(); i-- > 0;) {
+            if (shape[i] != 1 && strides[i] != expected)
+                return false;
+            expected *= static_cast<std::ptrdiff_t>(shape[i]);
+        }
+        return true;
+    }
+
+    std::ptrdiff_t TensorData::index(const Index& index) const {
         if (index.size() != this->shape.size()) {
             fmt::print("Index {}\n", index);
             fmt::print("Shape {}\n", shape);
@@ -105,35 +269,360 @@ namespace tensor_data {
         return index_to_position(index, this->strides);
     }
 
-    TensorStorageView TensorData::view(const Index& index) const {
-        size_t start_idx = index_to_position(index, this->strides);
+    std::pair<size_t, size_t> storage_extent(const Shape& shape,
+                                             const Strides& strides) {
+        std::ptrdiff_t low = 0, high = 0;
+        for (size_t i = 0; i < shape.size(); i++) {
+            if (shape[i] == 0)
+                return { 0, 0 };
+
+            auto reach = static_cast<std::ptrdiff_t>(shape[i] - 1) * strides[i];
+            (reach < 0 ? low : high) += reach;
+        }
+        return { -low, high - low + 1 };
+    }
+
+    bool overlaps(const Shape& shape, const Strides& strides) {
+        ReOrderIndex order;
+        for (size_t i = 0; i < shape.size(); i++) {
+            if (shape[i] == 0)
+                return false;
+            if (shape[i] == 1)
+                continue;
+            if (strides[i] == 0)
+                return true;
+            order.push_back(i);
+        }
+
+        // By increasing stride, each dimension usually steps past all the
+        // elements the ones before it reach
+        auto stride = [&](size_t i) { return std::abs(strides[i]); };
+        std::ranges::sort(order, {}, stride);
+
+        std::ptrdiff_t reach = 0;
+        bool nested          = true;
+        for (size_t i : order) {
+            if (stride(i) <= reach) {
+                nested = false;
+                break;
+            }
+            reach += static_cast<std::ptrdiff_t>(shape[i] - 1) * stride(i);
+        }
+        if (nested)
+            return false;
+
+        // Interleaved, e.g. shape {3, 2} with strides {2, 3}, so every
+        // position is compared
+        std::vector<std::ptrdiff_t> positions;
+        Index index(shape.size(), 0);
+        for (size_t n = generic_operators::prod(shape); n-- > 0;) {
+            positions.push_back(index_to_position(index, strides));
+            for (size_t d = shape.size(); d-- > 0 && ++index[d] == shape[d];)
+                index[d] = 0;
+        }
+        std::ranges::sort(positions);
+        return std::ranges::adjacent_find(positions) != positions.end();
+    }
+
+    void check_dim(size_t dim, size_t dims) {
+        if (dim >= dims) {
+            std::ostringstream msg;
+            msg << "IndexingError: Dimension " << dim
+                << " is out of range for a " << dims << "-d tensor.";
+            throw IndexingError(msg.str());
+        }
+    }
+
+    void check_index(size_t index, size_t dim, size_t size) {
+        if (index >= size) {
+            std::ostringstream msg;
+            msg << "IndexingError: Index " << index
+                << " is out of range for dimension " << dim << ".";
+            throw IndexingError(msg.str());
+        }
+    }
+
+    // Quantization parameters of a view that keeps the channel axis of
+    // per-channel data, `channels` maps view channels to source ones
+    template <typename Fn>
+    sptr<const QuantParams> remap_channels(const sptr<const QuantParams>& qp,
+                                           int axis,
+                                           size_t channels,
+                                           const Fn& channel) {
+        if (!qp || !qp->per_channel())
+            return qp;
+
+        auto params  = std::make_shared<QuantParams>(*qp);
+        params->axis = axis;
+        params->scales.resize(channels);
+        params->zero_points.resize(channels);
+        for (size_t c = 0; c < channels; c++) {
+            params->scales[c]      = qp->scales[channel(c)];
+            params->zero_points[c] = qp->zero_points[channel(c)];
+        }
+        return params;
+    }
+
+    TensorData TensorData::as_strided(const Shape& new_shape,
+                                      const Strides& new_strides,
+                                      std::ptrdiff_t offset) const {
+        auto [first, length] = storage_extent(new_shape, new_strides);
+
+        TensorData out(this->_storage.view(offset, length, first),
+                       new_shape,
+                       new_strides);
+        out.qparams = this->qparams;
+        return out;
+    }
+
+    TensorData TensorData::at(const Index& index) const {
+        if (index.size() > this->shape.size())
+            throw IndexingError("IndexingError: Too many indices.");
+
+        for (size_t i = 0; i < index.size(); i++)
+            check_index(index[i], i, this->shape[i]);
+
+        Shape new_shape(this->shape.begin() + index.size(), this->shape.end());
+        Strides new_strides(this->strides.begin() + index.size(),
+                            this->strides.end());
+
+        if (new_shape.empty()) {
+            new_shape   = { 1 };
+            new_strides = { 1 };
+        }
 
-        auto slice_size = this->strides  //
-                          | std::views::drop(index.size() - 1)
-                          | std::views::take(1);
+        TensorData out = as_strided(
+            new_shape, new_strides, index_to_position(index, this->strides));
+
+        // Per-channel parameters follow their axis, or collapse to the
+        // selected channel when the axis is indexed away
+        if (qparams && qparams->per_channel()) {
+            size_t axis = qparams->axis;
+
+            if (axis < index.size())
+                out.qparams = remap_channels(
+                    qparams, -1, 1, [&](size_t) { return index[axis]; });
+            else
+                out.qparams = remap_channels(
+                    qparams,
+                    static_cast<int>(axis - index.size()),
+                    qparams->scales.size(),
+                    std::identity());
+        }
 
-        size_t slice_width = std::accumulate(slice_size.begin(),
-                                             slice_size.end(),
-                                             1,
-                                             std::multiplies<double>());
+        return out;
+    }
 
-        return TensorStorageView(this->_storage.data() + start_idx, slice_width);
+    TensorData TensorData::slice(size_t dim,
+                                 size_t start,
+                                 size_t stop,
+                                 size_t step) const {
+        check_dim(dim, this->shape.size());
+        stop = std::min(stop, this->shape[dim]);
+
+        if (step == 0 || start > stop)
+            throw IndexingError(
+                "IndexingError: Slices need a positive step and start <= "
+                "stop.");
+
+        Shape new_shape     = this->shape;
+        Strides new_strides = this->strides;
+        new_shape[dim]      = (stop - start + step - 1) / step;
+        new_strides[dim] *= static_cast<std::ptrdiff_t>(step);
+
+        TensorData out = as_strided(
+            new_shape,
+            new_strides,
+            static_cast<std::ptrdiff_t>(start) * this->strides[dim]);
+
+        if (qparams && size_t(qparams->axis) == dim)
+            out.qparams = remap_channels(
+                qparams, qparams->axis, new_shape[dim], [&](size_t c) {
+                    return start + c * step;
+                });
+
+        return out;
     }
 
-    TensorStorageView TensorData::view() const {
-        return TensorStorageView(this->_storage.data(), this->size);
+    TensorData TensorData::narrow(size_t dim,
+                                  size_t start,
+                                  size_t length) const {
+        check_dim(dim, this->shape.size());
+        if (start + length > this->shape[dim])
+            throw IndexingError(
+                "IndexingError: Narrowed range is out of bounds.");
+
+        return slice(dim, start, start + length);
+    }
+
+    TensorData TensorData::select(size_t dim, size_t index) const {
+        check_dim(dim, this->shape.size());
+        check_index(index, dim, this->shape[dim]);
+
+        Shape new_shape     = this->shape;
+        Strides new_strides = this->strides;
+        new_shape.erase(new_shape.begin() + dim);
+        new_strides.erase(new_strides.begin() + dim);
+
+        if (new_shape.empty()) {
+            new_shape   = { 1 };
+            new_strides = { 1 };
+        }
+
+        TensorData out = as_strided(
+            new_shape,
+            new_strides,
+            static_cast<std::ptrdiff_t>(index) * this->strides[dim]);
+
+        if (qparams && qparams->per_channel()) {
+            size_t axis = qparams->axis;
+
+            if (axis == dim)
+                out.qparams = remap_channels(
+                    qparams, -1, 1, [&](size_t) { return index; });
+            else
+                out.qparams = remap_channels(
+                    qparams,
+                    static_cast<int>(axis > dim ? axis - 1 : axis),
+                    qparams->scales.size(),
+                    std::identity());
+        }
+
+        return out;
+    }
+
+    TensorData TensorData::flip(const std::vector<size_t>& axes) const {
+        Strides new_strides   = this->strides;
+        std::ptrdiff_t offset = 0;
+
+        for (size_t dim : axes) {
+            check_dim(dim, this->shape.size());
+            if (this->shape[dim] == 0)
+                continue;
+
+            offset += static_cast<std::ptrdiff_t>(this->shape[dim] - 1)
+                      * new_strides[dim];
+            new_strides[dim] = -new_strides[dim];
+        }
+
+        TensorData out = as_strided(this->shape, new_strides, offset);
+
+        if (qparams && qparams->per_channel()) {
+            size_t axis     = qparams->axis;
+            size_t channels = qparams->scales.size();
+            size_t flips    = std::ranges::count(axes, axis);
+
+            if (flips % 2)
+                out.qparams = remap_channels(
+                    qparams, qparams->axis, channels, [&](size_t c) {
+                        return channels - 1 - c;
+                    });
+        }
+
+        return out;
+    }
+
+    TensorData TensorData::expand(const Shape& new_shape) const {
+        if (new_shape.size() < this->shape.size())
+            throw IndexingError(
+                "IndexingError: Expanded shape has fewer dimensions.");
+
+        size_t extra = new_shape.size() - this->shape.size();
+        Strides new_strides(new_shape.size(), 0);
+
+        for (size_t i = 0; i < this->shape.size(); i++) {
+            if (this->shape[i] == new_shape[extra + i])
+                new_strides[extra + i] = this->strides[i];
+            else if (this->shape[i] != 1)
+                throw IndexingError(
+                    "IndexingError: Only dimensions of size 1 can be "
+                    "expanded.");
+        }
+
+        TensorData out = as_strided(new_shape, new_strides);
+
+        if (qparams && qparams->per_channel())
+            out.qparams = remap_channels(
+                qparams,
+                qparams->axis + static_cast<int>(extra),
+                qparams->scales.size(),
+                std::identity());
+
+        return out;
+    }
+
+    TensorData TensorData::reshape(const Shape& new_shape) const {
+        if (generic_operators::prod(new_shape) != this->size)
+            throw IndexingError(
+                "IndexingError: View shape does not match the number of "
+                "elements.");
+
+        if (!is_contiguous())
+            throw IndexingError(
+                "IndexingError: View of non-contiguous data, call "
+                "contiguous() first.");
+
+        if (qparams && qparams->per_channel())
+            throw IndexingError(
+                "IndexingError: Per-channel quantized data cannot be "
+                "reshaped.");
+
+        TensorData out(this->_storage.view(0, this->size), new_shape);
+        out.qparams = this->qparams;
+        return out;
+    }
+
+    bool TensorData::is_contiguous() const {
+        return tensor_data::is_contiguous(this->shape, this->strides);
+    }
+
+    TensorData TensorData::permute(const ReOrderIndex order) {
+        if (order.size() != this->shape.size())
+            throw IndexingError(
+                "IndexingError: Permutation must cover every dimension.");
+
+        std::vector<bool> seen(order.size(), false);
+        Shape new_shape(order.size());
+        Strides new_strides(order.size());
+
+        for (size_t i = 0; i < order.size(); i++) {
+            if (order[i] >= order.size() || seen[order[i]])
+                throw IndexingError(
+                    "IndexingError: Invalid permutation order.");
+            seen[order[i]] = true;
+            new_shape[i]   = this->shape[order[i]];
+            new_strides[i] = this->strides[order[i]];
+        }
+
+        TensorData out(this->_storage, new_shape, new_strides);
+
+        // The channel axis of per-channel parameters moves along
+        out.qparams = this->qparams;
+        if (qparams && qparams->per_channel()) {
+            auto axis    = std::ranges::find(order, size_t(qparams->axis));
+            auto params  = std::make_shared<QuantParams>(*qparams);
+            params->axis = static_cast<int>(axis - order.begin());
+            out.qparams = std::move(params);
+        }
+
+        return out;
     }
 
     double TensorData::get(const Index& key) {
-        return (this->_storage)[index(key)];
+        return this->_storage.get(index(key));
     }
 
     void TensorData::print_info() const {
-        fmt::print("TensorData(shape={}, size={}, dims={}, strides={})\n",
-                   this->shape,
-                   this->size,
-                   this->dims,
-                   this->strides);
+        fmt::print(
+            "TensorData(shape={}, size={}, dims={}, strides={}, dtype={}, "
+            "align={}, pages={})\n",
+            this->shape,
+            this->size,
+            this->dims,
+            this->strides,
+            dtype_name(this->dtype()),
+            this->_storage.alignment(),
+            this->_storage.huge_pages() ? "huge" : "default");
     }
 
     TensorDataInfo TensorData::info() const {
@@ -145,17 +634,28 @@ namespace tensor_data {
     }
 
     std::string TensorData::string_view() const {
-        const TensorStorageView storage = this->view();
-        Strides this_stride             = this->strides;
-        Shape this_shape                = this->shape;
+        const Storage& storage = this->_storage;
+        Strides this_stride    = strides_from_shape(this->shape);
+        Shape this_shape       = this->shape;
+
+        // Storage position of the idx-th element in row-major order
+        auto position = [&](size_t idx) {
+            std::ptrdiff_t pos = 0;
+            for (size_t d = this_shape.size(); d-- > 0;) {
+                pos += static_cast<std::ptrdiff_t>(idx % this_shape[d])
+                       * this->strides[d];
+                idx /= this_shape[d];
+            }
+            return pos;
+        };
 
         std::string tensor_string = "[";
-        tensor_string.reserve(storage.size() * 10);
+        tensor_string.reserve(this->size * 10);
 
         size_t offset = this_stride.size();  // offset braces
         offset += 7;                         // offset "Tensor("
 
-        for (size_t idx = 0; idx < storage.size(); idx++) {
+        for (size_t idx = 0; idx < this->size; idx++) {
             // Closing brackets
             for (auto stride :
                  this_stride | std::views::take(this_shape.size() - 1)) {
@@ -190,14 +690,16 @@ namespace tensor_data {
             if (tensor_string.back() != '[')
                 tensor_string += ' ';
 
+            double value = storage.get(position(idx));
+
             // Align for negative sign
-            if (storage[idx] > 0)
+            if (value > 0)
                 tensor_string += ' ';
 
-            tensor_string += std::to_string(storage[idx]);
+            tensor_string += std::to_string(value);
 
             // Comma
-            if (idx % this_shape.back() != 0 && idx + 1 < storage.size())
+            if (idx % this_shape.back() != 0 && idx + 1 < this->size)
                 tensor_string += ',';
         }
 
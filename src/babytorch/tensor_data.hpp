@@ -1,13 +1,19 @@
 #pragma once
 
+#include <algorithm>
+#include <cstdint>
+#include <initializer_list>
+#include <iterator>
 #include <memory>
-#include <span>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include "generic_operators.hpp"
+#include "half.hpp"
 #include "ptr.hpp"
+#include "small_vector.hpp"
 #include "utils.hpp"
 
 namespace tensor_data {
@@ -16,14 +22,272 @@ namespace tensor_data {
         using std::runtime_error::runtime_error;
     };
 
+    // Element type of a tensor. Float64 is the default and the reference
+    // for gradient checks, Float32 halves memory traffic. Float16 and
+    // BFloat16 are storage formats, kernels convert them to float. Int8
+    // holds quantized values and Int32 their products, both only go
+    // through the quantized ops (see quantize.hpp).
+    enum class DType : uint8_t {
+        Float64,
+        Float32,
+        Float16,
+        BFloat16,
+        Int8,
+        Int32,
+    };
+
+    size_t dtype_size(DType dtype);
+    std::string_view dtype_name(DType dtype);
+
+    inline bool is_floating(DType dtype) {
+        return dtype != DType::Int8 && dtype != DType::Int32;
+    }
+
+    // Dtype of the result of a binary operation, the wider operand wins.
+    // Float16 and BFloat16 together promote to Float32. Integer dtypes
+    // only combine with themselves.
+    DType promote_types(DType a, DType b);
+
+    template <typename T>
+    constexpr DType dtype_of = DType::Float64;
+    template <>
+    inline constexpr DType dtype_of<float> = DType::Float32;
+    template <>
+    inline constexpr DType dtype_of<half::Half> = DType::Float16;
+    template <>
+    inline constexpr DType dtype_of<half::BFloat16> = DType::BFloat16;
+    template <>
+    inline constexpr DType dtype_of<int8_t> = DType::Int8;
+    template <>
+    inline constexpr DType dtype_of<int32_t> = DType::Int32;
+
+    // Calls fn.template operator()<T>() with T the element type of `dtype`
+    template <typename Fn>
+    decltype(auto) visit_dtype(DType dtype, Fn&& fn) {
+        switch (dtype) {
+            case DType::Float32:
+                return fn.template operator()<float>();
+            case DType::Float16:
+                return fn.template operator()<half::Half>();
+            case DType::BFloat16:
+                return fn.template operator()<half::BFloat16>();
+            case DType::Int8:
+                return fn.template operator()<int8_t>();
+            case DType::Int32:
+                return fn.template operator()<int32_t>();
+            default:
+                return fn.template operator()<double>();
+        }
+    }
+
+    void check_floating(DType dtype);
+
+    // visit_dtype for the floating point kernels, integer dtypes throw
+    template <typename Fn>
+    decltype(auto) visit_float_dtype(DType dtype, Fn&& fn) {
+        switch (dtype) {
+            case DType::Float32:
+                return fn.template operator()<float>();
+            case DType::Float16:
+                return fn.template operator()<half::Half>();
+            case DType::BFloat16:
+                return fn.template operator()<half::BFloat16>();
+            case DType::Float64:
+                return fn.template operator()<double>();
+            default:
+                check_floating(dtype);
+                return fn.template operator()<double>();
+        }
+    }
+
+    // Affine quantization of integer storage, value = scale * (q - zero).
+    // One scale and zero point for the whole tensor when axis < 0,
+    // otherwise one per index along `axis`.
+    struct QuantParams {
+        std::vector<double> scales;
+        std::vector<int32_t> zero_points;
+        int axis = -1;
+
+        bool per_channel() const {
+            return axis >= 0;
+        }
+
+        bool operator==(const QuantParams&) const = default;
+    };
+
+    // Flat element buffer of a single dtype. Float64 storage keeps the
+    // std::vector<double> interface the kernels and tests are written
+    // against, any dtype can be read through as<T>() or get/set.
+    //
+    // A Storage is a handle on a reference-counted buffer. Copies share
+    // the buffer, view() narrows the handle to a window of it, and clone()
+    // makes an independent copy. Positions passed to the element accessors
+    // are relative to the origin of the window, its first element unless
+    // the view says otherwise, so layouts with negative strides can reach
+    // elements before it. size() is the length of the window. In-place
+    // updates bump a version counter shared by every view of the buffer.
+    //
+    // Buffers come from the caching allocator (see allocator.hpp), start
+    // on a cache line and go back to it once the last handle is gone.
+    class Storage {
+    public:
+        Storage()
+            : Storage(uninitialized(0, DType::Float64)) {
+        }
+
+        Storage(std::initializer_list<double> values)
+            : Storage(std::vector<double>(values)) {
+        }
+
+        template <typename T>
+        Storage(const std::vector<T>& values)
+            : Storage(uninitialized(values.size(), dtype_of<T>)) {
+            std::ranges::copy(values, as<T>());
+        }
+
+        template <std::input_iterator It>
+        Storage(It first, It last)
+            : Storage(std::vector<double>(first, last)) {
+        }
+
+        Storage(size_t size, double value)
+            : Storage(uninitialized(size, DType::Float64)) {
+            std::fill_n(as<double>(), size, value);
+        }
+
+        // Zero filled
+        Storage(size_t size, DType dtype);
+
+        // Left as the allocator hands it out, for kernels that write
+        // every element
+        static Storage uninitialized(size_t size, DType dtype);
+
+        DType dtype() const {
+            return _dtype;
+        }
+
+        size_t size() const {
+            return length;
+        }
+
+        // Position of the origin in the buffer
+        size_t offset() const {
+            return _offset;
+        }
+
+        // Bytes the origin is aligned to, at most allocator::ALIGNMENT
+        size_t alignment() const;
+
+        // Whether the buffer sits on huge pages
+        bool huge_pages() const;
+
+        template <typename T>
+        T* as() {
+            if (dtype_of<T> != _dtype)
+                throw IndexingError("IndexingError: Storage dtype mismatch.");
+            return static_cast<T*>(block->ptr) + _offset;
+        }
+
+        template <typename T>
+        const T* as() const {
+            return const_cast<Storage*>(this)->as<T>();
+        }
+
+        // Float64 only
+        double* data() {
+            return as<double>();
+        }
+
+        const double* data() const {
+            return as<double>();
+        }
+
+        double& operator[](size_t i) {
+            return data()[i];
+        }
+
+        const double& operator[](size_t i) const {
+            return data()[i];
+        }
+
+        const double* begin() const {
+            return data();
+        }
+
+        const double* end() const {
+            return data() + size();
+        }
+
+        // Any dtype, converted through double. Integer dtypes hold raw
+        // quantized values, stores round and saturate.
+        double get(std::ptrdiff_t i) const;
+        void set(std::ptrdiff_t i, double value);
+
+        // Converted copy
+        Storage to(DType dtype) const;
+
+        // Window of `length` elements sharing the buffer. Its origin lies
+        // `offset` elements from the origin of this one and `first`
+        // elements into the window.
+        Storage view(std::ptrdiff_t offset,
+                     size_t length,
+                     size_t first = 0) const;
+
+        // Copy of the window into a buffer of its own
+        Storage clone() const;
+
+        // Whether no other storage refers to the buffer
+        bool unique() const {
+            return block.use_count() == 1;
+        }
+
+        bool shares(const Storage& other) const {
+            return block == other.block;
+        }
+
+        size_t version() const {
+            return block->version;
+        }
+
+        void bump_version() {
+            block->version++;
+        }
+
+        // Elementwise over the windows
+        bool operator==(const Storage& other) const;
+
+    private:
+        struct Block {
+            void* ptr;
+            size_t bytes;
+            size_t version = 0;
+
+            Block(size_t bytes);
+            ~Block();
+        };
+
+        Storage(DType dtype, size_t length, sptr<Block> block)
+            : _dtype(dtype)
+            , length(length)
+            , block(std::move(block)) {
+        }
+
+        DType _dtype   = DType::Float64;
+        size_t _offset = 0;  // origin in the buffer
+        size_t _first  = 0;  // window elements before the origin
+        size_t length  = 0;
+        sptr<Block> block;
+    };
+
     // Type - aliases
-    using Storage = std::vector<double>;
-    using Index   = std::vector<size_t>;
-    using Shape   = std::vector<size_t>;
-    using Strides = std::vector<size_t>;
+    // Inline up to MAX_INLINE_DIMS dimensions, see small_vector.hpp
+    constexpr size_t MAX_INLINE_DIMS = 8;
 
-    using ReOrderIndex      = std::vector<size_t>;
-    using TensorStorageView = std::span<const double>;
+    using Index   = utils::SmallVector<size_t, MAX_INLINE_DIMS>;
+    using Shape   = utils::SmallVector<size_t, MAX_INLINE_DIMS>;
+    using Strides = utils::SmallVector<std::ptrdiff_t, MAX_INLINE_DIMS>;
+
+    using ReOrderIndex      = utils::SmallVector<size_t, MAX_INLINE_DIMS>;
     using TensorDataTuple   = std::tuple<Storage&, Shape&, Strides&>;
     using TensorDataInfo
         = std::tuple<const Storage&, const Shape&, const Strides&>;
@@ -37,8 +301,19 @@ namespace tensor_data {
                           const Shape& broadcasted_shape);
 
     Shape shape_broadcast(const Shape& shape1, const Shape& shape2);
-    size_t index_to_position(const Index& index, const Strides& strides);
+    std::ptrdiff_t index_to_position(const Index& index,
+                                     const Strides& strides);
     Strides strides_from_shape(const Shape& shape);
+    bool is_contiguous(const Shape& shape, const Strides& strides);
+
+    // Storage window a layout reaches from its origin, as the number of
+    // elements before the origin and the length of the window
+    std::pair<size_t, size_t> storage_extent(const Shape& shape,
+                                             const Strides& strides);
+
+    // Whether two indices of the layout reach the same element, as they
+    // do along a dimension broadcast with a stride of 0
+    bool overlaps(const Shape& shape, const Strides& strides);
 
     struct TensorData {
         Storage _storage;
@@ -48,6 +323,13 @@ namespace tensor_data {
         size_t size = 0;
         int dims    = 0;
 
+        // Set on quantized integer data only
+        sptr<const QuantParams> qparams;
+
+        DType dtype() const {
+            return _storage.dtype();
+        }
+
         TensorData() {
             this->_storage = { 0 };
             this->shape    = { 0 };
@@ -86,15 +368,42 @@ namespace tensor_data {
         void print_info() const;
         TensorDataInfo info() const;
         TensorDataTuple tuple();
-        bool is_contiguous();
+        bool is_contiguous() const;
         Index sample();
-        size_t index(const Index& index) const;
+        std::ptrdiff_t index(const Index& index) const;
         void set(const Index& index);
         double get(const Index& key);
         TensorData permute(const ReOrderIndex order);
 
-        TensorStorageView view() const;
-        TensorStorageView view(const Index& index) const;
+        // Views sharing the storage. at() fixes the leading dimensions,
+        // reshape() needs contiguous data.
+        TensorData at(const Index& index) const;
+        TensorData reshape(const Shape& shape) const;
+
+        // Elements start, start + step, ... before stop along `dim`, stop
+        // is clamped to the size of the dimension
+        TensorData slice(size_t dim,
+                         size_t start,
+                         size_t stop,
+                         size_t step = 1) const;
+        TensorData narrow(size_t dim, size_t start, size_t length) const;
+
+        // Drops `dim` by fixing it to `index`
+        TensorData select(size_t dim, size_t index) const;
+
+        // Reverses the order along every dimension in `axes`
+        TensorData flip(const std::vector<size_t>& axes) const;
+
+        // Broadcasts dimensions of size 1, and new leading ones, to
+        // `shape` with a stride of 0
+        TensorData expand(const Shape& shape) const;
+
+        // Any layout over the storage, with its origin `offset` elements
+        // from the origin of this one
+        TensorData as_strided(const Shape& shape,
+                              const Strides& strides,
+                              std::ptrdiff_t offset = 0) const;
+
         std::string string_view() const;
 
         static uptr<TensorData> rand(Shape user_shape) {
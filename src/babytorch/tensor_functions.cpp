@@ -1,3 +1,5 @@
+#include <numeric>
+
 #include "ptr.hpp"
 #include "tensor.hpp"
 #include "tensor_functions.hpp"
@@ -6,6 +8,8 @@ namespace tensor_functions {
 
     using tensor::Tensor;
     using tensor_autodiff::Context;
+    using tensor_data::Shape;
+    using tensor_data::TensorData;
 
     sptr<Tensor> Add::forward(Context&,
                               const sptr<Tensor>& self,
@@ -18,6 +22,120 @@ namespace tensor_functions {
         return { d_out, d_out };
     }
 
+    sptr<Tensor> Sub::forward(Context&,
+                              const sptr<Tensor>& self,
+                              const sptr<Tensor>& other) {
+        return self->backend->sub_zip(self, other);
+    }
+
+    std::array<sptr<Tensor>, 2> Sub::backward(Context&,
+                                              const sptr<Tensor>& d_out) {
+        return { d_out, d_out->backend->neg_map(d_out) };
+    }
+
+    sptr<Tensor> Div::forward(Context& ctx,
+                              const sptr<Tensor>& self,
+                              const sptr<Tensor>& other) {
+        ctx.save_for_backwards(self, other);
+        return self->backend->div_zip(self, other);
+    }
+
+    std::array<sptr<Tensor>, 2> Div::backward(Context& ctx,
+                                              const sptr<Tensor>& d_out) {
+        auto self    = ctx.saved_values[0];
+        auto other   = ctx.saved_values[1];
+        auto backend = self->backend;
+
+        // d/dy (x / y) = -x / y^2
+        return { backend->div_zip(d_out, other),
+                 backend->inv_back_zip(other, backend->mul_zip(self, d_out)) };
+    }
+
+    sptr<Tensor> AddScalar::forward(Context&,
+                                    const sptr<Tensor>& self,
+                                    double constant) {
+        return self->backend->add_scalar(self, constant);
+    }
+
+    std::array<sptr<Tensor>, 2> AddScalar::backward(Context&,
+                                                    const sptr<Tensor>& d_out) {
+        return { d_out };
+    }
+
+    sptr<Tensor> MulScalar::forward(Context&,
+                                    const sptr<Tensor>& self,
+                                    double constant) {
+        return self->backend->mul_scalar(self, constant);
+    }
+
+    std::array<sptr<Tensor>, 2> MulScalar::backward(Context& ctx,
+                                                    const sptr<Tensor>& d_out) {
+        return { d_out->backend->mul_scalar(d_out, ctx.constant) };
+    }
+
+    sptr<Tensor> RSubScalar::forward(Context&,
+                                     const sptr<Tensor>& self,
+                                     double constant) {
+        return self->backend->rsub_scalar(self, constant);
+    }
+
+    std::array<sptr<Tensor>, 2> RSubScalar::backward(
+        Context&,
+        const sptr<Tensor>& d_out) {
+        return { d_out->backend->neg_map(d_out) };
+    }
+
+    sptr<Tensor> RDivScalar::forward(Context& ctx,
+                                     const sptr<Tensor>& self,
+                                     double constant) {
+        ctx.save_for_backwards(self);
+        return self->backend->rdiv_scalar(self, constant);
+    }
+
+    std::array<sptr<Tensor>, 2> RDivScalar::backward(
+        Context& ctx,
+        const sptr<Tensor>& d_out) {
+        auto self    = ctx.saved_values[0];
+        auto backend = self->backend;
+
+        // d/dx (c / x) = -c / x^2
+        auto scaled = backend->mul_scalar(d_out, ctx.constant);
+        return { backend->inv_back_zip(self, scaled) };
+    }
+
+    sptr<Tensor> LtScalar::forward(Context&,
+                                   const sptr<Tensor>& self,
+                                   double constant) {
+        return self->backend->lt_scalar(self, constant);
+    }
+
+    std::array<sptr<Tensor>, 2> LtScalar::backward(Context&,
+                                                   const sptr<Tensor>& d_out) {
+        return { d_out->zeros() };
+    }
+
+    sptr<Tensor> GtScalar::forward(Context&,
+                                   const sptr<Tensor>& self,
+                                   double constant) {
+        return self->backend->gt_scalar(self, constant);
+    }
+
+    std::array<sptr<Tensor>, 2> GtScalar::backward(Context&,
+                                                   const sptr<Tensor>& d_out) {
+        return { d_out->zeros() };
+    }
+
+    sptr<Tensor> EqScalar::forward(Context&,
+                                   const sptr<Tensor>& self,
+                                   double constant) {
+        return self->backend->eq_scalar(self, constant);
+    }
+
+    std::array<sptr<Tensor>, 2> EqScalar::backward(Context&,
+                                                   const sptr<Tensor>& d_out) {
+        return { d_out->zeros() };
+    }
+
     sptr<Tensor> Neg::forward(Context& ctx, const sptr<Tensor>& self) {
         ctx.save_for_backwards(self);
         return self->backend->neg_map(self);
@@ -127,6 +245,10 @@ namespace tensor_functions {
         return { a, b };
     }
 
+    Shape Is_close::output_shape(const Shape& a, const Shape& b) {
+        return tensor_data::shape_broadcast(a, b);
+    }
+
     sptr<Tensor> Is_close::forward(Context& ctx,
                                    const sptr<Tensor>& self,
                                    const sptr<Tensor>& other) {
@@ -134,6 +256,108 @@ namespace tensor_functions {
         return self->backend->is_close_zip(self, other);
     }
 
+    // Swap the two innermost dimensions. Only used inside backward, the
+    // view shares the storage and has no history of its own.
+    sptr<Tensor> transpose(const sptr<Tensor>& t) {
+        size_t dims = t->shape().size();
+
+        tensor_data::ReOrderIndex order(dims);
+        std::iota(order.begin(), order.end(), 0);
+        std::swap(order[dims - 2], order[dims - 1]);
+
+        t->realize();
+        return Tensor::create(
+            std::make_unique<TensorData>(t->data->permute(order)));
+    }
+
+    // Sum a gradient over the dimensions `shape` was broadcast along
+    sptr<Tensor> sum_to_shape(sptr<Tensor> t, const Shape& shape) {
+        if (t->shape() == shape)
+            return t;
+
+        size_t extra = t->shape().size() - shape.size();
+        for (size_t d = 0; d < t->shape().size(); d++)
+            if (d < extra || (shape[d - extra] == 1 && t->shape()[d] != 1))
+                t = t->backend->add_reduce(t, d);
+
+        // Reduced tensors are contiguous, only the leading ones are dropped
+        return Tensor::create(
+            std::make_unique<TensorData>(t->data->_storage, shape));
+    }
+
+    // Same checks as the kernel, lazy mode reports them when recording
+    Shape MatMul::output_shape(const Shape& a, const Shape& b) {
+        if (a.size() < 2 || b.size() < 2)
+            throw tensor_data::IndexingError(
+                "IndexingError: Matrix multiply expects at least 2-d tensors.");
+
+        if (b[b.size() - 2] != a.back())
+            throw tensor_data::IndexingError(
+                "IndexingError: Inner dimensions of matrix multiply differ.");
+
+        Shape out = tensor_data::shape_broadcast(Shape(a.begin(), a.end() - 2),
+                                                 Shape(b.begin(), b.end() - 2));
+        out.push_back(a[a.size() - 2]);
+        out.push_back(b.back());
+        return out;
+    }
+
+    sptr<Tensor> MatMul::forward(Context& ctx,
+                                 const sptr<Tensor>& self,
+                                 const sptr<Tensor>& other) {
+        ctx.save_for_backwards(self, other);
+        return self->backend->matrix_multiply(self, other);
+    }
+
+    void MatMul::forward_into(TensorData& out,
+                              const sptr<Tensor>& self,
+                              const sptr<Tensor>& other) {
+        tensor_ops::matrix_multiply_into(out, self, other);
+    }
+
+    std::array<sptr<Tensor>, 2> MatMul::backward(Context& ctx,
+                                                 const sptr<Tensor>& d_out) {
+        auto self  = ctx.saved_values[0];
+        auto other = ctx.saved_values[1];
+
+        Shape a_shape = self->shape(), b_shape = other->shape();
+        Shape a_batch(a_shape.begin(), a_shape.end() - 2);
+        Shape b_batch(b_shape.begin(), b_shape.end() - 2);
+
+        size_t K = a_shape.back(), N = b_shape.back();
+
+        Shape out_shape = output_shape(a_shape, b_shape);
+
+        // Seed gradient of backward() is a single element, spread it over
+        // the output first
+        auto grad = d_out->shape() == out_shape
+                        ? d_out
+                        : d_out->backend->add_zip(Tensor::zeros(out_shape),
+                                                  d_out);
+
+        // Transposes only swap strides, gemm reads them in place
+        auto matmul = self->backend->matrix_multiply;
+        auto d_self = sum_to_shape(matmul(grad, transpose(other)), a_shape);
+
+        // A weight shared by every batch gets its gradient from a single
+        // [K, batch * M] @ [batch * M, N] product instead of one product
+        // per batch followed by a reduction
+        if (b_batch.empty() && a_shape.size() == out_shape.size()
+            && self->data->is_contiguous() && grad->data->is_contiguous()) {
+            size_t rows = self->data->size / K;
+
+            auto flat_self = Tensor::create(std::make_unique<TensorData>(
+                self->data->_storage, Shape{ rows, K }));
+            auto flat_grad = Tensor::create(std::make_unique<TensorData>(
+                grad->data->_storage, Shape{ rows, N }));
+
+            return { d_self, matmul(transpose(flat_self), flat_grad) };
+        }
+
+        auto d_other = sum_to_shape(matmul(transpose(self), grad), b_shape);
+        return { d_self, d_other };
+    }
+
     sptr<Tensor> Copy::forward(Context&, const sptr<Tensor>& self) {
         return self->backend->id_map(self);
     }
@@ -2,6 +2,7 @@
 
 #include "ptr.hpp"
 #include "tensor_autodiff.hpp"
+#include "tensor_fusion.hpp"
 
 namespace tensor {
     class Tensor;
@@ -11,44 +12,85 @@ namespace tensor_functions {
 
     using tensor::Tensor;
     using tensor_autodiff::Context;
+    using tensor_fusion::Op;
+
+    // Sum a gradient over the dimensions `shape` was broadcast along
+    sptr<Tensor> sum_to_shape(sptr<Tensor> t, const tensor_data::Shape& shape);
+
+    // Elementwise functions name the fused_op that replaces their kernel
+    // when fusion is enabled
 
     struct Neg {
+        static constexpr Op fused_op = Op::Neg;
+
         static sptr<Tensor> forward(Context&, const sptr<Tensor>&);
         static std::array<sptr<Tensor>, 2> backward(Context&,
                                                     const sptr<Tensor>&);
     };
 
     struct Inv {
+        static constexpr Op fused_op = Op::Inv;
+
         static sptr<Tensor> forward(Context&, const sptr<Tensor>&);
         static std::array<sptr<Tensor>, 2> backward(Context&,
                                                     const sptr<Tensor>&);
     };
 
     struct Relu {
+        static constexpr Op fused_op = Op::Relu;
+
         static sptr<Tensor> forward(Context&, const sptr<Tensor>&);
         static std::array<sptr<Tensor>, 2> backward(Context&,
                                                     const sptr<Tensor>&);
     };
 
     struct Sigmoid {
+        static constexpr Op fused_op = Op::Sigmoid;
+
         static sptr<Tensor> forward(Context&, const sptr<Tensor>&);
         static std::array<sptr<Tensor>, 2> backward(Context&,
                                                     const sptr<Tensor>&);
     };
 
     struct Log {
+        static constexpr Op fused_op = Op::Log;
+
         static sptr<Tensor> forward(Context&, const sptr<Tensor>&);
         static std::array<sptr<Tensor>, 2> backward(Context&,
                                                     const sptr<Tensor>&);
     };
 
     struct Exp {
+        static constexpr Op fused_op = Op::Exp;
+
         static sptr<Tensor> forward(Context&, const sptr<Tensor>&);
         static std::array<sptr<Tensor>, 2> backward(Context&,
                                                     const sptr<Tensor>&);
     };
 
     struct Add {
+        static constexpr Op fused_op = Op::Add;
+
+        static sptr<Tensor> forward(Context&,
+                                    const sptr<Tensor>&,
+                                    const sptr<Tensor>&);
+        static std::array<sptr<Tensor>, 2> backward(Context&,
+                                                    const sptr<Tensor>&);
+    };
+
+    struct Sub {
+        static constexpr Op fused_op = Op::Sub;
+
+        static sptr<Tensor> forward(Context&,
+                                    const sptr<Tensor>&,
+                                    const sptr<Tensor>&);
+        static std::array<sptr<Tensor>, 2> backward(Context&,
+                                                    const sptr<Tensor>&);
+    };
+
+    struct Div {
+        static constexpr Op fused_op = Op::Div;
+
         static sptr<Tensor> forward(Context&,
                                     const sptr<Tensor>&,
                                     const sptr<Tensor>&);
@@ -57,6 +99,8 @@ namespace tensor_functions {
     };
 
     struct Mul {
+        static constexpr Op fused_op = Op::Mul;
+
         static sptr<Tensor> forward(Context&,
                                     const sptr<Tensor>&,
                                     const sptr<Tensor>&);
@@ -64,7 +108,83 @@ namespace tensor_functions {
                                                     const sptr<Tensor>&);
     };
 
+    // Functions of a tensor and a constant, applied through
+    // TensorFunction::apply_scalar. Reversed functions put the constant on
+    // the left of fused_op.
+
+    // x + c
+    struct AddScalar {
+        static constexpr Op fused_op  = Op::Add;
+        static constexpr bool reversed = false;
+
+        static sptr<Tensor> forward(Context&, const sptr<Tensor>&, double);
+        static std::array<sptr<Tensor>, 2> backward(Context&,
+                                                    const sptr<Tensor>&);
+    };
+
+    // x * c
+    struct MulScalar {
+        static constexpr Op fused_op  = Op::Mul;
+        static constexpr bool reversed = false;
+
+        static sptr<Tensor> forward(Context&, const sptr<Tensor>&, double);
+        static std::array<sptr<Tensor>, 2> backward(Context&,
+                                                    const sptr<Tensor>&);
+    };
+
+    // c - x
+    struct RSubScalar {
+        static constexpr Op fused_op  = Op::Sub;
+        static constexpr bool reversed = true;
+
+        static sptr<Tensor> forward(Context&, const sptr<Tensor>&, double);
+        static std::array<sptr<Tensor>, 2> backward(Context&,
+                                                    const sptr<Tensor>&);
+    };
+
+    // c / x
+    struct RDivScalar {
+        static constexpr Op fused_op  = Op::Div;
+        static constexpr bool reversed = true;
+
+        static sptr<Tensor> forward(Context&, const sptr<Tensor>&, double);
+        static std::array<sptr<Tensor>, 2> backward(Context&,
+                                                    const sptr<Tensor>&);
+    };
+
+    // x < c
+    struct LtScalar {
+        static constexpr Op fused_op  = Op::Lt;
+        static constexpr bool reversed = false;
+
+        static sptr<Tensor> forward(Context&, const sptr<Tensor>&, double);
+        static std::array<sptr<Tensor>, 2> backward(Context&,
+                                                    const sptr<Tensor>&);
+    };
+
+    // x > c, i.e. c < x
+    struct GtScalar {
+        static constexpr Op fused_op  = Op::Lt;
+        static constexpr bool reversed = true;
+
+        static sptr<Tensor> forward(Context&, const sptr<Tensor>&, double);
+        static std::array<sptr<Tensor>, 2> backward(Context&,
+                                                    const sptr<Tensor>&);
+    };
+
+    // x == c
+    struct EqScalar {
+        static constexpr Op fused_op  = Op::Eq;
+        static constexpr bool reversed = false;
+
+        static sptr<Tensor> forward(Context&, const sptr<Tensor>&, double);
+        static std::array<sptr<Tensor>, 2> backward(Context&,
+                                                    const sptr<Tensor>&);
+    };
+
     struct Lt {
+        static constexpr Op fused_op = Op::Lt;
+
         static sptr<Tensor> forward(Context&,
                                     const sptr<Tensor>&,
                                     const sptr<Tensor>&);
@@ -73,6 +193,8 @@ namespace tensor_functions {
     };
 
     struct Eq {
+        static constexpr Op fused_op = Op::Eq;
+
         static sptr<Tensor> forward(Context&,
                                     const sptr<Tensor>&,
                                     const sptr<Tensor>&);
@@ -88,7 +210,13 @@ namespace tensor_functions {
                                                     const sptr<Tensor>&);
     };
 
+    // Functions with an output_shape are deferred in lazy mode, see
+    // TensorFunction::apply_lazy. Their forward may only save inputs.
+
     struct Is_close {
+        static tensor_data::Shape output_shape(const tensor_data::Shape&,
+                                               const tensor_data::Shape&);
+
         static sptr<Tensor> forward(Context&,
                                     const sptr<Tensor>&,
                                     const sptr<Tensor>&);
@@ -96,7 +224,26 @@ namespace tensor_functions {
                                                     const sptr<Tensor>&);
     };
 
+    struct MatMul {
+        static tensor_data::Shape output_shape(const tensor_data::Shape&,
+                                               const tensor_data::Shape&);
+
+        static sptr<Tensor> forward(Context&,
+                                    const sptr<Tensor>&,
+                                    const sptr<Tensor>&);
+
+        // Forward into the data of a captured output, see
+        // TensorFunction::replay
+        static void forward_into(tensor_data::TensorData&,
+                                 const sptr<Tensor>&,
+                                 const sptr<Tensor>&);
+        static std::array<sptr<Tensor>, 2> backward(Context&,
+                                                    const sptr<Tensor>&);
+    };
+
     struct Copy {
+        static constexpr Op fused_op = Op::Id;
+
         static sptr<Tensor> forward(Context&, const sptr<Tensor>&);
         static std::array<sptr<Tensor>, 2> backward(Context&,
                                                     const sptr<Tensor>&);
@@ -0,0 +1,415 @@
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "generic_operators.hpp"
+#include "half.hpp"
+#include "tensor.hpp"
+#include "tensor_fusion.hpp"
+#include "tensor_iterator.hpp"
+#include "thread_pool.hpp"
+#include "utils.hpp"
+
+namespace tensor_fusion {
+
+    using tensor_data::dtype_size;
+    using tensor_data::Storage;
+    using tensor_data::visit_float_dtype;
+
+    using tensor_iterator::broadcast_strides;
+    using tensor_iterator::DimStrides;
+    using tensor_iterator::StridedIterator;
+
+    thread_local bool fusion_enabled = false;
+    thread_local bool lazy_enabled   = false;
+
+    bool enabled() {
+        return fusion_enabled;
+    }
+
+    void set_enabled(bool enable) {
+        fusion_enabled = enable;
+    }
+
+    bool lazy() {
+        return lazy_enabled;
+    }
+
+    void set_lazy(bool enable) {
+        lazy_enabled   = enable;
+        fusion_enabled = enable;
+    }
+
+    FusionScope::FusionScope(bool enable)
+        : previous(fusion_enabled) {
+        fusion_enabled = enable;
+    }
+
+    FusionScope::~FusionScope() {
+        fusion_enabled = previous;
+    }
+
+    LazyScope::LazyScope(bool enable)
+        : previous_lazy(lazy_enabled)
+        , previous_fused(fusion_enabled) {
+        set_lazy(enable);
+    }
+
+    LazyScope::~LazyScope() {
+        lazy_enabled   = previous_lazy;
+        fusion_enabled = previous_fused;
+    }
+
+    sptr<Expr> load(sptr<Tensor> input) {
+        auto expr   = std::make_shared<Expr>();
+        expr->op    = Op::Load;
+        expr->shape = input->shape();
+        expr->dtype = input->dtype();
+        expr->input = std::move(input);
+        return expr;
+    }
+
+    sptr<Expr> constant(double value) {
+        auto expr    = std::make_shared<Expr>();
+        expr->op     = Op::Const;
+        expr->shape  = { 1 };
+        expr->value  = value;
+        expr->inputs = 0;
+        return expr;
+    }
+
+    sptr<Expr> apply(Op op, sptr<Expr> a, sptr<Expr> b) {
+        auto expr    = std::make_shared<Expr>();
+        expr->op     = op;
+        expr->shape  = b ? tensor_data::shape_broadcast(a->shape, b->shape)
+                         : a->shape;
+        expr->inputs = a->inputs + (b ? b->inputs : 0);
+
+        // Constants take the dtype of the other operand
+        if (!b || b->op == Op::Const)
+            expr->dtype = a->dtype;
+        else if (a->op == Op::Const)
+            expr->dtype = b->dtype;
+        else
+            expr->dtype = tensor_data::promote_types(a->dtype, b->dtype);
+
+        expr->args = { std::move(a), std::move(b) };
+        return expr;
+    }
+
+    sptr<Expr> call(Shape shape, DType dtype, Kernel kernel) {
+        auto expr    = std::make_shared<Expr>();
+        expr->op     = Op::Call;
+        expr->shape  = std::move(shape);
+        expr->dtype  = dtype;
+        expr->kernel = std::make_shared<Kernel>(std::move(kernel));
+        return expr;
+    }
+
+    // Appends the Calls below `expr` to `order`, each after the Calls
+    // its operands depend on. Shared nodes are visited once.
+    void collect_calls(Expr& expr,
+                       std::vector<Expr*>& order,
+                       std::unordered_set<const Expr*>& seen) {
+        if (!seen.insert(&expr).second)
+            return;
+
+        if (expr.op == Op::Call) {
+            for (auto& operand : expr.kernel->operands)
+                if (operand->pending)
+                    collect_calls(*operand->pending, order, seen);
+            order.push_back(&expr);
+            return;
+        }
+
+        for (auto& arg : expr.args)
+            if (arg)
+                collect_calls(*arg, order, seen);
+    }
+
+    void schedule(Expr& expr) {
+        std::vector<Expr*> order;
+        std::unordered_set<const Expr*> seen;
+        collect_calls(expr, order, seen);
+
+        for (Expr* node : order) {
+            // Calls below the operands already ran, this only evaluates
+            // the elementwise expressions around them
+            for (auto& operand : node->kernel->operands)
+                operand->realize();
+
+            node->input = Tensor::create(node->kernel->run());
+            node->op    = Op::Load;
+            node->kernel.reset();
+        }
+    }
+
+    // Expressions are flattened into register code: every instruction
+    // computes one block of values into register `dst`
+    struct Instr {
+        Op op;
+        uint32_t dst;
+        uint32_t a;  // input slot for loads
+        uint32_t b;
+        double value;  // constants only
+    };
+
+    struct Program {
+        std::vector<Instr> code;
+        std::vector<sptr<Tensor>> inputs;
+        uint32_t registers = 0;
+    };
+
+    uint32_t compile(const Expr& expr,
+                     Program& program,
+                     std::unordered_map<const Expr*, uint32_t>& done) {
+        // Shared subexpressions, e.g. x * x, are computed once
+        if (auto it = done.find(&expr); it != done.end())
+            return it->second;
+
+        Instr instr{ expr.op, 0, 0, 0, expr.value };
+
+        if (expr.op == Op::Const) {
+            // Filled once per block below
+        }
+        else if (expr.op == Op::Load) {
+            auto& inputs = program.inputs;
+            // Compared by address, Tensor overloads == elementwise
+            auto slot = std::ranges::find_if(inputs, [&](const auto& input) {
+                return input.get() == expr.input.get();
+            });
+            if (slot == inputs.end())
+                slot = inputs.insert(slot, expr.input);
+            instr.a = static_cast<uint32_t>(slot - inputs.begin());
+        }
+        else {
+            instr.a = compile(*expr.args[0], program, done);
+            if (expr.args[1])
+                instr.b = compile(*expr.args[1], program, done);
+        }
+
+        instr.dst = program.registers++;
+        program.code.push_back(instr);
+
+        return done[&expr] = instr.dst;
+    }
+
+    // Values computed per instruction before moving on to the next one,
+    // small enough for all registers to stay in L1
+    constexpr std::ptrdiff_t BLOCK = 256;
+
+    // Wraps an operator into a lambda type so the loops below inline it
+    template <auto op>
+    constexpr auto fn = [](auto... x) -> double { return op(x...); };
+
+    template <typename Fn>
+    void unary(const Fn& fn, const double* x, double* out, std::ptrdiff_t n) {
+        for (std::ptrdiff_t i = 0; i < n; i++)
+            out[i] = fn(x[i]);
+    }
+
+    template <typename Fn>
+    void binary(const Fn& fn,
+                const double* x,
+                const double* y,
+                double* out,
+                std::ptrdiff_t n) {
+        for (std::ptrdiff_t i = 0; i < n; i++)
+            out[i] = fn(x[i], y[i]);
+    }
+
+    template <typename T>
+    void load_block(const T* load,
+                    std::ptrdiff_t load_step,
+                    double* out,
+                    std::ptrdiff_t n) {
+        if constexpr (half::is_half<T>)
+            if (load_step == 1) {
+                float widened[BLOCK];
+                half::to_float(load, widened, n);
+                std::copy(widened, widened + n, out);
+                return;
+            }
+
+        if (load_step == 1)
+            std::copy(load, load + n, out);
+        else if (load_step == 0)
+            std::fill(out, out + n, double(*load));
+        else
+            for (std::ptrdiff_t i = 0; i < n; i++)
+                out[i] = load[i * load_step];
+    }
+
+    // Inputs keep their own dtype, loads widen them to double
+    struct Input {
+        const void* data;
+        DType dtype;
+
+        static Input of(const Storage& storage) {
+            return visit_float_dtype(storage.dtype(), [&]<typename T>() {
+                return Input{ storage.as<T>(), storage.dtype() };
+            });
+        }
+
+        Input at(std::ptrdiff_t offset) const {
+            auto width = static_cast<std::ptrdiff_t>(dtype_size(dtype));
+            auto bytes = offset * width;
+            return { static_cast<const std::byte*>(data) + bytes, dtype };
+        }
+    };
+
+    void execute(const Instr& instr,
+                 double* regs,
+                 Input load,
+                 std::ptrdiff_t load_step,
+                 std::ptrdiff_t n) {
+        using namespace generic_operators;
+
+        double* out     = regs + instr.dst * BLOCK;
+        const double* x = regs + instr.a * BLOCK;
+        const double* y = regs + instr.b * BLOCK;
+
+        switch (instr.op) {
+            case Op::Load:
+                visit_float_dtype(load.dtype, [&]<typename T>() {
+                    auto* data = static_cast<const T*>(load.data);
+                    load_block(data, load_step, out, n);
+                });
+                break;
+            case Op::Const: std::fill(out, out + n, instr.value); break;
+            case Op::Id: unary(fn<id<double>>, x, out, n); break;
+            case Op::Neg: unary(fn<neg<double>>, x, out, n); break;
+            case Op::Inv: unary(fn<inv<double>>, x, out, n); break;
+            case Op::Relu: unary(fn<relu<double>>, x, out, n); break;
+            case Op::Sigmoid: unary(fn<sigmoid<double>>, x, out, n); break;
+            case Op::Log: unary(fn<log_func<double>>, x, out, n); break;
+            case Op::Exp: unary(fn<exp_func<double>>, x, out, n); break;
+            case Op::Add: binary(fn<add<double>>, x, y, out, n); break;
+            case Op::Sub: binary(fn<sub<double>>, x, y, out, n); break;
+            case Op::Mul: binary(fn<mul<double>>, x, y, out, n); break;
+            case Op::Div: binary(fn<div<double>>, x, y, out, n); break;
+            case Op::Lt: binary(fn<lt<double>>, x, y, out, n); break;
+            case Op::Eq: binary(fn<eq<double>>, x, y, out, n); break;
+            case Op::Call: break;  // turned into loads by schedule()
+        }
+    }
+
+    using Iterator = StridedIterator<MAX_INPUTS + 1>;
+
+    // Runs the program over every output element, storing values as T
+    template <typename T>
+    void evaluate(const Program& program,
+                  uint32_t result,
+                  const Iterator& it,
+                  const std::array<Input, MAX_INPUTS>& data,
+                  T* out_ptr) {
+        size_t grain = std::max<size_t>(1, thread_pool::GRAIN_SIZE / it.inner);
+
+        thread_pool::parallel_for(0, it.rows(), grain, [&](size_t b, size_t e) {
+            thread_local std::vector<double> regs;
+            regs.resize(program.registers * BLOCK);
+
+            Iterator rows = it;
+            rows.seek(b);
+
+            for (size_t row = b; row < e; row++, rows.next()) {
+                for (std::ptrdiff_t i0 = 0; i0 < rows.inner; i0 += BLOCK) {
+                    std::ptrdiff_t n = std::min(BLOCK, rows.inner - i0);
+
+                    for (const Instr& instr : program.code) {
+                        Input load{};
+                        std::ptrdiff_t step = 0;
+
+                        if (instr.op == Op::Load) {
+                            step = rows.inner_stride[instr.a + 1];
+                            load = data[instr.a].at(rows.pos[instr.a + 1]
+                                                    + i0 * step);
+                        }
+
+                        execute(instr, regs.data(), load, step, n);
+                    }
+
+                    const double* value = regs.data() + result * BLOCK;
+                    std::ptrdiff_t step = rows.inner_stride[0];
+                    T* dst              = out_ptr + rows.pos[0] + i0 * step;
+
+                    if constexpr (half::is_half<T>)
+                        if (step == 1) {
+                            float narrowed[BLOCK];
+                            std::copy(value, value + n, narrowed);
+                            half::from_float(narrowed, dst, n);
+                            continue;
+                        }
+
+                    if (step == 1)
+                        std::copy(value, value + n, dst);
+                    else
+                        for (std::ptrdiff_t i = 0; i < n; i++)
+                            dst[i * step] = static_cast<T>(value[i]);
+                }
+            }
+        });
+    }
+
+    // Runs a compiled program over every element of `out`, which has the
+    // shape of the expression
+    void evaluate_into(const Program& program,
+                       uint32_t result,
+                       TensorData& out) {
+        // Slot 0 is the output, unused input slots keep zero strides
+        std::array<DimStrides, MAX_INPUTS + 1> strides{};
+        std::array<Input, MAX_INPUTS> data{};
+
+        strides[0] = broadcast_strides(out.shape, out.strides, out.shape);
+        for (size_t k = 0; k < program.inputs.size(); k++) {
+            auto [in_storage, in_shape, in_strides] = program.inputs[k]->info();
+            strides[k + 1] = broadcast_strides(in_shape, in_strides, out.shape);
+            data[k]        = Input::of(in_storage);
+        }
+
+        Iterator it(out.shape, strides);
+
+        if (it.empty())
+            return;
+
+        visit_float_dtype(out.dtype(), [&]<typename T>() {
+            evaluate(program, result, it, data, out._storage.as<T>());
+        });
+    }
+
+    Program compile(const Expr& expr, uint32_t& result) {
+        Program program;
+        std::unordered_map<const Expr*, uint32_t> done;
+        result = compile(expr, program, done);
+
+        if (program.inputs.size() > MAX_INPUTS)
+            throw tensor_data::IndexingError(
+                "IndexingError: Too many inputs for a fused kernel.");
+
+        return program;
+    }
+
+    uptr<TensorData> realize(const Expr& expr) {
+        uint32_t result;
+        Program program = compile(expr, result);
+
+        const Shape& shape = expr.shape;
+        auto out           = std::make_unique<TensorData>(
+            Storage::uninitialized(generic_operators::prod(shape), expr.dtype),
+            shape);
+
+        evaluate_into(program, result, *out);
+        return out;
+    }
+
+    std::function<void(TensorData&)> compile_into(const Expr& expr) {
+        uint32_t result;
+        Program program = compile(expr, result);
+
+        return [program = std::move(program), result](TensorData& out) {
+            evaluate_into(program, result, out);
+        };
+    }
+
+}  // namespace tensor_fusion
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "ptr.hpp"
+#include "tensor_data.hpp"
+
+namespace tensor {
+    class Tensor;
+}
+
+namespace tensor_fusion {
+    // Fusion of chained elementwise tensor functions.
+    //
+    // While a FusionScope is active, elementwise TensorFunction::apply calls
+    // do not run their kernel. They return a pending Tensor carrying an
+    // expression over already realized inputs. The first access to its data
+    // realizes the whole expression in one strided pass, reading every input
+    // once and writing only the final output. History is recorded as usual,
+    // so backward realizes intermediates it needs on demand.
+    //
+    // A LazyScope goes further: functions with a kernel of their own, such
+    // as matmul, defer it as well and record a Call node, as do views,
+    // contiguous() and dtype conversions of pending values. Nothing runs
+    // until a value is observed, i.e. its data is accessed, it is printed
+    // or backward() starts from it. The scheduler then walks everything
+    // that value depends on and runs the pending kernels in dependency
+    // order, each once however many expressions read it, and fuses the
+    // elementwise parts around them. Kernels of results that are never
+    // observed are never run. In-place ops and functions without an
+    // output_shape (see tensor_functions.hpp) realize their inputs.
+
+    using tensor::Tensor;
+    using tensor_data::DType;
+    using tensor_data::Shape;
+    using tensor_data::TensorData;
+
+    enum class Op : uint8_t {
+        Load,
+        Const,
+        Id,
+        Neg,
+        Inv,
+        Relu,
+        Sigmoid,
+        Log,
+        Exp,
+        Add,
+        Sub,
+        Mul,
+        Div,
+        Lt,
+        Eq,
+        Call,
+    };
+
+    // Distinct realized inputs a single fused kernel reads
+    constexpr size_t MAX_INPUTS = 8;
+
+    // Deferred kernel of a Call node, reading `operands` once they are
+    // realized
+    struct Kernel {
+        std::vector<sptr<Tensor>> operands;
+        std::function<uptr<TensorData>()> run;
+    };
+
+    // Node of a pending expression. A Load reads `input`, a Const yields
+    // `value`, a Call runs `kernel`, any other node applies `op` to its
+    // arguments. Values are computed in double and stored in `dtype`.
+    // The scheduler turns a Call into a Load of its result.
+    struct Expr {
+        Op op;
+        Shape shape;
+        DType dtype = DType::Float64;
+        sptr<Tensor> input;
+        double value = 0.0;
+        std::array<sptr<Expr>, 2> args;
+        sptr<Kernel> kernel;
+        size_t inputs = 1;  // loads below this node, repeats included
+    };
+
+    // Whether elementwise functions are fused, also true in lazy mode
+    bool enabled();
+    void set_enabled(bool enable);
+
+    bool lazy();
+    void set_lazy(bool enable);
+
+    // Turns fusion on (or off) for the lifetime of the scope
+    class FusionScope {
+    public:
+        explicit FusionScope(bool enable = true);
+        ~FusionScope();
+
+        FusionScope(const FusionScope&)            = delete;
+        FusionScope& operator=(const FusionScope&) = delete;
+
+    private:
+        bool previous;
+    };
+
+    // Turns lazy mode, and with it fusion, on (or off) for the lifetime
+    // of the scope
+    class LazyScope {
+    public:
+        explicit LazyScope(bool enable = true);
+        ~LazyScope();
+
+        LazyScope(const LazyScope&)            = delete;
+        LazyScope& operator=(const LazyScope&) = delete;
+
+    private:
+        bool previous_lazy;
+        bool previous_fused;
+    };
+
+    sptr<Expr> load(sptr<Tensor> input);
+    sptr<Expr> constant(double value);
+    sptr<Expr> apply(Op op, sptr<Expr> a, sptr<Expr> b = nullptr);
+    sptr<Expr> call(Shape shape, DType dtype, Kernel kernel);
+
+    // Runs every Call the expression depends on, turning them into loads
+    void schedule(Expr& expr);
+
+    // Evaluate a scheduled expression into freshly allocated tensor data
+    uptr<TensorData> realize(const Expr& expr);
+
+    // Compiles an expression over realized loads once. The kernel writes
+    // its value into existing data of the same shape, reading the current
+    // data of the loads on every call.
+    std::function<void(TensorData&)> compile_into(const Expr& expr);
+
+}  // namespace tensor_fusion
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <sstream>
+
+#include "tensor_data.hpp"
+
+namespace tensor_iterator {
+    // Allocation-free N-d iteration over strided storage.
+    //
+    // Kernels walk the output shape in row-major order, running a tight loop
+    // over the innermost dimension and advancing the remaining dimensions
+    // like an odometer. Every operand keeps its own storage position which
+    // is stepped by precomputed per-dimension stride deltas, so no index
+    // vectors are built per element.
+
+    using tensor_data::IndexingError;
+    using tensor_data::Shape;
+    using tensor_data::Strides;
+
+    constexpr size_t MAX_DIMS = 16;
+
+    using DimSizes   = std::array<size_t, MAX_DIMS>;
+    using DimStrides = std::array<std::ptrdiff_t, MAX_DIMS>;
+
+    inline void check_rank(const size_t dims) {
+        if (dims > MAX_DIMS) {
+            std::ostringstream msg;
+            msg << "IndexingError: Tensors with more than " << MAX_DIMS
+                << " dimensions are not supported, got " << dims << ".";
+            throw IndexingError(msg.str());
+        }
+    }
+
+    // Strides of an operand as seen from the (broadcasted) output shape:
+    // dimensions that are missing or of size 1 get stride 0
+    inline DimStrides broadcast_strides(const Shape& shape,
+                                        const Strides& strides,
+                                        const Shape& out_shape) {
+        check_rank(out_shape.size());
+
+        DimStrides out_strides{};
+        size_t offset = out_shape.size() - shape.size();
+
+        for (size_t i = 0; i < shape.size(); i++)
+            if (shape[i] != 1)
+                out_strides[i + offset] = strides[i];
+
+        return out_strides;
+    }
+
+    template <size_t N>
+    struct StridedIterator {
+        size_t dims          = 0;  // outer dimensions walked by the odometer
+        std::ptrdiff_t inner = 1;  // extent of the innermost dimension
+        size_t total         = 1;  // number of elements visited
+
+        DimSizes shape{};
+        DimSizes counter{};
+        std::array<DimStrides, N> strides{};
+        std::array<DimStrides, N> back_strides{};
+
+        std::array<std::ptrdiff_t, N> pos{};
+        std::array<std::ptrdiff_t, N> inner_stride{};
+
+        StridedIterator(const Shape& out_shape,
+                        const std::array<DimStrides, N>& operand_strides) {
+            check_rank(out_shape.size());
+
+            // Drop unit dimensions and merge neighbours that are laid out
+            // back to back for every operand, e.g. a contiguous [3, 4, 5]
+            // collapses into a single dimension of 60 elements
+            size_t rank = 0;
+            for (size_t d = 0; d < out_shape.size(); d++) {
+                total *= out_shape[d];
+                if (out_shape[d] == 1)
+                    continue;
+
+                bool mergeable = rank > 0;
+                for (size_t k = 0; k < N && mergeable; k++)
+                    mergeable = strides[k][rank - 1]
+                                == operand_strides[k][d]
+                                       * static_cast<std::ptrdiff_t>(
+                                           out_shape[d]);
+
+                if (mergeable) {
+                    shape[rank - 1] *= out_shape[d];
+                    for (size_t k = 0; k < N; k++)
+                        strides[k][rank - 1] = operand_strides[k][d];
+                    continue;
+                }
+
+                shape[rank] = out_shape[d];
+                for (size_t k = 0; k < N; k++)
+                    strides[k][rank] = operand_strides[k][d];
+                rank++;
+            }
+
+            if (rank == 0)
+                return;
+
+            this->dims  = rank - 1;
+            this->inner = shape[rank - 1];
+            for (size_t k = 0; k < N; k++)
+                inner_stride[k] = strides[k][rank - 1];
+
+            for (size_t d = 0; d < this->dims; d++)
+                for (size_t k = 0; k < N; k++)
+                    back_strides[k][d] = strides[k][d]
+                                         * static_cast<std::ptrdiff_t>(
+                                             shape[d] - 1);
+        }
+
+        bool empty() const {
+            return total == 0;
+        }
+
+        // Number of innermost rows, i.e. calls to next() + 1
+        size_t rows() const {
+            return empty() ? 0 : total / inner;
+        }
+
+        // Jump to the start of an innermost row, used to split iteration
+        // between threads
+        void seek(size_t row) {
+            for (size_t k = 0; k < N; k++)
+                pos[k] = 0;
+
+            for (size_t d = this->dims; d-- > 0;) {
+                counter[d] = row % shape[d];
+                row /= shape[d];
+
+                for (size_t k = 0; k < N; k++)
+                    pos[k] += strides[k][d]
+                              * static_cast<std::ptrdiff_t>(counter[d]);
+            }
+        }
+
+        // Advance to the next innermost row, returns false once exhausted
+        bool next() {
+            for (size_t d = this->dims; d-- > 0;) {
+                if (++counter[d] < shape[d]) {
+                    for (size_t k = 0; k < N; k++)
+                        pos[k] += strides[k][d];
+                    return true;
+                }
+
+                counter[d] = 0;
+                for (size_t k = 0; k < N; k++)
+                    pos[k] -= back_strides[k][d];
+            }
+            return false;
+        }
+    };
+
+}  // namespace tensor_iterator
@@ -1,142 +1,752 @@
+#include <algorithm>
+#include <functional>
+#include <numeric>
 #include <ranges>
 
+#include "gemm.hpp"
+#include "half.hpp"
 #include "ptr.hpp"
+#include "quantize.hpp"
 #include "tensor.hpp"
 #include "tensor_data.hpp"
+#include "tensor_iterator.hpp"
 #include "tensor_ops.hpp"
+#include "thread_pool.hpp"
 #include "utils.hpp"
 
 namespace tensor_ops {
     using tensor::Tensor;
 
+    using tensor_data::DType;
     using tensor_data::Index;
     using tensor_data::Shape;
     using tensor_data::Storage;
     using tensor_data::Strides;
 
-    using tensor_data::broadcast_index;
-    using tensor_data::index_to_position;
     using tensor_data::shape_broadcast;
-    using tensor_data::to_tensor_index;
 
-    UnivariateTensorDataFn tensor_map(UnivariateFn fn) {
-        return [fn](const TensorDataInfo& a) -> sptr<Tensor> {
-            auto& [in_storage, in_shape, in_strides] = a;
+    using tensor_iterator::broadcast_strides;
+    using tensor_iterator::StridedIterator;
+
+    using tensor_data::is_contiguous;
+    using tensor_data::overlaps;
+    using tensor_data::promote_types;
+    using tensor_data::visit_float_dtype;
+
+    using thread_pool::GRAIN_SIZE;
+    using thread_pool::parallel_for;
+
+    // Contiguous kernels: operands share the output shape and are laid out
+    // densely in row-major order, so storage can be walked linearly without
+    // any index bookkeeping. Every kernel reads and writes elements of type
+    // T, operators are evaluated in double.
+    //
+    // 16-bit elements are converted a block at a time, to float when they
+    // are loaded and back when the block is stored.
+
+    constexpr size_t CONVERT_BLOCK = 256;
+
+    // Reductions of 16-bit elements accumulate in float
+    template <typename T>
+    using Accumulator = std::conditional_t<half::is_half<T>, float, T>;
+
+    template <typename T, typename Fn>
+    void map_contiguous(const Fn& fn,
+                        const Storage& in_storage,
+                        Storage& out_storage) {
+        const T* in = in_storage.as<T>();
+        T* out      = out_storage.as<T>();
+        size_t len  = out_storage.size();
+
+        parallel_for(0, len, GRAIN_SIZE, [&](size_t b, size_t e) {
+            if constexpr (half::is_half<T>) {
+                float x[CONVERT_BLOCK], y[CONVERT_BLOCK];
+
+                for (size_t i0 = b; i0 < e; i0 += CONVERT_BLOCK) {
+                    size_t n = std::min(CONVERT_BLOCK, e - i0);
+
+                    half::to_float(in + i0, x, n);
+                    for (size_t i = 0; i < n; i++)
+                        y[i] = fn(x[i]);
+                    half::from_float(y, out + i0, n);
+                }
+            }
+            else
+                for (size_t i = b; i < e; i++)
+                    out[i] = fn(in[i]);
+        });
+    }
+
+    template <typename T, typename Fn>
+    void zip_contiguous(const Fn& fn,
+                        const Storage& a_storage,
+                        const Storage& b_storage,
+                        Storage& out_storage) {
+        const T* a = a_storage.as<T>();
+        const T* b = b_storage.as<T>();
+        T* out     = out_storage.as<T>();
+        size_t len = out_storage.size();
+
+        parallel_for(0, len, GRAIN_SIZE, [&](size_t s, size_t e) {
+            if constexpr (half::is_half<T>) {
+                float x[CONVERT_BLOCK], y[CONVERT_BLOCK], z[CONVERT_BLOCK];
+
+                for (size_t i0 = s; i0 < e; i0 += CONVERT_BLOCK) {
+                    size_t n = std::min(CONVERT_BLOCK, e - i0);
+
+                    half::to_float(a + i0, x, n);
+                    half::to_float(b + i0, y, n);
+                    for (size_t i = 0; i < n; i++)
+                        z[i] = fn(x[i], y[i]);
+                    half::from_float(z, out + i0, n);
+                }
+            }
+            else
+                for (size_t i = s; i < e; i++)
+                    out[i] = fn(a[i], b[i]);
+        });
+    }
+
+    template <typename T, typename Fn>
+    void reduce_contiguous(const Fn& fn,
+                           const Storage& in_storage,
+                           const Shape& in_shape,
+                           const size_t dim,
+                           Storage& out_storage) {
+        // View input as [outer, reduce, inner] around the reduced dimension
+        auto outer_dims = in_shape | std::views::take(dim);
+        auto inner_dims = in_shape | std::views::drop(dim + 1);
+
+        size_t outer  = std::accumulate(outer_dims.begin(),
+                                       outer_dims.end(),
+                                       1ull,
+                                       std::multiplies<size_t>());
+        size_t inner  = std::accumulate(inner_dims.begin(),
+                                       inner_dims.end(),
+                                       1ull,
+                                       std::multiplies<size_t>());
+        size_t reduce = in_shape[dim];
+
+        // Split the outer * inner output elements, each costs `reduce` steps
+        size_t grain = std::max<size_t>(1, GRAIN_SIZE / std::max(1ul, reduce));
+
+        parallel_for(0, outer * inner, grain, [&](size_t b, size_t e) {
+            std::vector<Accumulator<T>> acc;
+
+            for (size_t idx = b; idx < e;) {
+                size_t o     = idx / inner;
+                size_t start = idx % inner;
+                size_t stop  = std::min(inner, start + (e - idx));
+
+                const T* in = in_storage.as<T>() + o * reduce * inner;
+                T* out      = out_storage.as<T>() + o * inner;
+
+                acc.assign(out + start, out + stop);
+
+                for (size_t j = 0; j < reduce; j++)
+                    for (size_t i = start; i < stop; i++)
+                        acc[i - start] = fn(in[j * inner + i], acc[i - start]);
+
+                std::copy(acc.begin(), acc.end(), out + start);
+
+                idx += stop - start;
+            }
+        });
+    }
+
+    // Strided kernels: general fallback for broadcasted or permuted operands,
+    // driven by the allocation-free odometer in tensor_iterator
+
+    template <typename T, typename Fn>
+    void map_strided(const Fn& fn,
+                     const TensorDataInfo& in,
+                     const Shape& out_shape,
+                     const Strides& out_strides,
+                     Storage& out_storage) {
+        auto& [in_storage, in_shape, in_strides] = in;
 
-            auto out_tensor = Tensor::zeros(in_shape);
-            auto data_tuple = out_tensor->data->tuple();
+        StridedIterator<2> it(
+            out_shape,
+            { broadcast_strides(out_shape, out_strides, out_shape),
+              broadcast_strides(in_shape, in_strides, out_shape) });
 
-            auto& [out_storage, out_shape, out_strides] = data_tuple;
+        if (it.empty())
+            return;
 
-            Index out_index = utils::zeros<size_t>(out_shape.size());
-            Index in_index  = utils::zeros<size_t>(out_shape.size());
+        const T* in_ptr = in_storage.as<T>();
+        T* out_ptr      = out_storage.as<T>();
 
-            for (size_t idx : std::views::iota(0ull, in_storage.size())) {
-                out_index     = to_tensor_index(idx, out_index, out_shape);
-                out_index     = broadcast_index(out_index, out_shape, in_shape);
-                size_t in_pos = index_to_position(in_index, in_strides);
-                size_t out_pos = index_to_position(out_index, out_strides);
+        auto [out_step, in_step] = it.inner_stride;
 
-                out_storage[out_pos] = fn(in_storage[in_pos]);
+        size_t grain = std::max<size_t>(1, GRAIN_SIZE / it.inner);
+
+        parallel_for(0, it.rows(), grain, [&](size_t b, size_t e) {
+            StridedIterator<2> rows = it;
+            rows.seek(b);
+
+            for (size_t row = b; row < e; row++, rows.next()) {
+                auto [out_pos, in_pos] = rows.pos;
+                for (std::ptrdiff_t i = 0; i < rows.inner; i++)
+                    out_ptr[out_pos + i * out_step] = fn(
+                        in_ptr[in_pos + i * in_step]);
             }
+        });
+    }
 
-            return out_tensor;
-        };
+    template <typename T, typename Fn>
+    void zip_strided(const Fn& fn,
+                     const TensorDataInfo& a,
+                     const TensorDataInfo& b,
+                     const Shape& out_shape,
+                     const Strides& out_strides,
+                     Storage& out_storage) {
+        auto& [a_storage, a_shape, a_strides] = a;
+        auto& [b_storage, b_shape, b_strides] = b;
+
+        StridedIterator<3> it(
+            out_shape,
+            { broadcast_strides(out_shape, out_strides, out_shape),
+              broadcast_strides(a_shape, a_strides, out_shape),
+              broadcast_strides(b_shape, b_strides, out_shape) });
+
+        if (it.empty())
+            return;
+
+        const T* a_ptr = a_storage.as<T>();
+        const T* b_ptr = b_storage.as<T>();
+        T* out_ptr     = out_storage.as<T>();
+
+        auto [out_step, a_step, b_step] = it.inner_stride;
+
+        size_t grain = std::max<size_t>(1, GRAIN_SIZE / it.inner);
+
+        parallel_for(0, it.rows(), grain, [&](size_t s, size_t e) {
+            StridedIterator<3> rows = it;
+            rows.seek(s);
+
+            for (size_t row = s; row < e; row++, rows.next()) {
+                auto [out_pos, a_pos, b_pos] = rows.pos;
+                for (std::ptrdiff_t i = 0; i < rows.inner; i++)
+                    out_ptr[out_pos + i * out_step] = fn(
+                        a_ptr[a_pos + i * a_step],
+                        b_ptr[b_pos + i * b_step]);
+            }
+        });
     }
 
-    BivariateTensorDataFn tensor_zip(BivariateFn fn) {
-        return [fn](const TensorDataInfo& a,
-                    const TensorDataInfo& b) -> sptr<Tensor> {
-            auto& [a_storage, a_shape, a_strides] = a;
-            auto& [b_storage, b_shape, b_strides] = b;
+    template <typename T, typename Fn>
+    void reduce_strided(const Fn& fn,
+                        const TensorDataInfo& in,
+                        const size_t dim,
+                        const Shape& out_shape,
+                        const Strides& out_strides,
+                        Storage& out_storage) {
+        auto& [in_storage, in_shape, in_strides] = in;
+
+        // Walk the output shape and reduce along `dim` for every element;
+        // input and output share their rank so strides map one to one
+        StridedIterator<2> it(
+            out_shape,
+            { broadcast_strides(out_shape, out_strides, out_shape),
+              broadcast_strides(out_shape, in_strides, out_shape) });
 
-            Shape out_shape = a_shape != b_shape
-                                  ? shape_broadcast(a_shape, b_shape)
-                                  : a_shape;
+        if (it.empty())
+            return;
 
-            auto out_tensor = Tensor::zeros(out_shape);
-            auto data_tuple = out_tensor->data->tuple();
+        const T* in_ptr = in_storage.as<T>();
+        T* out_ptr      = out_storage.as<T>();
 
-            auto& [out_storage, _, out_strides] = data_tuple;
+        auto [out_step, in_step] = it.inner_stride;
 
-            Index out_index = utils::zeros<size_t>(out_shape.size());
-            Index a_index   = utils::zeros<size_t>(a_shape.size());
-            Index b_index   = utils::zeros<size_t>(b_shape.size());
+        std::ptrdiff_t reduce_size = in_shape[dim];
+        std::ptrdiff_t reduce_step = in_strides[dim];
 
-            size_t idx = 0;
-            size_t len = out_storage.size();
-            while (idx < len) {
-                out_index = to_tensor_index(idx, out_index, out_shape);
+        size_t work  = it.inner * std::max<std::ptrdiff_t>(1, reduce_size);
+        size_t grain = std::max<size_t>(1, GRAIN_SIZE / work);
 
-                a_index = broadcast_index(out_index, out_shape, a_shape);
-                b_index = broadcast_index(out_index, out_shape, b_shape);
+        parallel_for(0, it.rows(), grain, [&](size_t b, size_t e) {
+            StridedIterator<2> rows = it;
+            rows.seek(b);
 
-                size_t ai = index_to_position(a_index, a_strides);
-                size_t bi = index_to_position(b_index, b_strides);
-                size_t oi = index_to_position(out_index,
-                                              out_tensor->data->strides);
+            for (size_t row = b; row < e; row++, rows.next()) {
+                auto [out_pos, in_pos] = rows.pos;
+                for (std::ptrdiff_t i = 0; i < rows.inner; i++) {
+                    T& dst           = out_ptr[out_pos + i * out_step];
+                    const T* slice   = in_ptr + in_pos + i * in_step;
+                    Accumulator<T> acc = dst;
 
-                out_storage[oi] = fn(a_storage[ai], b_storage[bi]);
-                idx++;
+                    for (std::ptrdiff_t j = 0; j < reduce_size; j++)
+                        acc = fn(slice[j * reduce_step], acc);
+
+                    dst = acc;
+                }
             }
-            return out_tensor;
-        };
+        });
     }
 
-    ReduceTensorDataFn tensor_reduce(BivariateFn fn) {
-        return [fn](const TensorDataInfo& a, size_t dim) -> sptr<Tensor> {
-            auto& [in_storage, in_shape, in_strides] = a;
+    // Dispatch: take the flat loop whenever the layout allows it and fall
+    // back to the strided iterator otherwise. `Fn` is either a type-erased
+    // std::function or a lambda forwarding to a compile-time operator, in
+    // which case the operator is inlined into the loops above.
+    //
+    // Results take the promoted dtype of the operands, an operand of
+    // another dtype is converted once up front.
 
-            Shape out_shape = in_shape;
-            out_shape[dim]  = 1;
+    template <typename Fn>
+    sptr<Tensor> map_tensor_data(const Fn& fn, const TensorDataInfo& a) {
+        auto& [in_storage, in_shape, in_strides] = a;
 
-            auto out_tensor = Tensor::zeros(out_shape);
-            auto data_tuple = out_tensor->data->tuple();
+        DType dtype     = in_storage.dtype();
+        auto out_tensor = Tensor::empty(in_shape, dtype);
+        auto data_tuple = out_tensor->data->tuple();
 
-            auto& [out_storage, _, out_strides] = data_tuple;
+        auto& [out_storage, out_shape, out_strides] = data_tuple;
 
-            Index out_index = utils::zeros<size_t>(out_shape.size());
+        visit_float_dtype(dtype, [&]<typename T>() {
+            if (is_contiguous(in_shape, in_strides))
+                map_contiguous<T>(fn, in_storage, out_storage);
+            else
+                map_strided<T>(fn, a, out_shape, out_strides, out_storage);
+        });
 
-            for (size_t idx = 0; idx < out_storage.size(); idx++) {
-                out_index = to_tensor_index(idx, out_index, out_shape);
-                auto pos  = index_to_position(out_index, out_strides);
+        return out_tensor;
+    }
 
-                for (auto j : std::views::iota(0ull, in_shape[dim])) {
-                    Index in_index = out_index;
-                    in_index[dim]  = j;
-                    size_t pos_a   = index_to_position(in_index, in_strides);
+    template <typename Fn>
+    sptr<Tensor> zip_tensor_data(const Fn& fn,
+                                 const TensorDataInfo& a,
+                                 const TensorDataInfo& b) {
+        auto& [a_storage, a_shape, a_strides] = a;
+        auto& [b_storage, b_shape, b_strides] = b;
+
+        DType dtype = promote_types(a_storage.dtype(), b_storage.dtype());
+
+        if (a_storage.dtype() != dtype) {
+            TensorData cast(a_storage.to(dtype), a_shape, a_strides);
+            return zip_tensor_data(fn, cast.info(), b);
+        }
+        if (b_storage.dtype() != dtype) {
+            TensorData cast(b_storage.to(dtype), b_shape, b_strides);
+            return zip_tensor_data(fn, a, cast.info());
+        }
+
+        bool same_shape = a_shape == b_shape;
+        Shape out_shape = same_shape ? a_shape
+                                     : shape_broadcast(a_shape, b_shape);
+
+        auto out_tensor = Tensor::empty(out_shape, dtype);
+        auto data_tuple = out_tensor->data->tuple();
+
+        auto& [out_storage, _, out_strides] = data_tuple;
+
+        visit_float_dtype(dtype, [&]<typename T>() {
+            if (same_shape && is_contiguous(a_shape, a_strides)
+                && is_contiguous(b_shape, b_strides))
+                zip_contiguous<T>(fn, a_storage, b_storage, out_storage);
+            else
+                zip_strided<T>(fn, a, b, out_shape, out_strides, out_storage);
+        });
+
+        return out_tensor;
+    }
 
-                    out_storage[pos] = fn(in_storage[pos_a], out_storage[pos]);
-                }
-            }
-            return out_tensor;
+    template <typename Fn>
+    sptr<Tensor> reduce_tensor_data(const Fn& fn,
+                                    const TensorDataInfo& a,
+                                    const size_t dim) {
+        auto& [in_storage, in_shape, in_strides] = a;
+
+        Shape out_shape = in_shape;
+        out_shape[dim]  = 1;
+
+        // Reductions accumulate onto the zeroed output
+        DType dtype     = in_storage.dtype();
+        auto out_tensor = Tensor::zeros(out_shape, dtype);
+        auto data_tuple = out_tensor->data->tuple();
+
+        auto& [out_storage, _, out_strides] = data_tuple;
+
+        visit_float_dtype(dtype, [&]<typename T>() {
+            if (is_contiguous(in_shape, in_strides))
+                reduce_contiguous<T>(
+                    fn, in_storage, in_shape, dim, out_storage);
+            else
+                reduce_strided<T>(
+                    fn, a, dim, out_shape, out_strides, out_storage);
+        });
+
+        return out_tensor;
+    }
+
+    // In-place kernels reuse the zip kernels with the output doubling as
+    // the first operand. Each output element is read just before it is
+    // written, so an operand that overlaps the output any other way is
+    // copied first.
+
+    // A layout reaching an element from several indices, e.g. an expand,
+    // would have it written once per index
+    void check_writable(const TensorData& out) {
+        if (overlaps(out.shape, out.strides))
+            throw tensor_data::IndexingError(
+                "IndexingError: In-place output has overlapping elements.");
+    }
+
+    template <typename Fn>
+    void zip_inplace(const Fn& fn, TensorData& out, const TensorDataInfo& in) {
+        auto& [in_storage, in_shape, in_strides] = in;
+
+        check_writable(out);
+
+        if (shape_broadcast(out.shape, in_shape) != out.shape)
+            throw tensor_data::IndexingError(
+                "IndexingError: In-place operand does not broadcast to the "
+                "output shape.");
+
+        // The output keeps its dtype
+        if (in_storage.dtype() != out.dtype()) {
+            TensorData cast(in_storage.to(out.dtype()), in_shape, in_strides);
+            zip_inplace(fn, out, cast.info());
+            return;
+        }
+
+        // e.g. x.add_(x.permute(...)) would read elements it already wrote
+        bool same_layout = in_storage.offset() == out._storage.offset()
+                           && in_shape == out.shape
+                           && in_strides == out.strides;
+        if (in_storage.shares(out._storage) && !same_layout) {
+            TensorData copy(in_storage.clone(), in_shape, in_strides);
+            zip_inplace(fn, out, copy.info());
+            return;
+        }
+
+        visit_float_dtype(out.dtype(), [&]<typename T>() {
+            if (out.shape == in_shape && out.is_contiguous()
+                && is_contiguous(in_shape, in_strides))
+                zip_contiguous<T>(fn, out._storage, in_storage, out._storage);
+            else
+                zip_strided<T>(
+                    fn, out.info(), in, out.shape, out.strides, out._storage);
+        });
+
+        out._storage.bump_version();
+    }
+
+    void add_inplace(TensorData& out, const TensorDataInfo& in, double alpha) {
+        if (alpha == 1.0)
+            zip_inplace([](double x, double y) { return x + y; }, out, in);
+        else
+            zip_inplace([alpha](double x, double y) { return x + alpha * y; },
+                        out,
+                        in);
+    }
+
+    void mul_inplace(TensorData& out, const TensorDataInfo& in) {
+        zip_inplace([](double x, double y) { return x * y; }, out, in);
+    }
+
+    void copy_inplace(TensorData& out, const TensorDataInfo& in) {
+        zip_inplace([](double, double y) { return y; }, out, in);
+    }
+
+    void fill_inplace(TensorData& out, double value) {
+        check_writable(out);
+        auto fill = [value](double) { return value; };
+
+        visit_float_dtype(out.dtype(), [&]<typename T>() {
+            if (out.is_contiguous())
+                map_contiguous<T>(fill, out._storage, out._storage);
+            else
+                map_strided<T>(
+                    fill, out.info(), out.shape, out.strides, out._storage);
+        });
+
+        out._storage.bump_version();
+    }
+
+    UnivariateTensorDataFn tensor_map(UnivariateFn fn) {
+        return [fn](const TensorDataInfo& a) -> sptr<Tensor> {
+            return map_tensor_data(fn, a);
         };
     }
 
-    MapFuncFactory TensorOps::map = [](UnivariateFn fn) -> UnivariateTensorFn {
+    BivariateTensorDataFn tensor_zip(BivariateFn fn) {
+        return [fn](const TensorDataInfo& a,
+                    const TensorDataInfo& b) -> sptr<Tensor> {
+            return zip_tensor_data(fn, a, b);
+        };
+    }
+
+    ReduceTensorDataFn tensor_reduce(BivariateFn fn) {
+        return [fn](const TensorDataInfo& a, size_t dim) -> sptr<Tensor> {
+            return reduce_tensor_data(fn, a, dim);
+        };
+    }
+
+    // Function factories
+
+    UnivariateTensorFn TensorOps::map(UnivariateFn fn) {
         UnivariateTensorDataFn f = tensor_map(fn);
-        UnivariateTensorFn ret   = [f](const sptr<Tensor>& a) {
+        return [f](const sptr<Tensor>& a) {
             return f(a->info());
         };
-        return ret;
-    };
+    }
 
-    ZipFuncFactory TensorOps::zip = [](BivariateFn fn) -> BivariateTensorFn {
+    BivariateTensorFn TensorOps::zip(BivariateFn fn) {
         BivariateTensorDataFn f = tensor_zip(fn);
-        BivariateTensorFn ret = [f](const sptr<Tensor>& a, const sptr<Tensor>& b) {
+        return [f](const sptr<Tensor>& a, const sptr<Tensor>& b) {
             return f(a->info(), b->info());
         };
-        return ret;
-    };
+    }
 
-    ReduceFuncFactory TensorOps::reduce = [](BivariateFn fn) -> ReduceTensorFn {
+    ReduceTensorFn TensorOps::reduce(BivariateFn fn) {
         ReduceTensorDataFn f = tensor_reduce(fn);
-        ReduceTensorFn ret   = [f](const sptr<Tensor>& a, const size_t dim) {
+        return [f](const sptr<Tensor>& a, const size_t dim) {
             return f(a->info(), dim);
         };
-        return ret;
+    }
+
+    template <auto fn>
+    UnivariateTensorFn TensorOps::map() {
+        auto kernel = [](double x) -> double { return fn(x); };
+        return [kernel](const sptr<Tensor>& a) {
+            return map_tensor_data(kernel, a->info());
+        };
+    }
+
+    template <auto fn>
+    BivariateTensorFn TensorOps::zip() {
+        auto kernel = [](double x, double y) -> double { return fn(x, y); };
+        return [kernel](const sptr<Tensor>& a, const sptr<Tensor>& b) {
+            return zip_tensor_data(kernel, a->info(), b->info());
+        };
+    }
+
+    template <auto fn>
+    ReduceTensorFn TensorOps::reduce() {
+        auto kernel = [](double x, double y) -> double { return fn(x, y); };
+        return [kernel](const sptr<Tensor>& a, const size_t dim) {
+            return reduce_tensor_data(kernel, a->info(), dim);
+        };
+    }
+
+    template <auto fn>
+    ScalarTensorFn TensorOps::map_scalar() {
+        return [](const sptr<Tensor>& a, double c) {
+            auto kernel = [c](double x) -> double { return fn(x, c); };
+            return map_tensor_data(kernel, a->info());
+        };
+    }
+
+    // Batches the matmul kernel keeps inline, more go to the heap
+    constexpr size_t MATMUL_BATCHES = 8;
+
+    template <typename T>
+    using Matrices = utils::SmallVector<gemm::Matrix<T>, MATMUL_BATCHES>;
+    using Offsets  = utils::SmallVector<std::ptrdiff_t, MATMUL_BATCHES>;
+
+    // Batched product of operands in the dtype of `out`, float or double,
+    // written into `out`, a contiguous [..., M, N] buffer. Shapes are
+    // checked by the caller.
+    void gemm_into(TensorData& out,
+                   const TensorDataInfo& a,
+                   const TensorDataInfo& b) {
+        auto& [a_storage, a_shape, a_strides] = a;
+        auto& [b_storage, b_shape, b_strides] = b;
+
+        size_t a_dims = a_shape.size(), b_dims = b_shape.size();
+        size_t M = a_shape[a_dims - 2], K = a_shape[a_dims - 1];
+        size_t N = b_shape[b_dims - 1];
+
+        // Leading dimensions broadcast like in elementwise ops
+        Shape a_batch(a_shape.begin(), a_shape.end() - 2);
+        Shape b_batch(b_shape.begin(), b_shape.end() - 2);
+        Shape batch_shape = shape_broadcast(a_batch, b_batch);
+
+        auto a_batch_strides = broadcast_strides(
+            a_batch,
+            Strides(a_strides.begin(), a_strides.end() - 2),
+            batch_shape);
+        auto b_batch_strides = broadcast_strides(
+            b_batch,
+            Strides(b_strides.begin(), b_strides.end() - 2),
+            batch_shape);
+
+        auto& out_storage = out._storage;
+
+        // Strides are handed to the packing routines as is, transposed
+        // or flipped operands need no copy
+
+        // Every batch is an offset into the operand storage. Broadcast
+        // operands repeat the same offset, which gemm_batched detects to
+        // share the packed panels.
+        size_t batch = generic_operators::prod(batch_shape);
+
+        Offsets a_offsets(batch), b_offsets(batch);
+
+        Index counter(batch_shape.size(), 0);
+        for (size_t i = 0; i < batch; i++) {
+            for (size_t d = 0; d < counter.size(); d++) {
+                auto pos = static_cast<std::ptrdiff_t>(counter[d]);
+                a_offsets[i] += pos * a_batch_strides[d];
+                b_offsets[i] += pos * b_batch_strides[d];
+            }
+
+            for (size_t d = counter.size(); d-- > 0;) {
+                if (++counter[d] < batch_shape[d])
+                    break;
+                counter[d] = 0;
+            }
+        }
+
+        visit_float_dtype(out.dtype(), [&]<typename T>() {
+            // 16-bit dtypes take the float path of matrix_multiply
+            if constexpr (std::is_floating_point_v<T>) {
+                Matrices<const T> a_mats(batch), b_mats(batch);
+                Matrices<T> out_mats(batch);
+
+                for (size_t i = 0; i < batch; i++) {
+                    a_mats[i] = { a_storage.as<T>() + a_offsets[i],
+                                  a_strides[a_dims - 2],
+                                  a_strides[a_dims - 1] };
+                    b_mats[i] = { b_storage.as<T>() + b_offsets[i],
+                                  b_strides[b_dims - 2],
+                                  b_strides[b_dims - 1] };
+                    out_mats[i] = { out_storage.as<T>() + i * M * N,
+                                    static_cast<std::ptrdiff_t>(N),
+                                    1 };
+                }
+
+                gemm::gemm_batched(batch,
+                                   M,
+                                   N,
+                                   K,
+                                   a_mats.data(),
+                                   b_mats.data(),
+                                   out_mats.data());
+            }
+        });
+    }
+
+    BivariateTensorFn TensorOps::matrix_multiply = [](const sptr<Tensor>& a,
+                                                     const sptr<Tensor>& b) {
+        auto [a_storage, a_shape, a_strides] = a->info();
+        auto [b_storage, b_shape, b_strides] = b->info();
+
+        if (a_shape.size() < 2 || b_shape.size() < 2)
+            throw tensor_data::IndexingError(
+                "IndexingError: Matrix multiply expects at least 2-d tensors.");
+
+        size_t a_dims = a_shape.size(), b_dims = b_shape.size();
+        size_t M = a_shape[a_dims - 2], K = a_shape[a_dims - 1];
+        size_t N = b_shape[b_dims - 1];
+
+        if (b_shape[b_dims - 2] != K)
+            throw tensor_data::IndexingError(
+                "IndexingError: Inner dimensions of matrix multiply differ.");
+
+        // Leading dimensions broadcast like in elementwise ops
+        Shape out_shape = shape_broadcast(
+            Shape(a_shape.begin(), a_shape.end() - 2),
+            Shape(b_shape.begin(), b_shape.end() - 2));
+        out_shape.push_back(M);
+        out_shape.push_back(N);
+
+        if (a_storage.dtype() == DType::Int8
+            && b_storage.dtype() == DType::Int8)
+            return quantize::matmul(a, b);
+
+        DType dtype = promote_types(a_storage.dtype(), b_storage.dtype());
+
+        auto cast = [](const sptr<Tensor>& t, DType to) {
+            auto [storage, shape, strides] = t->info();
+            return Tensor::create(std::make_unique<TensorData>(
+                storage.to(to), shape, strides));
+        };
+
+        if (a_storage.dtype() != dtype)
+            return TensorOps::matrix_multiply(cast(a, dtype), b);
+        if (b_storage.dtype() != dtype)
+            return TensorOps::matrix_multiply(a, cast(b, dtype));
+
+        // 16-bit operands are widened once and multiplied in float, the
+        // product is rounded back when every sum is complete
+        if (dtype == DType::Float16 || dtype == DType::BFloat16) {
+            auto out = TensorOps::matrix_multiply(cast(a, DType::Float32),
+                                                  cast(b, DType::Float32));
+            return cast(out, dtype);
+        }
+
+        // gemm writes every element, K == 0 included
+        auto out_tensor = Tensor::empty(out_shape, dtype);
+        gemm_into(*out_tensor->data, a->info(), b->info());
+        return out_tensor;
     };
 
-    UnivariateTensorFn matrix_multiply;
+    void matrix_multiply_into(TensorData& out,
+                              const sptr<Tensor>& a,
+                              const sptr<Tensor>& b) {
+        DType dtype = out.dtype();
+        bool direct = (dtype == DType::Float64 || dtype == DType::Float32)
+                      && a->dtype() == dtype && b->dtype() == dtype
+                      && out.is_contiguous();
+
+        if (direct)
+            gemm_into(out, a->info(), b->info());
+        else
+            copy_inplace(out, TensorOps::matrix_multiply(a, b)->info());
+    }
+
+    TensorBackend::TensorBackend() {
+        using namespace generic_operators;
+
+        this->id_map      = TensorOps::map<id<double>>();
+        this->neg_map     = TensorOps::map<neg<double>>();
+        this->inv_map     = TensorOps::map<inv<double>>();
+        this->relu_map    = TensorOps::map<relu<double>>();
+        this->log_map     = TensorOps::map<log_func<double>>();
+        this->exp_map     = TensorOps::map<exp_func<double>>();
+        this->sigmoid_map = TensorOps::map<sigmoid<double>>();
+
+        this->add_zip       = TensorOps::zip<add<double>>();
+        this->sub_zip       = TensorOps::zip<sub<double>>();
+        this->mul_zip       = TensorOps::zip<mul<double>>();
+        this->div_zip       = TensorOps::zip<div<double>>();
+        this->lt_zip        = TensorOps::zip<lt<double>>();
+        this->eq_zip        = TensorOps::zip<eq<double>>();
+        this->is_close_zip  = TensorOps::zip<is_close<double>>();
+        this->relu_back_zip = TensorOps::zip<relu_back<double>>();
+        this->log_back_zip  = TensorOps::zip<log_back<double>>();
+        this->inv_back_zip  = TensorOps::zip<inv_back<double>>();
+
+        this->add_reduce = TensorOps::reduce<add<double>>();
+        this->mul_reduce = TensorOps::reduce<mul<double>>();
+
+        this->add_scalar  = TensorOps::map_scalar<add<double>>();
+        this->mul_scalar  = TensorOps::map_scalar<mul<double>>();
+        this->rsub_scalar = TensorOps::map_scalar<rsub<double>>();
+        this->rdiv_scalar = TensorOps::map_scalar<rdiv<double>>();
+        this->lt_scalar   = TensorOps::map_scalar<lt<double>>();
+        this->gt_scalar   = TensorOps::map_scalar<gt<double>>();
+        this->eq_scalar   = TensorOps::map_scalar<eq<double>>();
+
+        this->matrix_multiply = TensorOps::matrix_multiply;
+
+        this->quantize = [](const sptr<Tensor>& x,
+                            const tensor_data::QuantParams& params) {
+            return quantize::quantize(x, params);
+        };
+        this->dequantize = [](const sptr<Tensor>& q) {
+            return quantize::dequantize(q);
+        };
+        this->quantized_matmul = quantize::matmul;
+        this->quantized_add    = quantize::add;
+        this->quantized_mul    = quantize::mul;
+        this->quantized_relu   = quantize::relu;
+    }
+
+    void TensorBackend::about() {
+        fmt::print("TensorBackend: CPU ({} threads)\n",
+                   thread_pool::num_threads());
+    }
 
 }  // tensor_ops
@@ -19,6 +19,7 @@ namespace tensor_ops {
 
     // Forward declarations
     using tensor::Tensor;
+    using tensor_data::TensorData;
     using tensor_data::TensorDataInfo;
 
     // Aliases
@@ -30,6 +31,14 @@ namespace tensor_ops {
         = std::function<sptr<Tensor>(const sptr<Tensor>&, const sptr<Tensor>&)>;
     using ReduceTensorFn
         = std::function<sptr<Tensor>(const sptr<Tensor>&, const size_t)>;
+    using ScalarTensorFn
+        = std::function<sptr<Tensor>(const sptr<Tensor>&, double)>;
+    using QuantizeTensorFn = std::function<
+        sptr<Tensor>(const sptr<Tensor>&, const tensor_data::QuantParams&)>;
+    using QuantizedZipTensorFn
+        = std::function<sptr<Tensor>(const sptr<Tensor>&,
+                                     const sptr<Tensor>&,
+                                     const tensor_data::QuantParams&)>;
 
     using UnivariateTensorDataFn  //
         = std::function<sptr<Tensor>(const TensorDataInfo&)>;
@@ -38,17 +47,33 @@ namespace tensor_ops {
     using ReduceTensorDataFn
         = std::function<sptr<Tensor>(const TensorDataInfo&, const size_t)>;
 
-    // 1layer =
-    // Function factories
-    using MapFuncFactory    = std::function<UnivariateTensorFn(UnivariateFn)>;
-    using ZipFuncFactory    = std::function<BivariateTensorFn(BivariateFn)>;
-    using ReduceFuncFactory = std::function<ReduceTensorFn(BivariateFn)>;
-
     struct TensorOps {
-        static MapFuncFactory map;
-        static ZipFuncFactory zip;
-        static ReduceFuncFactory reduce;
-        static UnivariateTensorFn matrix_multiply;
+        // Generic factories, the scalar function is type-erased and called
+        // through std::function for every element
+        static UnivariateTensorFn map(UnivariateFn fn);
+        static BivariateTensorFn zip(BivariateFn fn);
+        static ReduceTensorFn reduce(BivariateFn fn);
+
+        // Specialized factories, the scalar function is a template argument
+        // and gets inlined into the kernel loops, e.g.
+        // TensorOps::zip<generic_operators::add<double>>(). Defined and
+        // instantiated in tensor_ops.cpp
+        template <auto fn>
+        static UnivariateTensorFn map();
+        template <auto fn>
+        static BivariateTensorFn zip();
+        template <auto fn>
+        static ReduceTensorFn reduce();
+
+        // Map with a constant right operand, fn(x, c), where c is passed by
+        // value instead of being broadcast from a one-element tensor
+        template <auto fn>
+        static ScalarTensorFn map_scalar();
+
+        // Matrix product of [..., M, K] and [..., K, N] tensors, leading
+        // dimensions are broadcast. Two int8 operands take the quantized
+        // int32 product.
+        static BivariateTensorFn matrix_multiply;
     };
 
     struct TensorBackend {
@@ -62,7 +87,9 @@ namespace tensor_ops {
 
         // Zip operations
         BivariateTensorFn add_zip;
+        BivariateTensorFn sub_zip;
         BivariateTensorFn mul_zip;
+        BivariateTensorFn div_zip;
         BivariateTensorFn lt_zip;
         BivariateTensorFn eq_zip;
         BivariateTensorFn is_close_zip;
@@ -74,38 +101,46 @@ namespace tensor_ops {
         ReduceTensorFn add_reduce;
         ReduceTensorFn mul_reduce;
 
-        TensorBackend() {
-            this->id_map      = TensorOps::map(operators::id);
-            this->neg_map     = TensorOps::map(operators::neg);
-            this->inv_map     = TensorOps::map(operators::inv);
-            this->relu_map    = TensorOps::map(operators::relu);
-            this->log_map     = TensorOps::map(operators::log_func);
-            this->exp_map     = TensorOps::map(operators::exp_func);
-            this->sigmoid_map = TensorOps::map(operators::sigmoid);
-
-            this->add_zip       = TensorOps::zip(operators::add);
-            this->mul_zip       = TensorOps::zip(operators::mul);
-            this->lt_zip        = TensorOps::zip(operators::lt);
-            this->eq_zip        = TensorOps::zip(operators::eq);
-            this->is_close_zip  = TensorOps::zip(operators::is_close);
-            this->relu_back_zip = TensorOps::zip(operators::relu_back);
-            this->log_back_zip  = TensorOps::zip(operators::log_back);
-            this->inv_back_zip  = TensorOps::zip(operators::inv_back);
-
-            this->add_reduce = TensorOps::reduce(operators::add);
-            this->mul_reduce = TensorOps::reduce(operators::mul);
-        }
+        // Operations with a constant
+        ScalarTensorFn add_scalar;
+        ScalarTensorFn mul_scalar;
+        ScalarTensorFn rsub_scalar;
+        ScalarTensorFn rdiv_scalar;
+        ScalarTensorFn lt_scalar;
+        ScalarTensorFn gt_scalar;
+        ScalarTensorFn eq_scalar;
+
+        // Quantized inference on int8 tensors, see quantize.hpp
+        QuantizeTensorFn quantize;
+        UnivariateTensorFn dequantize;
+        BivariateTensorFn quantized_matmul;
+        QuantizedZipTensorFn quantized_add;
+        QuantizedZipTensorFn quantized_mul;
+        UnivariateTensorFn quantized_relu;
+
+        TensorBackend();
+        virtual ~TensorBackend() = default;
 
         // Additional methods
-        Tensor (*matrix_multiply)(sptr<Tensor>, sptr<Tensor>);  // Pointer to
-                                                                // matrix_multiply
-                                                                // function
+        BivariateTensorFn matrix_multiply;
 
-        void about() {
-            fmt::print("TensorBackend: CPU\n");
-        };
+        virtual void about();
     };
 
+    // In-place kernels, `in` must broadcast to the shape of `out`. Each
+    // call bumps the version counter of the storage of `out`.
+    void add_inplace(TensorData& out, const TensorDataInfo& in, double alpha);
+    void mul_inplace(TensorData& out, const TensorDataInfo& in);
+    void copy_inplace(TensorData& out, const TensorDataInfo& in);
+    void fill_inplace(TensorData& out, double value);
+
+    // Matrix product written into `out`, which has the shape and dtype of
+    // the product. Float and double operands of its dtype go straight to
+    // gemm, any other goes through a temporary.
+    void matrix_multiply_into(TensorData& out,
+                              const sptr<Tensor>& a,
+                              const sptr<Tensor>& b);
+
     UnivariateTensorDataFn tensor_map(UnivariateFn);
     BivariateTensorDataFn tensor_zip(BivariateFn);
     ReduceTensorDataFn tensor_reduce(BivariateFn);
@@ -0,0 +1,698 @@
+#include <immintrin.h>
+
+#include "ptr.hpp"
+#include "tensor.hpp"
+#include "tensor_data.hpp"
+#include "tensor_simd.hpp"
+#include "thread_pool.hpp"
+
+namespace tensor_simd {
+    using generic_operators::EPS;
+    using tensor::Tensor;
+    using tensor_data::DType;
+    using tensor_data::is_contiguous;
+    using tensor_ops::BivariateTensorFn;
+    using tensor_ops::UnivariateTensorFn;
+
+    using thread_pool::GRAIN_SIZE;
+    using thread_pool::parallel_for;
+
+    // Operators: one overload per instruction set and element type, plus a
+    // scalar version for loop tails. The scalar versions follow
+    // generic_operators exactly.
+
+    const float EPS_F32 = static_cast<float>(EPS);
+
+    struct Neg {
+        static double scalar(double x) {
+            return -x;
+        }
+
+        [[gnu::target("sse4.1")]] static __m128d sse4(__m128d x) {
+            return _mm_xor_pd(x, _mm_set1_pd(-0.0));
+        }
+
+        [[gnu::target("avx2")]] static __m256d avx2(__m256d x) {
+            return _mm256_xor_pd(x, _mm256_set1_pd(-0.0));
+        }
+
+        [[gnu::target("avx512f")]] static __m512d avx512(__m512d x) {
+            __m512i sign = _mm512_set1_epi64(0x8000000000000000ll);
+            __m512i bits = _mm512_xor_si512(_mm512_castpd_si512(x), sign);
+            return _mm512_castsi512_pd(bits);
+        }
+
+        static float scalar(float x) {
+            return -x;
+        }
+
+        [[gnu::target("sse4.1")]] static __m128 sse4(__m128 x) {
+            return _mm_xor_ps(x, _mm_set1_ps(-0.0f));
+        }
+
+        [[gnu::target("avx2")]] static __m256 avx2(__m256 x) {
+            return _mm256_xor_ps(x, _mm256_set1_ps(-0.0f));
+        }
+
+        [[gnu::target("avx512f")]] static __m512 avx512(__m512 x) {
+            __m512i sign = _mm512_set1_epi32(0x80000000);
+            __m512i bits = _mm512_xor_si512(_mm512_castps_si512(x), sign);
+            return _mm512_castsi512_ps(bits);
+        }
+    };
+
+    struct Relu {
+        static double scalar(double x) {
+            return x > 0 ? x : 0;
+        }
+
+        // max returns its second operand when the first one is NaN,
+        // matching the scalar comparison above
+        [[gnu::target("sse4.1")]] static __m128d sse4(__m128d x) {
+            return _mm_max_pd(x, _mm_setzero_pd());
+        }
+
+        [[gnu::target("avx2")]] static __m256d avx2(__m256d x) {
+            return _mm256_max_pd(x, _mm256_setzero_pd());
+        }
+
+        [[gnu::target("avx512f")]] static __m512d avx512(__m512d x) {
+            __mmask8 mask = _mm512_cmp_pd_mask(x,
+                                               _mm512_setzero_pd(),
+                                               _CMP_GT_OQ);
+            return _mm512_maskz_mov_pd(mask, x);
+        }
+
+        static float scalar(float x) {
+            return x > 0 ? x : 0;
+        }
+
+        [[gnu::target("sse4.1")]] static __m128 sse4(__m128 x) {
+            return _mm_max_ps(x, _mm_setzero_ps());
+        }
+
+        [[gnu::target("avx2")]] static __m256 avx2(__m256 x) {
+            return _mm256_max_ps(x, _mm256_setzero_ps());
+        }
+
+        [[gnu::target("avx512f")]] static __m512 avx512(__m512 x) {
+            __mmask16 mask = _mm512_cmp_ps_mask(x,
+                                                _mm512_setzero_ps(),
+                                                _CMP_GT_OQ);
+            return _mm512_maskz_mov_ps(mask, x);
+        }
+    };
+
+    struct Add {
+        static double scalar(double x, double y) {
+            return x + y;
+        }
+
+        [[gnu::target("sse4.1")]] static __m128d sse4(__m128d x, __m128d y) {
+            return _mm_add_pd(x, y);
+        }
+
+        [[gnu::target("avx2")]] static __m256d avx2(__m256d x, __m256d y) {
+            return _mm256_add_pd(x, y);
+        }
+
+        [[gnu::target("avx512f")]] static __m512d avx512(__m512d x, __m512d y) {
+            return _mm512_add_pd(x, y);
+        }
+
+        static float scalar(float x, float y) {
+            return x + y;
+        }
+
+        [[gnu::target("sse4.1")]] static __m128 sse4(__m128 x, __m128 y) {
+            return _mm_add_ps(x, y);
+        }
+
+        [[gnu::target("avx2")]] static __m256 avx2(__m256 x, __m256 y) {
+            return _mm256_add_ps(x, y);
+        }
+
+        [[gnu::target("avx512f")]] static __m512 avx512(__m512 x, __m512 y) {
+            return _mm512_add_ps(x, y);
+        }
+    };
+
+    struct Mul {
+        static double scalar(double x, double y) {
+            return x * y;
+        }
+
+        [[gnu::target("sse4.1")]] static __m128d sse4(__m128d x, __m128d y) {
+            return _mm_mul_pd(x, y);
+        }
+
+        [[gnu::target("avx2")]] static __m256d avx2(__m256d x, __m256d y) {
+            return _mm256_mul_pd(x, y);
+        }
+
+        [[gnu::target("avx512f")]] static __m512d avx512(__m512d x, __m512d y) {
+            return _mm512_mul_pd(x, y);
+        }
+
+        static float scalar(float x, float y) {
+            return x * y;
+        }
+
+        [[gnu::target("sse4.1")]] static __m128 sse4(__m128 x, __m128 y) {
+            return _mm_mul_ps(x, y);
+        }
+
+        [[gnu::target("avx2")]] static __m256 avx2(__m256 x, __m256 y) {
+            return _mm256_mul_ps(x, y);
+        }
+
+        [[gnu::target("avx512f")]] static __m512 avx512(__m512 x, __m512 y) {
+            return _mm512_mul_ps(x, y);
+        }
+    };
+
+    struct Sub {
+        static double scalar(double x, double y) {
+            return x - y;
+        }
+
+        [[gnu::target("sse4.1")]] static __m128d sse4(__m128d x, __m128d y) {
+            return _mm_sub_pd(x, y);
+        }
+
+        [[gnu::target("avx2")]] static __m256d avx2(__m256d x, __m256d y) {
+            return _mm256_sub_pd(x, y);
+        }
+
+        [[gnu::target("avx512f")]] static __m512d avx512(__m512d x, __m512d y) {
+            return _mm512_sub_pd(x, y);
+        }
+
+        static float scalar(float x, float y) {
+            return x - y;
+        }
+
+        [[gnu::target("sse4.1")]] static __m128 sse4(__m128 x, __m128 y) {
+            return _mm_sub_ps(x, y);
+        }
+
+        [[gnu::target("avx2")]] static __m256 avx2(__m256 x, __m256 y) {
+            return _mm256_sub_ps(x, y);
+        }
+
+        [[gnu::target("avx512f")]] static __m512 avx512(__m512 x, __m512 y) {
+            return _mm512_sub_ps(x, y);
+        }
+    };
+
+    // Same epsilon guard as generic_operators::div
+    struct Div {
+        static double scalar(double x, double y) {
+            return x / (y + EPS);
+        }
+
+        [[gnu::target("sse4.1")]] static __m128d sse4(__m128d x, __m128d y) {
+            return _mm_div_pd(x, _mm_add_pd(y, _mm_set1_pd(EPS)));
+        }
+
+        [[gnu::target("avx2")]] static __m256d avx2(__m256d x, __m256d y) {
+            return _mm256_div_pd(x, _mm256_add_pd(y, _mm256_set1_pd(EPS)));
+        }
+
+        [[gnu::target("avx512f")]] static __m512d avx512(__m512d x, __m512d y) {
+            return _mm512_div_pd(x, _mm512_add_pd(y, _mm512_set1_pd(EPS)));
+        }
+
+        static float scalar(float x, float y) {
+            return x / (y + EPS_F32);
+        }
+
+        [[gnu::target("sse4.1")]] static __m128 sse4(__m128 x, __m128 y) {
+            return _mm_div_ps(x, _mm_add_ps(y, _mm_set1_ps(EPS_F32)));
+        }
+
+        [[gnu::target("avx2")]] static __m256 avx2(__m256 x, __m256 y) {
+            return _mm256_div_ps(x, _mm256_add_ps(y, _mm256_set1_ps(EPS_F32)));
+        }
+
+        [[gnu::target("avx512f")]] static __m512 avx512(__m512 x, __m512 y) {
+            return _mm512_div_ps(x, _mm512_add_ps(y, _mm512_set1_ps(EPS_F32)));
+        }
+    };
+
+    struct Lt {
+        static double scalar(double x, double y) {
+            return x < y ? 1.0 : 0.0;
+        }
+
+        [[gnu::target("sse4.1")]] static __m128d sse4(__m128d x, __m128d y) {
+            return _mm_and_pd(_mm_cmplt_pd(x, y), _mm_set1_pd(1.0));
+        }
+
+        [[gnu::target("avx2")]] static __m256d avx2(__m256d x, __m256d y) {
+            __m256d mask = _mm256_cmp_pd(x, y, _CMP_LT_OQ);
+            return _mm256_and_pd(mask, _mm256_set1_pd(1.0));
+        }
+
+        [[gnu::target("avx512f")]] static __m512d avx512(__m512d x, __m512d y) {
+            __mmask8 mask = _mm512_cmp_pd_mask(x, y, _CMP_LT_OQ);
+            return _mm512_maskz_mov_pd(mask, _mm512_set1_pd(1.0));
+        }
+
+        static float scalar(float x, float y) {
+            return x < y ? 1.0f : 0.0f;
+        }
+
+        [[gnu::target("sse4.1")]] static __m128 sse4(__m128 x, __m128 y) {
+            return _mm_and_ps(_mm_cmplt_ps(x, y), _mm_set1_ps(1.0f));
+        }
+
+        [[gnu::target("avx2")]] static __m256 avx2(__m256 x, __m256 y) {
+            __m256 mask = _mm256_cmp_ps(x, y, _CMP_LT_OQ);
+            return _mm256_and_ps(mask, _mm256_set1_ps(1.0f));
+        }
+
+        [[gnu::target("avx512f")]] static __m512 avx512(__m512 x, __m512 y) {
+            __mmask16 mask = _mm512_cmp_ps_mask(x, y, _CMP_LT_OQ);
+            return _mm512_maskz_mov_ps(mask, _mm512_set1_ps(1.0f));
+        }
+    };
+
+    struct Eq {
+        static double scalar(double x, double y) {
+            return x == y ? 1.0 : 0.0;
+        }
+
+        [[gnu::target("sse4.1")]] static __m128d sse4(__m128d x, __m128d y) {
+            return _mm_and_pd(_mm_cmpeq_pd(x, y), _mm_set1_pd(1.0));
+        }
+
+        [[gnu::target("avx2")]] static __m256d avx2(__m256d x, __m256d y) {
+            __m256d mask = _mm256_cmp_pd(x, y, _CMP_EQ_OQ);
+            return _mm256_and_pd(mask, _mm256_set1_pd(1.0));
+        }
+
+        [[gnu::target("avx512f")]] static __m512d avx512(__m512d x, __m512d y) {
+            __mmask8 mask = _mm512_cmp_pd_mask(x, y, _CMP_EQ_OQ);
+            return _mm512_maskz_mov_pd(mask, _mm512_set1_pd(1.0));
+        }
+
+        static float scalar(float x, float y) {
+            return x == y ? 1.0f : 0.0f;
+        }
+
+        [[gnu::target("sse4.1")]] static __m128 sse4(__m128 x, __m128 y) {
+            return _mm_and_ps(_mm_cmpeq_ps(x, y), _mm_set1_ps(1.0f));
+        }
+
+        [[gnu::target("avx2")]] static __m256 avx2(__m256 x, __m256 y) {
+            __m256 mask = _mm256_cmp_ps(x, y, _CMP_EQ_OQ);
+            return _mm256_and_ps(mask, _mm256_set1_ps(1.0f));
+        }
+
+        [[gnu::target("avx512f")]] static __m512 avx512(__m512 x, __m512 y) {
+            __mmask16 mask = _mm512_cmp_ps_mask(x, y, _CMP_EQ_OQ);
+            return _mm512_maskz_mov_ps(mask, _mm512_set1_ps(1.0f));
+        }
+    };
+
+    struct ReluBack {
+        static double scalar(double x, double d) {
+            return x > 0.0 ? d : 0.0;
+        }
+
+        [[gnu::target("sse4.1")]] static __m128d sse4(__m128d x, __m128d d) {
+            return _mm_and_pd(_mm_cmpgt_pd(x, _mm_setzero_pd()), d);
+        }
+
+        [[gnu::target("avx2")]] static __m256d avx2(__m256d x, __m256d d) {
+            __m256d mask = _mm256_cmp_pd(x, _mm256_setzero_pd(), _CMP_GT_OQ);
+            return _mm256_and_pd(mask, d);
+        }
+
+        [[gnu::target("avx512f")]] static __m512d avx512(__m512d x, __m512d d) {
+            __mmask8 mask = _mm512_cmp_pd_mask(x,
+                                               _mm512_setzero_pd(),
+                                               _CMP_GT_OQ);
+            return _mm512_maskz_mov_pd(mask, d);
+        }
+
+        static float scalar(float x, float d) {
+            return x > 0.0f ? d : 0.0f;
+        }
+
+        [[gnu::target("sse4.1")]] static __m128 sse4(__m128 x, __m128 d) {
+            return _mm_and_ps(_mm_cmpgt_ps(x, _mm_setzero_ps()), d);
+        }
+
+        [[gnu::target("avx2")]] static __m256 avx2(__m256 x, __m256 d) {
+            __m256 mask = _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_GT_OQ);
+            return _mm256_and_ps(mask, d);
+        }
+
+        [[gnu::target("avx512f")]] static __m512 avx512(__m512 x, __m512 d) {
+            __mmask16 mask = _mm512_cmp_ps_mask(x,
+                                                _mm512_setzero_ps(),
+                                                _CMP_GT_OQ);
+            return _mm512_maskz_mov_ps(mask, d);
+        }
+    };
+
+    // Unaligned loads and stores per instruction set and element type
+
+    [[gnu::target("sse4.1")]] __m128d load_sse4(const double* p) {
+        return _mm_loadu_pd(p);
+    }
+
+    [[gnu::target("sse4.1")]] __m128 load_sse4(const float* p) {
+        return _mm_loadu_ps(p);
+    }
+
+    [[gnu::target("sse4.1")]] void store_sse4(double* p, __m128d x) {
+        _mm_storeu_pd(p, x);
+    }
+
+    [[gnu::target("sse4.1")]] void store_sse4(float* p, __m128 x) {
+        _mm_storeu_ps(p, x);
+    }
+
+    [[gnu::target("avx2")]] __m256d load_avx2(const double* p) {
+        return _mm256_loadu_pd(p);
+    }
+
+    [[gnu::target("avx2")]] __m256 load_avx2(const float* p) {
+        return _mm256_loadu_ps(p);
+    }
+
+    [[gnu::target("avx2")]] void store_avx2(double* p, __m256d x) {
+        _mm256_storeu_pd(p, x);
+    }
+
+    [[gnu::target("avx2")]] void store_avx2(float* p, __m256 x) {
+        _mm256_storeu_ps(p, x);
+    }
+
+    [[gnu::target("avx512f")]] __m512d load_avx512(const double* p) {
+        return _mm512_loadu_pd(p);
+    }
+
+    [[gnu::target("avx512f")]] __m512 load_avx512(const float* p) {
+        return _mm512_loadu_ps(p);
+    }
+
+    [[gnu::target("avx512f")]] void store_avx512(double* p, __m512d x) {
+        _mm512_storeu_pd(p, x);
+    }
+
+    [[gnu::target("avx512f")]] void store_avx512(float* p, __m512 x) {
+        _mm512_storeu_ps(p, x);
+    }
+
+    // Loops: full vectors first, the remainder goes through Op::scalar
+
+    template <typename Op, typename T>
+    void map_scalar(const T* in, T* out, size_t len) {
+        for (size_t i = 0; i < len; i++)
+            out[i] = Op::scalar(in[i]);
+    }
+
+    template <typename Op, typename T>
+    [[gnu::target("sse4.1")]] void map_sse4(const T* in, T* out, size_t len) {
+        constexpr size_t lanes = 16 / sizeof(T);
+
+        size_t i = 0;
+        for (; i + lanes <= len; i += lanes)
+            store_sse4(out + i, Op::sse4(load_sse4(in + i)));
+        map_scalar<Op>(in + i, out + i, len - i);
+    }
+
+    template <typename Op, typename T>
+    [[gnu::target("avx2")]] void map_avx2(const T* in, T* out, size_t len) {
+        constexpr size_t lanes = 32 / sizeof(T);
+
+        size_t i = 0;
+        for (; i + lanes <= len; i += lanes)
+            store_avx2(out + i, Op::avx2(load_avx2(in + i)));
+        map_scalar<Op>(in + i, out + i, len - i);
+    }
+
+    template <typename Op, typename T>
+    [[gnu::target("avx512f")]] void map_avx512(const T* in,
+                                               T* out,
+                                               size_t len) {
+        constexpr size_t lanes = 64 / sizeof(T);
+
+        size_t i = 0;
+        for (; i + lanes <= len; i += lanes)
+            store_avx512(out + i, Op::avx512(load_avx512(in + i)));
+        map_scalar<Op>(in + i, out + i, len - i);
+    }
+
+    template <typename Op, typename T>
+    void zip_scalar(const T* a, const T* b, T* out, size_t len) {
+        for (size_t i = 0; i < len; i++)
+            out[i] = Op::scalar(a[i], b[i]);
+    }
+
+    template <typename Op, typename T>
+    [[gnu::target("sse4.1")]] void zip_sse4(const T* a,
+                                            const T* b,
+                                            T* out,
+                                            size_t len) {
+        constexpr size_t lanes = 16 / sizeof(T);
+
+        size_t i = 0;
+        for (; i + lanes <= len; i += lanes)
+            store_sse4(out + i, Op::sse4(load_sse4(a + i), load_sse4(b + i)));
+        zip_scalar<Op>(a + i, b + i, out + i, len - i);
+    }
+
+    template <typename Op, typename T>
+    [[gnu::target("avx2")]] void zip_avx2(const T* a,
+                                          const T* b,
+                                          T* out,
+                                          size_t len) {
+        constexpr size_t lanes = 32 / sizeof(T);
+
+        size_t i = 0;
+        for (; i + lanes <= len; i += lanes)
+            store_avx2(out + i, Op::avx2(load_avx2(a + i), load_avx2(b + i)));
+        zip_scalar<Op>(a + i, b + i, out + i, len - i);
+    }
+
+    template <typename Op, typename T>
+    [[gnu::target("avx512f")]] void zip_avx512(const T* a,
+                                               const T* b,
+                                               T* out,
+                                               size_t len) {
+        constexpr size_t lanes = 64 / sizeof(T);
+
+        size_t i = 0;
+        for (; i + lanes <= len; i += lanes)
+            store_avx512(out + i,
+                         Op::avx512(load_avx512(a + i), load_avx512(b + i)));
+        zip_scalar<Op>(a + i, b + i, out + i, len - i);
+    }
+
+    // Runtime dispatch
+
+    Isa detect_isa() {
+        static const Isa isa = [] {
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx512f"))
+                return Isa::AVX512;
+            if (__builtin_cpu_supports("avx2"))
+                return Isa::AVX2;
+            if (__builtin_cpu_supports("sse4.1"))
+                return Isa::SSE4;
+            return Isa::Scalar;
+        }();
+        return isa;
+    }
+
+    std::string_view isa_name(Isa isa) {
+        switch (isa) {
+            case Isa::SSE4:
+                return "SSE4";
+            case Isa::AVX2:
+                return "AVX2";
+            case Isa::AVX512:
+                return "AVX-512";
+            default:
+                return "scalar";
+        }
+    }
+
+    template <typename T>
+    Kernels<T> kernels_for(Isa isa) {
+        switch (isa) {
+            case Isa::SSE4:
+                return {
+                    .neg       = map_sse4<Neg, T>,
+                    .relu      = map_sse4<Relu, T>,
+                    .add       = zip_sse4<Add, T>,
+                    .sub       = zip_sse4<Sub, T>,
+                    .mul       = zip_sse4<Mul, T>,
+                    .div       = zip_sse4<Div, T>,
+                    .lt        = zip_sse4<Lt, T>,
+                    .eq        = zip_sse4<Eq, T>,
+                    .relu_back = zip_sse4<ReluBack, T>,
+                };
+            case Isa::AVX2:
+                return {
+                    .neg       = map_avx2<Neg, T>,
+                    .relu      = map_avx2<Relu, T>,
+                    .add       = zip_avx2<Add, T>,
+                    .sub       = zip_avx2<Sub, T>,
+                    .mul       = zip_avx2<Mul, T>,
+                    .div       = zip_avx2<Div, T>,
+                    .lt        = zip_avx2<Lt, T>,
+                    .eq        = zip_avx2<Eq, T>,
+                    .relu_back = zip_avx2<ReluBack, T>,
+                };
+            case Isa::AVX512:
+                return {
+                    .neg       = map_avx512<Neg, T>,
+                    .relu      = map_avx512<Relu, T>,
+                    .add       = zip_avx512<Add, T>,
+                    .sub       = zip_avx512<Sub, T>,
+                    .mul       = zip_avx512<Mul, T>,
+                    .div       = zip_avx512<Div, T>,
+                    .lt        = zip_avx512<Lt, T>,
+                    .eq        = zip_avx512<Eq, T>,
+                    .relu_back = zip_avx512<ReluBack, T>,
+                };
+            default:
+                return {
+                    .neg       = map_scalar<Neg, T>,
+                    .relu      = map_scalar<Relu, T>,
+                    .add       = zip_scalar<Add, T>,
+                    .sub       = zip_scalar<Sub, T>,
+                    .mul       = zip_scalar<Mul, T>,
+                    .div       = zip_scalar<Div, T>,
+                    .lt        = zip_scalar<Lt, T>,
+                    .eq        = zip_scalar<Eq, T>,
+                    .relu_back = zip_scalar<ReluBack, T>,
+                };
+        }
+    }
+
+    template Kernels<double> kernels_for(Isa isa);
+    template Kernels<float> kernels_for(Isa isa);
+
+    // Backend: vector kernels for dense same-shape operands, anything else
+    // falls through to the scalar kernels of the base TensorBackend
+
+    // 16-bit dtypes go through the converting kernels of the base backend
+    bool has_vector_kernels(DType dtype) {
+        return dtype == DType::Float64 || dtype == DType::Float32;
+    }
+
+    // visit_dtype restricted to the dtypes above
+    template <typename Fn>
+    void visit_vector_dtype(DType dtype, Fn&& fn) {
+        if (dtype == DType::Float32)
+            fn.template operator()<float>();
+        else
+            fn.template operator()<double>();
+    }
+
+    // Kernel for element type T out of a double and float pair
+    template <typename T, typename Kernel64, typename Kernel32>
+    auto select(Kernel64 f64, Kernel32 f32) {
+        if constexpr (std::is_same_v<T, float>)
+            return f32;
+        else
+            return f64;
+    }
+
+    UnivariateTensorFn simd_map(MapKernel<double> f64,
+                                MapKernel<float> f32,
+                                UnivariateTensorFn fallback) {
+        return [f64, f32, fallback](const sptr<Tensor>& a) -> sptr<Tensor> {
+            auto [in_storage, in_shape, in_strides] = a->info();
+
+            if (!is_contiguous(in_shape, in_strides)
+                || !has_vector_kernels(in_storage.dtype()))
+                return fallback(a);
+
+            DType dtype = in_storage.dtype();
+            auto out    = Tensor::empty(in_shape, dtype);
+            size_t len  = out->data->size;
+
+            visit_vector_dtype(dtype, [&]<typename T>() {
+                auto kernel = select<T>(f64, f32);
+                const T* in = in_storage.as<T>();
+                T* out_ptr  = out->data->_storage.as<T>();
+
+                parallel_for(0, len, GRAIN_SIZE, [&](size_t b, size_t e) {
+                    kernel(in + b, out_ptr + b, e - b);
+                });
+            });
+            return out;
+        };
+    }
+
+    BivariateTensorFn simd_zip(ZipKernel<double> f64,
+                               ZipKernel<float> f32,
+                               BivariateTensorFn fallback) {
+        return [f64, f32, fallback](const sptr<Tensor>& a,
+                                    const sptr<Tensor>& b) -> sptr<Tensor> {
+            auto [a_storage, a_shape, a_strides] = a->info();
+            auto [b_storage, b_shape, b_strides] = b->info();
+
+            if (a_shape != b_shape || !is_contiguous(a_shape, a_strides)
+                || !is_contiguous(b_shape, b_strides)
+                || a_storage.dtype() != b_storage.dtype()
+                || !has_vector_kernels(a_storage.dtype()))
+                return fallback(a, b);
+
+            DType dtype = a_storage.dtype();
+            auto out    = Tensor::empty(a_shape, dtype);
+            size_t len  = out->data->size;
+
+            visit_vector_dtype(dtype, [&]<typename T>() {
+                auto kernel = select<T>(f64, f32);
+                const T* x  = a_storage.as<T>();
+                const T* y  = b_storage.as<T>();
+                T* out_ptr  = out->data->_storage.as<T>();
+
+                parallel_for(0, len, GRAIN_SIZE, [&](size_t s, size_t e) {
+                    kernel(x + s, y + s, out_ptr + s, e - s);
+                });
+            });
+            return out;
+        };
+    }
+
+    SimdBackend::SimdBackend()
+        : SimdBackend(detect_isa()) {
+    }
+
+    SimdBackend::SimdBackend(Isa isa)
+        : isa(isa) {
+        Kernels<double> f64 = kernels_for<double>(isa);
+        Kernels<float> f32  = kernels_for<float>(isa);
+
+        this->neg_map  = simd_map(f64.neg, f32.neg, this->neg_map);
+        this->relu_map = simd_map(f64.relu, f32.relu, this->relu_map);
+
+        this->add_zip = simd_zip(f64.add, f32.add, this->add_zip);
+        this->sub_zip = simd_zip(f64.sub, f32.sub, this->sub_zip);
+        this->mul_zip = simd_zip(f64.mul, f32.mul, this->mul_zip);
+        this->div_zip = simd_zip(f64.div, f32.div, this->div_zip);
+        this->lt_zip  = simd_zip(f64.lt, f32.lt, this->lt_zip);
+        this->eq_zip  = simd_zip(f64.eq, f32.eq, this->eq_zip);
+
+        this->relu_back_zip = simd_zip(f64.relu_back,
+                                       f32.relu_back,
+                                       this->relu_back_zip);
+    }
+
+    void SimdBackend::about() {
+        fmt::print("TensorBackend: CPU ({}, {} threads)\n",
+                   isa_name(this->isa),
+                   thread_pool::num_threads());
+    }
+
+}  // namespace tensor_simd
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+
+#include "tensor_ops.hpp"
+
+namespace tensor_simd {
+    // Vectorized elementwise kernels for contiguous double and float storage.
+    //
+    // Every kernel is compiled for several instruction sets through function
+    // target attributes, the widest one supported by the host CPU is picked
+    // at startup. Operands that are broadcasted or strided are handed back
+    // to the scalar TensorBackend, which stays the reference implementation.
+
+    using tensor_ops::TensorBackend;
+
+    enum class Isa {
+        Scalar,
+        SSE4,
+        AVX2,
+        AVX512,
+    };
+
+    template <typename T>
+    using MapKernel = void (*)(const T* in, T* out, size_t len);
+    template <typename T>
+    using ZipKernel = void (*)(const T* a, const T* b, T* out, size_t len);
+
+    template <typename T>
+    struct Kernels {
+        MapKernel<T> neg;
+        MapKernel<T> relu;
+
+        ZipKernel<T> add;
+        ZipKernel<T> sub;
+        ZipKernel<T> mul;
+        ZipKernel<T> div;
+        ZipKernel<T> lt;
+        ZipKernel<T> eq;
+        ZipKernel<T> relu_back;
+    };
+
+    Isa detect_isa();
+    std::string_view isa_name(Isa isa);
+
+    // Defined for double and float
+    template <typename T>
+    Kernels<T> kernels_for(Isa isa);
+
+    struct SimdBackend : TensorBackend {
+        Isa isa;
+
+        SimdBackend();
+        explicit SimdBackend(Isa isa);
+
+        void about() override;
+    };
+
+}  // namespace tensor_simd
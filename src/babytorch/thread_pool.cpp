@@ -0,0 +1,171 @@
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+
+#include "ptr.hpp"
+#include "thread_pool.hpp"
+
+namespace thread_pool {
+
+    thread_local bool inside_region = false;
+
+    ThreadPool::ThreadPool(size_t n_threads) {
+        // The calling thread always takes part, so spawn one worker less
+        size_t n_workers = n_threads > 1 ? n_threads - 1 : 0;
+
+        workers.reserve(n_workers);
+        for (size_t i = 0; i < n_workers; i++)
+            workers.emplace_back([this] { worker_loop(); });
+    }
+
+    ThreadPool::~ThreadPool() {
+        {
+            std::lock_guard lock(mutex);
+            stop = true;
+        }
+        work_cv.notify_all();
+
+        for (auto& worker : workers)
+            worker.join();
+    }
+
+    size_t ThreadPool::size() const {
+        return workers.size() + 1;
+    }
+
+    void ThreadPool::run_chunks() {
+        inside_region = true;
+
+        size_t chunk;
+        while ((chunk = next_chunk.fetch_add(1)) < job_chunks) {
+            size_t b = job_begin + chunk * job_chunk;
+            size_t e = std::min(job_end, b + job_chunk);
+
+            try {
+                job_fn(job_ctx, b, e);
+            }
+            catch (...) {
+                std::lock_guard lock(mutex);
+                if (!error)
+                    error = std::current_exception();
+            }
+
+            if (pending_chunks.fetch_sub(1) == 1) {
+                std::lock_guard lock(mutex);
+                done_cv.notify_all();
+            }
+        }
+
+        inside_region = false;
+    }
+
+    void ThreadPool::worker_loop() {
+        size_t seen = 0;
+
+        while (true) {
+            {
+                std::unique_lock lock(mutex);
+                work_cv.wait(lock, [&] {
+                    return stop || (job_fn && generation != seen);
+                });
+
+                if (stop)
+                    return;
+
+                seen = generation;
+                active++;
+            }
+
+            run_chunks();
+
+            {
+                std::lock_guard lock(mutex);
+                active--;
+            }
+            done_cv.notify_all();
+        }
+    }
+
+    void ThreadPool::run(size_t begin,
+                         size_t end,
+                         size_t n_chunks,
+                         RangeFn fn,
+                         const void* ctx) {
+        // Parallel regions from different user threads take turns
+        std::lock_guard submit(submit_mutex);
+
+        {
+            std::lock_guard lock(mutex);
+            job_fn     = fn;
+            job_ctx    = ctx;
+            job_begin  = begin;
+            job_end    = end;
+            job_chunks = n_chunks;
+            job_chunk  = (end - begin + n_chunks - 1) / n_chunks;
+            error      = nullptr;
+            next_chunk.store(0);
+            pending_chunks.store(n_chunks);
+            generation++;
+        }
+        work_cv.notify_all();
+
+        run_chunks();
+
+        std::exception_ptr job_error;
+        {
+            std::unique_lock lock(mutex);
+            done_cv.wait(lock, [&] {
+                return pending_chunks.load() == 0 && active == 0;
+            });
+
+            job_fn  = nullptr;
+            job_ctx = nullptr;
+            std::swap(job_error, error);
+        }
+
+        if (job_error)
+            std::rethrow_exception(job_error);
+    }
+
+    size_t default_num_threads() {
+        if (const char* env = std::getenv("BABYTORCH_NUM_THREADS")) {
+            char* end;
+            unsigned long n = std::strtoul(env, &end, 10);
+            if (end != env && n > 0)
+                return n;
+        }
+        return std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    std::mutex pool_mutex;
+    uptr<ThreadPool> global_pool;
+    std::atomic<size_t> global_threads{ 0 };
+
+    ThreadPool& pool() {
+        std::lock_guard lock(pool_mutex);
+        if (!global_pool) {
+            global_pool = std::make_unique<ThreadPool>(default_num_threads());
+            global_threads.store(global_pool->size());
+        }
+        return *global_pool;
+    }
+
+    size_t num_threads() {
+        size_t n = global_threads.load(std::memory_order_relaxed);
+        return n ? n : pool().size();
+    }
+
+    // Must not be called while kernels are running on the pool
+    void set_num_threads(size_t n_threads) {
+        std::lock_guard lock(pool_mutex);
+        global_pool.reset();
+        global_pool = std::make_unique<ThreadPool>(
+            std::max<size_t>(1, n_threads));
+        global_threads.store(global_pool->size());
+    }
+
+    bool in_parallel_region() {
+        return inside_region;
+    }
+
+}  // namespace thread_pool
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace thread_pool {
+    // Persistent worker pool used to split tensor kernels across cores.
+    //
+    // The pool is created lazily with the thread count taken from the
+    // BABYTORCH_NUM_THREADS environment variable (hardware concurrency
+    // otherwise) and can be resized through set_num_threads().
+
+    // Minimal amount of elementwise work worth handing to another thread
+    constexpr size_t GRAIN_SIZE = 32768;
+
+    // Type-erased range task: fn(ctx, begin, end)
+    using RangeFn = void (*)(const void* ctx, size_t begin, size_t end);
+
+    class ThreadPool {
+    public:
+        explicit ThreadPool(size_t n_threads);
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool&)            = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        // Number of threads taking part in a parallel region, caller included
+        size_t size() const;
+
+        void run(size_t begin,
+                 size_t end,
+                 size_t n_chunks,
+                 RangeFn fn,
+                 const void* ctx);
+
+    private:
+        void worker_loop();
+        void run_chunks();
+
+        std::vector<std::thread> workers;
+
+        std::mutex mutex;
+        std::condition_variable work_cv;
+        std::condition_variable done_cv;
+        std::mutex submit_mutex;
+
+        // Job currently being executed, guarded by `mutex`
+        RangeFn job_fn      = nullptr;
+        const void* job_ctx = nullptr;
+        size_t job_begin    = 0;
+        size_t job_end      = 0;
+        size_t job_chunk    = 0;
+        size_t job_chunks   = 0;
+        size_t generation   = 0;
+        size_t active       = 0;
+        bool stop           = false;
+        std::exception_ptr error;
+
+        std::atomic<size_t> next_chunk{ 0 };
+        std::atomic<size_t> pending_chunks{ 0 };
+    };
+
+    ThreadPool& pool();
+    size_t num_threads();
+    void set_num_threads(size_t n_threads);
+    bool in_parallel_region();
+
+    // Split [begin, end) into chunks of at least `grain` iterations and run
+    // fn(chunk_begin, chunk_end) on the pool. Small ranges, single-threaded
+    // pools and nested calls run inline on the calling thread.
+    template <typename Fn>
+    void parallel_for(size_t begin, size_t end, size_t grain, const Fn& fn) {
+        if (begin >= end)
+            return;
+
+        size_t len     = end - begin;
+        size_t threads = in_parallel_region() ? 1 : num_threads();
+        size_t chunks  = std::min(threads, (len + grain - 1) / grain);
+
+        if (chunks <= 1) {
+            fn(begin, end);
+            return;
+        }
+
+        RangeFn trampoline = [](const void* ctx, size_t b, size_t e) {
+            (*static_cast<const Fn*>(ctx))(b, e);
+        };
+        pool().run(begin, end, chunks, trampoline, &fn);
+    }
+
+}  // namespace thread_pool
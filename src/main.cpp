@@ -4,6 +4,8 @@
 #include "./babytorch/ptr.hpp"
 #include "./babytorch/scalar.hpp"
 #include "./babytorch/tensor.hpp"
+#include "./babytorch/tensor_fusion.hpp"
+#include "./babytorch/tensor_simd.hpp"
 
 int main() {
     fmt::print("Autograd project!\n\n");
@@ -19,14 +21,19 @@ int main() {
     fmt::print("{}\n", *result);
 
     using tensor::Tensor;
-    Tensor::set_backend();
+    Tensor::set_backend<tensor_simd::SimdBackend>();
 
     auto a             = Tensor::create(3, 3, 5);
     auto b             = Tensor::create(3, 1, 5);
     auto c             = Tensor::create(5);
     auto d             = Tensor::create(3, 3, 1);
     auto e             = Tensor::create(3, 5);
-    auto tensor_result = a / 1.2 + b * c / d - 3 - e;
+
+    // Run the elementwise chain as a single fused kernel
+    auto tensor_result = [&] {
+        tensor_fusion::FusionScope fused;
+        return a / 1.2 + b * c / d - 3 - e;
+    }();
 
     tensor_result->backend->about();
 
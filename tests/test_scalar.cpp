@@ -241,6 +241,18 @@ TEST_CASE("Scalar Division", "[Scalar]") {
     }
 }
 
+TEST_CASE("Scalar Subtraction and Division Gradients", "[Scalar]") {
+    auto a = Scalar::create(6.0);
+    auto b = Scalar::create(2.0);
+
+    auto result = a / b - b;
+    result->backward();
+
+    REQUIRE_THAT(result->data, WithinAbs(1.0, EPS));
+    REQUIRE_THAT(a->grad, WithinAbs(0.5, EPS));
+    REQUIRE_THAT(b->grad, WithinAbs(-2.5, EPS));
+}
+
 TEST_CASE("Scalar Less Than Comparison", "[Scalar]") {
     auto a   = Scalar::create(2.0);
     auto b   = Scalar::create(3.0);
@@ -114,4 +114,55 @@ TEST_CASE("Test index broadcasting") {
         Index expected   = { 1, 3 };
         REQUIRE(broadcast_index(to_index, to_shape, from_shape) == expected);
     }
-}
\ No newline at end of file
+}
+TEST_CASE("Shapes are small vectors", "[small_vector]") {
+    SECTION("Up to eight dimensions stay inline") {
+        Shape shape = { 2, 3, 4, 5, 6, 7, 8, 9 };
+        REQUIRE(shape.is_inline());
+        REQUIRE(strides_from_shape(shape).is_inline());
+
+        shape.push_back(10);
+        REQUIRE(!shape.is_inline());
+        REQUIRE(shape.size() == 9);
+        REQUIRE(shape.back() == 10);
+    }
+
+    SECTION("Copies and moves") {
+        Shape small = { 1, 2, 3 };
+        Shape large(12, 2);
+
+        Shape copy = large;
+        REQUIRE(copy == large);
+        REQUIRE(copy.data() != large.data());
+
+        Shape moved = std::move(large);
+        REQUIRE(moved == copy);
+        REQUIRE(large.empty());
+        REQUIRE(large.is_inline());
+
+        moved = small;
+        REQUIRE(moved == Shape{ 1, 2, 3 });
+    }
+
+    SECTION("Insert and erase") {
+        Shape shape = { 2, 3 };
+        shape.insert(shape.begin(), 1);
+        REQUIRE(shape == Shape{ 1, 2, 3 });
+
+        shape.insert(shape.begin(), shape.back());
+        REQUIRE(shape == Shape{ 3, 1, 2, 3 });
+
+        shape.erase(shape.begin() + 1);
+        REQUIRE(shape == Shape{ 3, 2, 3 });
+    }
+
+    SECTION("Strides of high-dimensional shapes") {
+        Shape shape(10, 2);
+        auto strides = strides_from_shape(shape);
+
+        REQUIRE(strides.size() == 10);
+        REQUIRE(strides.front() == 512);
+        REQUIRE(strides.back() == 1);
+        REQUIRE(strides_from_shape({}) == Strides{ 1 });
+    }
+}
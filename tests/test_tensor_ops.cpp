@@ -0,0 +1,1663 @@
+#include <catch2/catch_approx.hpp>
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/matchers/catch_matchers_floating_point.hpp>
+
+#include "../src/babytorch/allocator.cpp"
+#include "../src/babytorch/gemm.cpp"
+#include "../src/babytorch/half.cpp"
+#include "../src/babytorch/quantize.cpp"
+#include "../src/babytorch/tensor.cpp"
+#include "../src/babytorch/tensor_autodiff.cpp"
+#include "../src/babytorch/tensor_capture.cpp"
+#include "../src/babytorch/tensor_functions.cpp"
+#include "../src/babytorch/tensor_fusion.cpp"
+#include "../src/babytorch/tensor_ops.cpp"
+#include "../src/babytorch/tensor_simd.cpp"
+#include "../src/babytorch/thread_pool.cpp"
+#include "../src/babytorch/utils.cpp"
+
+using namespace tensor;
+using Catch::Matchers::WithinAbs;
+using Catch::Matchers::WithinRel;
+
+// Same shape and the same elements in logical order, whatever the strides
+// of either side
+void require_close(const sptr<Tensor>& x, const sptr<Tensor>& y) {
+    x->realize();
+    y->realize();
+    REQUIRE(x->shape() == y->shape());
+
+    const Shape& shape = x->shape();
+    Index index(shape.size());
+    for (size_t i = 0; i < generic_operators::prod(shape); i++) {
+        index = tensor_data::to_tensor_index(i, index, shape);
+        REQUIRE_THAT(x->data->get(index), WithinAbs(y->data->get(index), 1e-9));
+    }
+}
+
+TEST_CASE("Tensor map", "[tensor_ops]") {
+    auto neg_map = tensor_ops::TensorOps::map(operators::neg);
+
+    SECTION("Contiguous input") {
+        auto a   = Tensor::create(Storage{ 1, -2, 3, -4 });
+        auto out = neg_map(a);
+
+        REQUIRE(out->data->_storage == Storage{ -1, 2, -3, 4 });
+    }
+
+    SECTION("Non-contiguous input") {
+        // Transposed 2x3 view over row-major [[1, 2, 3], [4, 5, 6]]
+        auto a = Tensor::create(std::make_unique<TensorData>(
+            Storage{ 1, 2, 3, 4, 5, 6 }, Shape{ 3, 2 }, Strides{ 1, 3 }));
+        auto out = neg_map(a);
+
+        REQUIRE(out->shape() == Shape{ 3, 2 });
+        REQUIRE(out->data->_storage == Storage{ -1, -4, -2, -5, -3, -6 });
+    }
+}
+
+TEST_CASE("Tensor zip", "[tensor_ops]") {
+    auto add_zip = tensor_ops::TensorOps::zip(operators::add);
+
+    SECTION("Same shape") {
+        auto a   = Tensor::create(Storage{ 1, 2, 3 });
+        auto b   = Tensor::create(Storage{ 10, 20, 30 });
+        auto out = add_zip(a, b);
+
+        REQUIRE(out->data->_storage == Storage{ 11, 22, 33 });
+    }
+
+    SECTION("Broadcasted shape") {
+        auto a = Tensor::create(std::make_unique<TensorData>(
+            Storage{ 1, 2, 3, 4, 5, 6 }, Shape{ 2, 3 }));
+        auto b   = Tensor::create(Storage{ 10, 20, 30 });
+        auto out = add_zip(a, b);
+
+        REQUIRE(out->shape() == Shape{ 2, 3 });
+        REQUIRE(out->data->_storage == Storage{ 11, 22, 33, 14, 25, 36 });
+    }
+
+    SECTION("Same shape, non-contiguous operand") {
+        auto a = Tensor::create(std::make_unique<TensorData>(
+            Storage{ 1, 2, 3, 4 }, Shape{ 2, 2 }, Strides{ 1, 2 }));
+        auto b = Tensor::create(std::make_unique<TensorData>(
+            Storage{ 0, 0, 0, 0 }, Shape{ 2, 2 }));
+        auto out = add_zip(a, b);
+
+        REQUIRE(out->data->_storage == Storage{ 1, 3, 2, 4 });
+    }
+}
+
+TEST_CASE("Tensor reduce", "[tensor_ops]") {
+    auto add_reduce = tensor_ops::TensorOps::reduce(operators::add);
+
+    auto a = Tensor::create(std::make_unique<TensorData>(
+        Storage{ 1, 2, 3, 4, 5, 6 }, Shape{ 2, 3 }));
+
+    SECTION("Reduce leading dimension") {
+        auto out = add_reduce(a, 0);
+
+        REQUIRE(out->shape() == Shape{ 1, 3 });
+        REQUIRE(out->data->_storage == Storage{ 5, 7, 9 });
+    }
+
+    SECTION("Reduce trailing dimension") {
+        auto out = add_reduce(a, 1);
+
+        REQUIRE(out->shape() == Shape{ 2, 1 });
+        REQUIRE(out->data->_storage == Storage{ 6, 15 });
+    }
+
+    SECTION("Reduce non-contiguous input") {
+        auto t = Tensor::create(std::make_unique<TensorData>(
+            Storage{ 1, 2, 3, 4, 5, 6 }, Shape{ 3, 2 }, Strides{ 1, 3 }));
+        auto out = add_reduce(t, 0);
+
+        REQUIRE(out->shape() == Shape{ 1, 2 });
+        REQUIRE(out->data->_storage == Storage{ 6, 15 });
+    }
+}
+
+TEST_CASE("Tensor subtraction and division", "[tensor_functions]") {
+    Tensor::set_backend();
+
+    auto a = Tensor::create(Storage{ 6, -4, 9 });
+    auto b = Tensor::create(Storage{ 2, 4, -3 });
+
+    SECTION("Single graph node per operation") {
+        auto diff = a - b;
+        auto quot = a / b;
+
+        for (auto& node : { diff, quot }) {
+            REQUIRE(node->parents().size() == 2);
+            REQUIRE(node->parents()[0].get() == a.get());
+            REQUIRE(node->parents()[1].get() == b.get());
+        }
+
+        REQUIRE_THAT(diff->data->_storage[0], WithinAbs(4, 1e-9));
+        REQUIRE_THAT(diff->data->_storage[1], WithinAbs(-8, 1e-9));
+        REQUIRE_THAT(quot->data->_storage[0], WithinAbs(3, 1e-9));
+        REQUIRE_THAT(quot->data->_storage[2], WithinAbs(-3, 1e-9));
+    }
+
+    SECTION("Backward") {
+        auto out = a / b - b;
+        out->backward();
+
+        // d/da = 1 / b, d/db = -a / b^2 - 1
+        std::vector<double> d_a = { 0.5, 0.25, -1.0 / 3 };
+        std::vector<double> d_b = { -2.5, -0.75, -2 };
+
+        for (size_t i = 0; i < 3; i++) {
+            REQUIRE_THAT(a->grad->data->_storage[i], WithinAbs(d_a[i], 1e-6));
+            REQUIRE_THAT(b->grad->data->_storage[i], WithinAbs(d_b[i], 1e-6));
+        }
+    }
+}
+
+TEST_CASE("Tensor operations with constants", "[tensor_functions]") {
+    Tensor::set_backend();
+
+    auto x = Tensor::create(Storage{ 1, -2, 4 });
+
+    auto check = [](const sptr<Tensor>& t,
+                    const std::vector<double>& expected) {
+        t->realize();
+        for (size_t i = 0; i < expected.size(); i++)
+            REQUIRE_THAT(t->data->_storage[i], WithinAbs(expected[i], 1e-6));
+    };
+
+    auto results = [&] {
+        return std::vector<sptr<Tensor>>{
+            x + 2.0, 2.0 + x, x * 3.0, 3.0 * x, x - 1.0, 1.0 - x,
+            x / 2.0, 4.0 / x, x < 0.0, 0.0 < x, x > 0.0, 0.0 > x,
+            x == 4.0,
+        };
+    };
+
+    std::vector<std::vector<double>> expected = {
+        { 3, 0, 6 },     { 3, 0, 6 },    { 3, -6, 12 }, { 3, -6, 12 },
+        { 0, -3, 3 },    { 0, 3, -3 },   { 0.5, -1, 2 }, { 4, -2, 1 },
+        { 0, 1, 0 },     { 1, 0, 1 },    { 1, 0, 1 },   { 0, 1, 0 },
+        { 0, 0, 1 },
+    };
+
+    SECTION("Single graph node per operation") {
+        auto eager = results();
+        for (size_t i = 0; i < eager.size(); i++) {
+            REQUIRE(eager[i]->parents().size() == 1);
+            REQUIRE(eager[i]->parents()[0].get() == x.get());
+            check(eager[i], expected[i]);
+        }
+    }
+
+    SECTION("Fused") {
+        tensor_fusion::FusionScope fusion;
+        auto fused = results();
+        for (size_t i = 0; i < fused.size(); i++)
+            check(fused[i], expected[i]);
+    }
+
+    SECTION("Backward") {
+        // d/dx = 2 + 3 - 1 - 4 / x^2
+        auto out = (x * 2.0 + 3.0 * x) - x + 4.0 / x - 1.0;
+        out->backward();
+
+        std::vector<double> d_x = { 0, 3, 3.75 };
+        check(x->grad, d_x);
+    }
+}
+
+TEST_CASE("Float32 tensors", "[tensor_data]") {
+    Tensor::set_backend();
+
+    auto x = Tensor::create(Storage(std::vector<float>{ 1, -2, 4, 0.5 }));
+    auto y = Tensor::create(Storage{ 2, 4, -1, 3 });
+
+    REQUIRE(x->dtype() == DType::Float32);
+    REQUIRE(y->dtype() == DType::Float64);
+
+    SECTION("Storage") {
+        REQUIRE(x->data->_storage.size() == 4);
+        REQUIRE(x->data->_storage.get(1) == -2);
+        REQUIRE(x->data->_storage.to(DType::Float64)
+                == Storage{ 1, -2, 4, 0.5 });
+        REQUIRE_THROWS_AS(x->data->_storage.data(), IndexingError);
+        REQUIRE(dtype_size(DType::Float32) == 4);
+    }
+
+    SECTION("Promotion") {
+        REQUIRE((x + x)->dtype() == DType::Float32);
+        REQUIRE((x * 2.0)->dtype() == DType::Float32);
+        REQUIRE(TensorFunction::apply<Relu>(x)->dtype() == DType::Float32);
+        REQUIRE(x->backend->add_reduce(x, 0)->dtype() == DType::Float32);
+
+        auto mixed = x + y;
+        REQUIRE(mixed->dtype() == DType::Float64);
+        REQUIRE(mixed->data->_storage == Storage{ 3, 2, 3, 3.5 });
+
+        // In-place updates keep the dtype of the output
+        auto z = x->to(DType::Float32)->zeros();
+        z->add_(y);
+        REQUIRE(z->dtype() == DType::Float32);
+        REQUIRE(z->data->_storage.get(2) == -1);
+    }
+
+    SECTION("Fused") {
+        tensor_fusion::FusionScope fusion;
+        auto out = TensorFunction::apply<Relu>(x * x + 1.0) - x;
+        REQUIRE(out->dtype() == DType::Float32);
+
+        out->realize();
+
+        std::vector<double> expected = { 1, 7, 13, 0.75 };
+        for (size_t i = 0; i < expected.size(); i++)
+            REQUIRE_THAT(out->data->_storage.get(i),
+                         WithinAbs(expected[i], 1e-6));
+    }
+
+    SECTION("Matrix multiply") {
+        auto a  = Tensor::create(TensorData::rand({ 37, 53 }));
+        auto b  = Tensor::create(TensorData::rand({ 53, 29 }));
+        auto fp = matmul(a->to(DType::Float32), b->to(DType::Float32));
+
+        REQUIRE(fp->dtype() == DType::Float32);
+
+        auto reference = matmul(a, b);
+        for (size_t i = 0; i < 37 * 29; i++)
+            REQUIRE_THAT(fp->data->_storage.get(i),
+                         WithinAbs(reference->data->_storage[i], 1e-4));
+    }
+
+    SECTION("Gradients flow back in the input dtype") {
+        auto a   = Tensor::create(Storage{ 1, 2, 3 });
+        auto out = a->to(DType::Float32) * 3.0;
+        out->backward();
+
+        REQUIRE(out->dtype() == DType::Float32);
+        REQUIRE(a->grad->dtype() == DType::Float64);
+        REQUIRE(a->grad->data->_storage == Storage{ 3, 3, 3 });
+    }
+
+    SECTION("SIMD kernels") {
+        auto reference = tensor_ops::TensorBackend();
+        auto simd      = tensor_simd::SimdBackend();
+
+        auto a = Tensor::create(TensorData::rand({ 37 }))->to(DType::Float32);
+        auto b = Tensor::create(TensorData::rand({ 37 }))->to(DType::Float32);
+
+        REQUIRE(simd.neg_map(a)->data->_storage
+                == reference.neg_map(a)->data->_storage);
+        REQUIRE(simd.relu_map(a)->data->_storage
+                == reference.relu_map(a)->data->_storage);
+        REQUIRE(simd.add_zip(a, b)->data->_storage
+                == reference.add_zip(a, b)->data->_storage);
+        REQUIRE(simd.mul_zip(a, b)->data->_storage
+                == reference.mul_zip(a, b)->data->_storage);
+        REQUIRE(simd.sub_zip(a, b)->data->_storage
+                == reference.sub_zip(a, b)->data->_storage);
+        REQUIRE(simd.lt_zip(a, b)->data->_storage
+                == reference.lt_zip(a, b)->data->_storage);
+
+        auto quot     = simd.div_zip(a, b);
+        auto expected = reference.div_zip(a, b);
+        REQUIRE(quot->dtype() == DType::Float32);
+        for (size_t i = 0; i < 37; i++)
+            REQUIRE_THAT(quot->data->_storage.get(i),
+                         WithinRel(expected->data->_storage.get(i), 1e-6));
+    }
+}
+
+TEST_CASE("Half precision tensors", "[half]") {
+    using half::BFloat16;
+    using half::Half;
+
+    Tensor::set_backend();
+
+    SECTION("Conversions round to nearest even") {
+        REQUIRE(Half(1.0f).bits == 0x3c00);
+        REQUIRE(Half(-2.0f).bits == 0xc000);
+        REQUIRE(Half(65504.0f).bits == 0x7bff);
+        REQUIRE(Half(65520.0f).bits == 0x7c00);
+        REQUIRE(Half(0x1p-24f).bits == 0x0001);
+        REQUIRE(Half(1.0f + 0x1p-11f).bits == 0x3c00);  // tie, to even
+        REQUIRE(Half(1.0f + 0x1p-11f + 0x1p-20f).bits == 0x3c01);
+        REQUIRE(float(Half::from_bits(0x0001)) == 0x1p-24f);
+        REQUIRE(std::isnan(float(Half(std::nanf("")))));
+
+        REQUIRE(BFloat16(1.0f).bits == 0x3f80);
+        REQUIRE(BFloat16(1.0f + 0x1p-8f).bits == 0x3f80);  // tie, to even
+        REQUIRE(float(BFloat16(3.140625f)) == 3.140625f);
+    }
+
+    SECTION("Bulk conversions match the scalar ones") {
+        std::vector<Half> all(1 << 16);
+        for (size_t i = 0; i < all.size(); i++)
+            all[i] = Half::from_bits(static_cast<uint16_t>(i));
+
+        std::vector<float> widened(all.size());
+        half::to_float(all.data(), widened.data(), all.size());
+
+        std::vector<Half> narrowed(all.size());
+        half::from_float(widened.data(), narrowed.data(), all.size());
+
+        for (size_t i = 0; i < all.size(); i++) {
+            float scalar = all[i];
+            if (std::isnan(scalar))
+                continue;
+            REQUIRE(widened[i] == scalar);
+            REQUIRE(narrowed[i] == all[i]);
+        }
+    }
+
+    auto x = Tensor::create(Storage{ 1, -2, 4, 0.5, 3 });
+
+    for (auto dtype : { DType::Float16, DType::BFloat16 }) {
+        auto h = x->to(dtype);
+        REQUIRE(h->dtype() == dtype);
+        REQUIRE(dtype_size(dtype) == 2);
+
+        auto sum = h + h;
+        REQUIRE(sum->dtype() == dtype);
+        REQUIRE(sum->to(DType::Float64)->data->_storage
+                == Storage{ 2, -4, 8, 1, 6 });
+
+        REQUIRE((h * 2.0 - x)->dtype() == DType::Float64);
+        REQUIRE((h + x->to(DType::Float32))->dtype() == DType::Float32);
+
+        tensor_fusion::FusionScope fusion;
+        auto fused = h * h - 1.0;
+        REQUIRE(fused->dtype() == dtype);
+        fused->realize();
+        REQUIRE(fused->data->_storage.to(DType::Float64)
+                == Storage{ 0, 3, 15, -0.75, 8 });
+    }
+
+    REQUIRE(promote_types(DType::Float16, DType::BFloat16) == DType::Float32);
+
+    SECTION("Reductions accumulate in float") {
+        // Past 2048 fp16 cannot represent x + 1, a 16-bit accumulator
+        // would get stuck there
+        auto ones = Tensor::zeros({ 4096 }, DType::Float16)->fill_(1.0);
+        auto sum  = ones->backend->add_reduce(ones, 0);
+        REQUIRE(sum->dtype() == DType::Float16);
+        REQUIRE(sum->data->_storage.get(0) == 4096);
+
+        auto strided = Tensor::zeros({ 4096, 2 }, DType::BFloat16)->fill_(1.0);
+        auto column  = strided->permute({ 1, 0 });
+        auto total   = column->backend->add_reduce(column, 1);
+        REQUIRE(total->data->_storage.get(0) == 4096);
+    }
+
+    SECTION("Matrix multiply") {
+        auto a = Tensor::create(TensorData::rand({ 33, 300 }));
+        auto b = Tensor::create(TensorData::rand({ 300, 17 }));
+
+        auto reference = matmul(a->to(DType::Float16)->to(DType::Float64),
+                                b->to(DType::Float16)->to(DType::Float64));
+        auto product   = matmul(a->to(DType::Float16), b->to(DType::Float16));
+
+        REQUIRE(product->dtype() == DType::Float16);
+        for (size_t i = 0; i < 33 * 17; i++)
+            REQUIRE_THAT(product->data->_storage.get(i),
+                         WithinAbs(reference->data->_storage[i], 2e-2));
+    }
+}
+
+TEST_CASE("Quantized tensors", "[quantize]") {
+    Tensor::set_backend();
+
+    auto matrix = [](Storage storage, Shape shape) {
+        return Tensor::create(
+            std::make_unique<TensorData>(std::move(storage), shape));
+    };
+
+    SECTION("Integer storage rounds and saturates") {
+        Storage s(3, DType::Int8);
+        s.set(0, 2.5);
+        s.set(1, -300);
+        s.set(2, 126.6);
+        REQUIRE(s.get(0) == 2);
+        REQUIRE(s.get(1) == -128);
+        REQUIRE(s.get(2) == 127);
+        REQUIRE(dtype_size(DType::Int8) == 1);
+        REQUIRE(dtype_size(DType::Int32) == 4);
+    }
+
+    SECTION("Per tensor round trip") {
+        auto x = matrix(Storage{ -1.0, -0.25, 0, 0.5, 2.0, 3.0 }, { 2, 3 });
+        auto params = quantize::calibrate(x);
+
+        REQUIRE_THAT(params.scales[0], WithinRel(4.0 / 255, 1e-12));
+        REQUIRE(params.zero_points[0] == -64);
+
+        auto q = quantize::quantize(x, params);
+        REQUIRE(q->dtype() == DType::Int8);
+        REQUIRE(*q->data->qparams == params);
+
+        auto back = quantize::dequantize(q, DType::Float64);
+        REQUIRE(back->dtype() == DType::Float64);
+        for (size_t i = 0; i < 6; i++)
+            REQUIRE_THAT(back->data->_storage[i],
+                         WithinAbs(x->data->_storage[i], params.scales[0] / 2));
+        REQUIRE(back->data->_storage[2] == 0.0);
+    }
+
+    SECTION("Per channel weights") {
+        auto w = matrix(Storage{ 1, -20, 0.5, 2, 10, -0.25 }, { 2, 3 });
+        auto q = quantize::quantize(w, 1);
+
+        auto& params = *q->data->qparams;
+        REQUIRE(params.axis == 1);
+        REQUIRE(params.scales
+                == std::vector<double>{ 2.0 / 127, 20.0 / 127, 0.5 / 127 });
+        REQUIRE(params.zero_points == std::vector<int32_t>{ 0, 0, 0 });
+
+        auto back = quantize::dequantize(q, DType::Float64);
+        for (size_t i = 0; i < 6; i++)
+            REQUIRE_THAT(back->data->_storage[i],
+                         WithinAbs(w->data->_storage[i],
+                                   params.scales[i % 3] / 2));
+
+        // The channel axis follows a permutation
+        auto t = q->permute({ 1, 0 });
+        REQUIRE(t->data->qparams->axis == 0);
+        auto t_back = quantize::dequantize(t, DType::Float64);
+        REQUIRE(t_back->data->get({ 1, 0 }) == back->data->get({ 0, 1 }));
+    }
+
+    SECTION("Int8 GEMM is exact") {
+        auto random_int8 = [](size_t rows, size_t cols) {
+            std::vector<int8_t> values(rows * cols);
+            for (auto& v : values)
+                v = static_cast<int8_t>(rand() % 256 - 128);
+            return values;
+        };
+
+        for (auto [M, N, K] : { std::tuple{ 37, 45, 301 },
+                                std::tuple{ 4, 16, 2 },
+                                std::tuple{ 5, 3, 1 } }) {
+            auto a = random_int8(M, K), b = random_int8(K, N);
+            std::vector<int32_t> c(M * N, 7);
+
+            // b is consumed transposed through its strides
+            gemm::gemm_s8(M,
+                          N,
+                          K,
+                          { a.data(), K, 1 },
+                          { b.data(), 1, K },
+                          { c.data(), N, 1 });
+
+            for (size_t i = 0; i < size_t(M); i++)
+                for (size_t j = 0; j < size_t(N); j++) {
+                    int32_t expected = 0;
+                    for (size_t k = 0; k < size_t(K); k++)
+                        expected += a[i * K + k] * b[j * K + k];
+                    REQUIRE(c[i * N + j] == expected);
+                }
+        }
+    }
+
+    SECTION("Matrix multiply matches the float product") {
+        auto x = Tensor::create(TensorData::rand({ 2, 7, 40 }));
+        auto w = Tensor::create(TensorData::rand({ 40, 9 }));
+
+        auto qx = quantize::quantize(x);
+        auto qw = quantize::quantize(w, 1);
+
+        auto acc = Tensor::backend->matrix_multiply(qx, qw);
+        REQUIRE(acc->dtype() == DType::Int32);
+        REQUIRE(acc->shape() == Shape{ 2, 7, 9 });
+        REQUIRE(acc->data->qparams->axis == 2);
+
+        auto out      = quantize::dequantize(acc, DType::Float64);
+        auto expected = matmul(quantize::dequantize(qx, DType::Float64),
+                               quantize::dequantize(qw, DType::Float64));
+
+        for (size_t i = 0; i < 2 * 7 * 9; i++)
+            REQUIRE_THAT(out->data->_storage[i],
+                         WithinAbs(expected->data->_storage[i], 1e-9));
+    }
+
+    SECTION("Elementwise ops requantize") {
+        auto a = Tensor::create(Storage{ -1.0, 0.5, 2.0, 3.0 });
+        auto b = Tensor::create(Storage{ 0.25, -2.0, 1.0, 0.75 });
+
+        auto qa = quantize::quantize(a), qb = quantize::quantize(b);
+        auto ra = quantize::dequantize(qa, DType::Float64);
+        auto rb = quantize::dequantize(qb, DType::Float64);
+
+        auto sum_params  = quantize::calibrate(ra + rb);
+        auto prod_params = quantize::calibrate(ra * rb);
+
+        auto sum  = quantize::dequantize(quantize::add(qa, qb, sum_params),
+                                        DType::Float64);
+        auto prod = quantize::dequantize(quantize::mul(qa, qb, prod_params),
+                                         DType::Float64);
+        auto relu = quantize::dequantize(quantize::relu(qa), DType::Float64);
+
+        for (size_t i = 0; i < 4; i++) {
+            double x = ra->data->_storage[i], y = rb->data->_storage[i];
+            REQUIRE_THAT(sum->data->_storage[i],
+                         WithinAbs(x + y, sum_params.scales[0] * 0.51));
+            REQUIRE_THAT(prod->data->_storage[i],
+                         WithinAbs(x * y, prod_params.scales[0] * 0.51));
+            REQUIRE(relu->data->_storage[i] == std::max(x, 0.0));
+        }
+
+        // Broadcasting a single element
+        auto scalar = quantize::quantize(Tensor::create(Storage{ 1.0 }));
+        auto shifted = quantize::add(qa, scalar, sum_params);
+        REQUIRE(shifted->shape() == Shape{ 4 });
+    }
+
+    SECTION("Float ops reject integer tensors") {
+        auto q = quantize::quantize(Tensor::create(Storage{ 1, 2, 3 }));
+
+        REQUIRE_THROWS_AS(q + q, IndexingError);
+        REQUIRE_THROWS_AS(q->to(DType::Float32), IndexingError);
+        REQUIRE_THROWS_AS(Tensor::create(Storage{ 1 })->to(DType::Int8),
+                          IndexingError);
+        REQUIRE_THROWS_AS(quantize::dequantize(Tensor::create(Storage{ 1 })),
+                          IndexingError);
+    }
+}
+
+TEST_CASE("In-place operations", "[tensor_ops]") {
+    Tensor::set_backend();
+
+    auto a = Tensor::create(std::make_unique<TensorData>(
+        Storage{ 1, 2, 3, 4, 5, 6 }, Shape{ 2, 3 }));
+    auto row = Tensor::create(Storage{ 10, 20, 30 });
+
+    SECTION("Kernels and version counter") {
+        a->add_(row);
+        REQUIRE(a->data->_storage == Storage{ 11, 22, 33, 14, 25, 36 });
+
+        a->add_(row, -0.5);
+        REQUIRE(a->data->_storage == Storage{ 6, 12, 18, 9, 15, 21 });
+
+        a->mul_(Tensor::create(Storage{ 2 }));
+        REQUIRE(a->data->_storage == Storage{ 12, 24, 36, 18, 30, 42 });
+
+        a->copy_(row);
+        REQUIRE(a->data->_storage == Storage{ 10, 20, 30, 10, 20, 30 });
+
+        a->fill_(0.5);
+        REQUIRE(a->data->_storage == Storage{ 0.5, 0.5, 0.5, 0.5, 0.5, 0.5 });
+
+        REQUIRE(a->version() == 5);
+    }
+
+    SECTION("Non-contiguous target") {
+        auto t = a->permute({ 1, 0 });
+        t->add_(Tensor::create(Storage{ 100, 200 }));
+
+        REQUIRE(t->data->_storage == Storage{ 101, 102, 103, 204, 205, 206 });
+    }
+
+    SECTION("Operands overlapping the target are read before it") {
+        auto m = Tensor::create(
+            std::make_unique<TensorData>(Storage{ 1, 2, 3, 4 }, Shape{ 2, 2 }));
+        m->add_(m->permute({ 1, 0 }));
+        REQUIRE(m->data->_storage == Storage{ 2, 5, 5, 8 });
+
+        auto v = Tensor::create(Storage{ 1, 2, 3, 4 });
+        v->add_(v->flip({ 0 }));
+        REQUIRE(v->data->_storage == Storage{ 5, 5, 5, 5 });
+
+        v->mul_(v);
+        REQUIRE(v->data->_storage == Storage{ 25, 25, 25, 25 });
+    }
+
+    SECTION("Operand must broadcast to the target") {
+        REQUIRE_THROWS_AS(row->add_(a), IndexingError);
+    }
+
+    SECTION("Targets must not reach an element twice") {
+        REQUIRE_THROWS_AS(row->expand({ 2, 3 })->add_(a), IndexingError);
+        REQUIRE_THROWS_AS(row->expand({ 2, 3 })->fill_(0), IndexingError);
+
+        auto buffer = TensorData(Storage(8, 0.0));
+        auto window = Tensor::create(std::make_unique<TensorData>(
+            buffer.as_strided(Shape{ 3, 2 }, Strides{ 1, 1 })));
+        REQUIRE_THROWS_AS(window->copy_(a->permute({ 1, 0 })), IndexingError);
+
+        // Interleaved but disjoint
+        auto spread = Tensor::create(std::make_unique<TensorData>(
+            buffer.as_strided(Shape{ 3, 2 }, Strides{ 2, 3 })));
+        spread->copy_(a->permute({ 1, 0 }));
+        REQUIRE(buffer._storage == Storage{ 1, 0, 2, 4, 3, 5, 0, 6 });
+        REQUIRE(row->data->_storage == Storage{ 10, 20, 30 });
+    }
+
+    SECTION("Modified saved tensors are detected by backward") {
+        auto out = a * row;
+        a->fill_(0);
+
+        REQUIRE_THROWS_AS(out->backward(), tensor_autodiff::AutodiffError);
+    }
+
+    SECTION("Gradients accumulate into the same storage") {
+        auto w = Tensor::create(Storage{ 1, 2, 3 });
+
+        (w * row)->backward();
+        auto* grad            = w->grad.get();
+        const double* storage = w->grad->data->_storage.data();
+
+        (w * row)->backward();
+
+        REQUIRE(w->grad.get() == grad);
+        REQUIRE(w->grad->data->_storage.data() == storage);
+        REQUIRE(w->grad->data->_storage == Storage{ 20, 40, 60 });
+    }
+}
+
+TEST_CASE("Views share storage", "[tensor_data]") {
+    Tensor::set_backend();
+
+    auto a = Tensor::create(std::make_unique<TensorData>(
+        Storage{ 1, 2, 3, 4, 5, 6 }, Shape{ 2, 3 }));
+    const double* base = a->data->_storage.data();
+
+    SECTION("Indexing") {
+        auto row = a->at(1);
+        REQUIRE(row->shape() == Shape{ 3 });
+        REQUIRE(row->data->_storage.data() == base + 3);
+        REQUIRE(row->data->_storage == Storage{ 4, 5, 6 });
+
+        row->fill_(0);
+        REQUIRE(a->data->_storage == Storage{ 1, 2, 3, 0, 0, 0 });
+
+        auto item = (*a)[0, 2];
+        REQUIRE(item.shape() == Shape{ 1 });
+        REQUIRE(item.data->_storage.data() == base + 2);
+
+        REQUIRE_THROWS_AS(a->at(2), IndexingError);
+        REQUIRE_THROWS_AS(a->at(0, 0, 0), IndexingError);
+    }
+
+    SECTION("Indexing a permuted tensor") {
+        auto column = a->permute({ 1, 0 })->at(2);
+        REQUIRE(column->data->strides == Strides{ 3 });
+        REQUIRE(column->data->_storage.size() == 4);
+        REQUIRE(column->data->_storage.get(3) == 6);
+    }
+
+    SECTION("Reshape") {
+        auto flat = a->view({ 6 });
+        REQUIRE(flat->shape() == Shape{ 6 });
+        REQUIRE(flat->data->_storage.data() == base);
+
+        REQUIRE_THROWS_AS(a->view({ 4 }), IndexingError);
+        REQUIRE_THROWS_AS(a->permute({ 1, 0 })->view({ 6 }), IndexingError);
+    }
+
+    SECTION("Contiguous copies only when needed") {
+        REQUIRE(a->contiguous().get() == a.get());
+        REQUIRE(a->at(1)->contiguous()->data->_storage.data() == base + 3);
+
+        auto t = a->permute({ 1, 0 });
+        REQUIRE(t->data->_storage.data() == base);
+
+        auto c = t->contiguous();
+        REQUIRE(c->data->_storage.data() != base);
+        REQUIRE(c->data->_storage == Storage{ 1, 4, 2, 5, 3, 6 });
+        REQUIRE(c->view({ 6 })->shape() == Shape{ 6 });
+    }
+
+    SECTION("Views share the version counter") {
+        auto out = a * a;
+        a->at(0)->fill_(0);
+
+        REQUIRE(a->version() == 1);
+        REQUIRE_THROWS_AS(out->backward(), tensor_autodiff::AutodiffError);
+    }
+
+    SECTION("Gradients flow through views") {
+        auto x = Tensor::create(Storage{ 1, 2, 3, 4, 5, 6 });
+        (x->view({ 2, 3 }) * a)->backward();
+        REQUIRE(x->grad->shape() == Shape{ 6 });
+        REQUIRE(x->grad->data->_storage == Storage{ 1, 2, 3, 4, 5, 6 });
+
+        auto b = Tensor::create(std::make_unique<TensorData>(
+            Storage{ 1, 2 }, Shape{ 1, 2 }));
+        auto y = Tensor::create(std::make_unique<TensorData>(
+            Storage{ 0, 0, 0, 0, 0, 0 }, Shape{ 2, 3 }));
+        (y->permute({ 1, 0 }) * b)->backward();
+        REQUIRE(y->grad->shape() == Shape{ 2, 3 });
+        REQUIRE(y->grad->contiguous()->data->_storage
+                == Storage{ 1, 1, 1, 2, 2, 2 });
+    }
+}
+
+TEST_CASE("Strided views", "[tensor_data]") {
+    Tensor::set_backend();
+
+    auto a = Tensor::create(std::make_unique<TensorData>(
+        Storage{ 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 }, Shape{ 3, 4 }));
+    const double* base = a->data->_storage.data();
+
+    SECTION("Slice, narrow and select") {
+        auto every_other = a->slice(1, 1, 100, 2);
+        REQUIRE(every_other->shape() == Shape{ 3, 2 });
+        REQUIRE(every_other->data->strides == Strides{ 4, 2 });
+        REQUIRE(every_other->data->_storage.data() == base + 1);
+        REQUIRE(every_other->contiguous()->data->_storage
+                == Storage{ 1, 3, 5, 7, 9, 11 });
+
+        auto rows = a->narrow(0, 1, 2);
+        REQUIRE(rows->shape() == Shape{ 2, 4 });
+        REQUIRE(rows->data->_storage.data() == base + 4);
+
+        auto column = a->select(1, 2);
+        REQUIRE(column->shape() == Shape{ 3 });
+        REQUIRE(column->contiguous()->data->_storage == Storage{ 2, 6, 10 });
+
+        REQUIRE(a->slice(1, 2, 2)->shape() == Shape{ 3, 0 });
+        REQUIRE_THROWS_AS(a->slice(2, 0, 1), IndexingError);
+        REQUIRE_THROWS_AS(a->slice(1, 0, 4, 0), IndexingError);
+        REQUIRE_THROWS_AS(a->narrow(0, 2, 2), IndexingError);
+        REQUIRE_THROWS_AS(a->select(0, 3), IndexingError);
+    }
+
+    SECTION("Flip uses negative strides") {
+        auto f = a->flip({ 0, 1 });
+        REQUIRE(f->data->strides == Strides{ -4, -1 });
+        REQUIRE(f->data->_storage.data() == base + 11);
+        REQUIRE(f->data->get({ 0, 0 }) == 11);
+        REQUIRE(f->data->get({ 2, 3 }) == 0);
+
+        // Kernels read the flipped layout in place
+        auto sum = a + f;
+        REQUIRE(sum->data->_storage == Storage(12, 11.0));
+
+        auto rows = f->backend->add_reduce(f, 1);
+        REQUIRE(rows->data->_storage == Storage{ 38, 22, 6 });
+
+        {
+            tensor_fusion::FusionScope fusion;
+            auto fused = f * 2.0 - a;
+            fused->realize();
+            REQUIRE(fused->data->_storage
+                    == Storage{ 22, 19, 16, 13, 10, 7, 4, 1, -2, -5, -8, -11 });
+        }
+
+        auto w = Tensor::create(std::make_unique<TensorData>(
+            Storage{ 1, 0, 0, 1, 1, 1, 0, 2 }, Shape{ 4, 2 }));
+        auto flipped_w = w->flip({ 0 });
+        REQUIRE(matmul(f, flipped_w)->data->_storage
+                == matmul(f->contiguous(), flipped_w->contiguous())
+                       ->data->_storage);
+
+        // Slicing a flipped tensor reaches elements before its origin
+        auto tail = f->select(0, 2)->slice(0, 1, 4);
+        REQUIRE(tail->contiguous()->data->_storage == Storage{ 2, 1, 0 });
+
+        f->select(1, 0)->fill_(-1);
+        REQUIRE(a->data->_storage
+                == Storage{ 0, 1, 2, -1, 4, 5, 6, -1, 8, 9, 10, -1 });
+    }
+
+    SECTION("Expand uses zero strides") {
+        auto row = Tensor::create(std::make_unique<TensorData>(
+            Storage{ 1, 2, 3, 4 }, Shape{ 1, 4 }));
+        auto e = row->expand({ 2, 3, 4 });
+
+        REQUIRE(e->data->strides == Strides{ 0, 0, 1 });
+        REQUIRE(e->data->_storage.size() == 4);
+        auto expected = (row + a)->expand({ 2, 3, 4 })->contiguous();
+        REQUIRE((e + a)->data->_storage == expected->data->_storage);
+
+        REQUIRE_THROWS_AS(a->expand({ 3, 2 }), IndexingError);
+        REQUIRE_THROWS_AS(a->expand({ 4 }), IndexingError);
+    }
+
+    SECTION("Gradients") {
+        auto x = Tensor::create(Storage{ 1, 2, 3, 4, 5, 6 });
+        auto w = Tensor::create(Storage{ 1, 10, 100 });
+
+        (x->slice(0, 1, 6, 2) * w)->backward();
+        REQUIRE(x->grad->data->_storage == Storage{ 0, 1, 0, 10, 0, 100 });
+
+        auto y = Tensor::create(Storage{ 1, 2, 3 });
+        (y->flip({ 0 }) * w)->backward();
+        REQUIRE(y->grad->data->_storage == Storage{ 100, 10, 1 });
+
+        auto z = Tensor::create(std::make_unique<TensorData>(
+            Storage{ 1, 2, 3 }, Shape{ 3, 1 }));
+        (z->expand({ 3, 4 }) * a)->backward();
+        REQUIRE(z->grad->shape() == Shape{ 3, 1 });
+        REQUIRE(z->grad->data->_storage == Storage{ 6, 22, 38 });
+    }
+}
+
+TEST_CASE("Strided iterator", "[tensor_iterator]") {
+    using tensor_iterator::broadcast_strides;
+    using tensor_iterator::StridedIterator;
+
+    SECTION("Contiguous dimensions are merged") {
+        Shape shape = { 3, 4, 5 };
+        auto strides
+            = broadcast_strides(shape, strides_from_shape(shape), shape);
+        StridedIterator<1> it(shape, { strides });
+
+        REQUIRE(it.dims == 0);
+        REQUIRE(it.inner == 60);
+        REQUIRE_FALSE(it.next());
+    }
+
+    SECTION("Broadcasted operand visits rows in order") {
+        Shape out_shape = { 2, 3 };
+        Shape in_shape  = { 2, 1 };
+        StridedIterator<2> it(
+            out_shape,
+            { broadcast_strides(out_shape, { 3, 1 }, out_shape),
+              broadcast_strides(in_shape, { 1, 1 }, out_shape) });
+
+        REQUIRE(it.inner == 3);
+        REQUIRE(it.inner_stride == std::array<std::ptrdiff_t, 2>{ 1, 0 });
+        REQUIRE(it.pos == std::array<std::ptrdiff_t, 2>{ 0, 0 });
+        REQUIRE(it.next());
+        REQUIRE(it.pos == std::array<std::ptrdiff_t, 2>{ 3, 1 });
+        REQUIRE_FALSE(it.next());
+    }
+
+    SECTION("Zip over broadcasted and permuted operands") {
+        auto add_zip = tensor_ops::TensorOps::zip(operators::add);
+
+        // a: [[1, 2], [3, 4]] transposed, b: column vector [10, 20]
+        auto a = Tensor::create(std::make_unique<TensorData>(
+            Storage{ 1, 2, 3, 4 }, Shape{ 2, 2 }, Strides{ 1, 2 }));
+        auto b = Tensor::create(std::make_unique<TensorData>(
+            Storage{ 10, 20 }, Shape{ 2, 1 }));
+        auto out = add_zip(a, b);
+
+        REQUIRE(out->data->_storage == Storage{ 11, 13, 22, 24 });
+    }
+}
+
+TEST_CASE("SIMD backend matches scalar reference", "[tensor_simd]") {
+    using tensor_simd::Isa;
+
+    auto reference = tensor_ops::TensorBackend();
+
+    // Odd length to exercise the scalar tail of every vector width
+    auto a = Tensor::create(std::make_unique<TensorData>(
+        Storage{ -2, -1, -0.5, 0, 0.5, 1, 2, 3, -3, 4, 0, -4, 5 },
+        Shape{ 13 }));
+    auto b = Tensor::create(std::make_unique<TensorData>(
+        Storage{ 1, -1, 0.5, 0, -0.5, 2, 2, -3, 3, 4, 1, 4, -5 }, Shape{ 13 }));
+
+    for (auto isa : { Isa::Scalar, Isa::SSE4, Isa::AVX2, Isa::AVX512 }) {
+        if (isa > tensor_simd::detect_isa())
+            continue;
+
+        auto simd = tensor_simd::SimdBackend(isa);
+
+        REQUIRE(simd.neg_map(a)->data->_storage
+                == reference.neg_map(a)->data->_storage);
+        REQUIRE(simd.relu_map(a)->data->_storage
+                == reference.relu_map(a)->data->_storage);
+        REQUIRE(simd.add_zip(a, b)->data->_storage
+                == reference.add_zip(a, b)->data->_storage);
+        REQUIRE(simd.mul_zip(a, b)->data->_storage
+                == reference.mul_zip(a, b)->data->_storage);
+        REQUIRE(simd.sub_zip(a, b)->data->_storage
+                == reference.sub_zip(a, b)->data->_storage);
+        REQUIRE(simd.div_zip(a, b)->data->_storage
+                == reference.div_zip(a, b)->data->_storage);
+        REQUIRE(simd.lt_zip(a, b)->data->_storage
+                == reference.lt_zip(a, b)->data->_storage);
+        REQUIRE(simd.eq_zip(a, b)->data->_storage
+                == reference.eq_zip(a, b)->data->_storage);
+        REQUIRE(simd.relu_back_zip(a, b)->data->_storage
+                == reference.relu_back_zip(a, b)->data->_storage);
+    }
+
+    SECTION("Broadcasted operands use the scalar fallback") {
+        auto simd = tensor_simd::SimdBackend();
+        auto c    = Tensor::create(Storage{ 10 });
+
+        REQUIRE(simd.add_zip(a, c)->data->_storage
+                == reference.add_zip(a, c)->data->_storage);
+    }
+}
+
+TEST_CASE("Multithreaded kernels match single-threaded results",
+          "[thread_pool]") {
+    // Large enough to be split into several chunks
+    Shape shape = { 64, 48, 40 };
+    auto a      = Tensor::create(TensorData::rand(shape));
+    auto b      = Tensor::create(TensorData::rand({ 64, 1, 40 }));
+    auto t      = Tensor::create(std::make_unique<TensorData>(
+        a->data->_storage, Shape{ 40, 48, 64 }, Strides{ 1, 40, 1920 }));
+
+    auto backend = tensor_ops::TensorBackend();
+
+    auto run_all = [&] {
+        return std::vector<Storage>{
+            backend.exp_map(a)->data->_storage,
+            backend.exp_map(t)->data->_storage,
+            backend.add_zip(a, b)->data->_storage,
+            backend.mul_zip(a, a)->data->_storage,
+            backend.add_reduce(a, 0)->data->_storage,
+            backend.add_reduce(a, 2)->data->_storage,
+            backend.add_reduce(t, 1)->data->_storage,
+        };
+    };
+
+    thread_pool::set_num_threads(1);
+    auto expected = run_all();
+
+    thread_pool::set_num_threads(4);
+    auto result = run_all();
+
+    REQUIRE(thread_pool::num_threads() == 4);
+    REQUIRE(result == expected);
+
+    SECTION("parallel_for covers the range exactly once") {
+        std::vector<int> hits(100000, 0);
+        auto count = [&](size_t s, size_t e) {
+            for (size_t i = s; i < e; i++)
+                hits[i]++;
+        };
+        thread_pool::parallel_for(0, hits.size(), 1000, count);
+        REQUIRE(std::ranges::all_of(hits, [](int h) { return h == 1; }));
+    }
+}
+
+TEST_CASE("Matrix multiply", "[gemm]") {
+    auto naive = [](const sptr<Tensor>& a, const sptr<Tensor>& b) {
+        size_t M = a->shape()[0], K = a->shape()[1], N = b->shape()[1];
+        Storage out(M * N, 0.0);
+        for (size_t i = 0; i < M; i++)
+            for (size_t j = 0; j < N; j++)
+                for (size_t k = 0; k < K; k++)
+                    out[i * N + j] += a->data->get({ i, k })
+                                      * b->data->get({ k, j });
+        return out;
+    };
+
+    auto require_close = [](const Storage& out, const Storage& expected) {
+        REQUIRE(out.size() == expected.size());
+        for (size_t i = 0; i < out.size(); i++)
+            REQUIRE_THAT(out[i], WithinAbs(expected[i], 1e-9));
+    };
+
+    auto backend = tensor_ops::TensorBackend();
+
+    SECTION("Sizes not divisible by the tile") {
+        auto a = Tensor::create(TensorData::rand({ 37, 53 }));
+        auto b = Tensor::create(TensorData::rand({ 53, 29 }));
+
+        require_close(backend.matrix_multiply(a, b)->data->_storage,
+                      naive(a, b));
+    }
+
+    SECTION("Inner dimension spans several panels") {
+        auto a = Tensor::create(TensorData::rand({ 9, 600 }));
+        auto b = Tensor::create(TensorData::rand({ 600, 11 }));
+
+        require_close(backend.matrix_multiply(a, b)->data->_storage,
+                      naive(a, b));
+    }
+
+    SECTION("Transposed operands") {
+        auto a = Tensor::create(TensorData::rand({ 21, 13 }));
+        auto b = Tensor::create(TensorData::rand({ 17, 21 }));
+        a      = a->permute({ 1, 0 });
+        b      = b->permute({ 1, 0 });
+
+        require_close(backend.matrix_multiply(a, b)->data->_storage,
+                      naive(a, b));
+    }
+
+    SECTION("Mismatched shapes throw") {
+        auto a = Tensor::create(TensorData::rand({ 3, 4 }));
+        auto b = Tensor::create(TensorData::rand({ 5, 2 }));
+
+        REQUIRE_THROWS_AS(backend.matrix_multiply(a, b), IndexingError);
+    }
+
+    SECTION("Backward") {
+        Tensor::set_backend();
+
+        auto a = Tensor::create(std::make_unique<TensorData>(
+            Storage{ 1, 2, 3, 4, 5, 6 }, Shape{ 2, 3 }));
+        auto b = Tensor::create(std::make_unique<TensorData>(
+            Storage{ 1, 0, -1, 2, 3, 1 }, Shape{ 3, 2 }));
+
+        auto out = matmul(a, b);
+        out->backward();
+
+        // d(sum(a @ b)) / da = ones @ b^T, / db = a^T @ ones
+        require_close(a->grad->data->_storage, Storage{ 1, 1, 4, 1, 1, 4 });
+        require_close(b->grad->data->_storage, Storage{ 5, 5, 7, 7, 9, 9 });
+    }
+}
+
+TEST_CASE("Batched matrix multiply", "[gemm]") {
+    auto backend = tensor_ops::TensorBackend();
+
+    // Compare every batch against the 2-d product of its slices
+    auto check = [&](Shape a_shape, Shape b_shape, Shape out_shape) {
+        auto a   = Tensor::create(TensorData::rand(a_shape));
+        auto b   = Tensor::create(TensorData::rand(b_shape));
+        auto out = backend.matrix_multiply(a, b);
+
+        REQUIRE(out->shape() == out_shape);
+
+        size_t dims = out_shape.size();
+        size_t K    = a_shape.back();
+
+        for (size_t i = 0; i < out->data->size; i++) {
+            Index out_index(dims, 0);
+            out_index = to_tensor_index(i, out_index, out_shape);
+
+            Index a_index = broadcast_index(out_index, out_shape, a_shape);
+            Index b_index = broadcast_index(out_index, out_shape, b_shape);
+
+            double expected = 0.0;
+            for (size_t k = 0; k < K; k++) {
+                a_index[a_index.size() - 2] = out_index[dims - 2];
+                a_index.back()              = k;
+                b_index[b_index.size() - 2] = k;
+                b_index.back()              = out_index[dims - 1];
+                expected += a->data->get(a_index) * b->data->get(b_index);
+            }
+
+            REQUIRE_THAT(out->data->get(out_index), WithinAbs(expected, 1e-9));
+        }
+    };
+
+    SECTION("Matching batches") {
+        check({ 3, 5, 7 }, { 3, 7, 4 }, { 3, 5, 4 });
+    }
+
+    SECTION("Shared right operand") {
+        check({ 2, 3, 9, 6 }, { 6, 10 }, { 2, 3, 9, 10 });
+    }
+
+    SECTION("Shared left operand") {
+        check({ 9, 6 }, { 4, 6, 10 }, { 4, 9, 10 });
+    }
+
+    SECTION("Unit batch dimensions broadcast") {
+        check({ 2, 1, 5, 3 }, { 1, 4, 3, 2 }, { 2, 4, 5, 2 });
+    }
+
+    SECTION("Shared weight gradient sums over batches") {
+        Tensor::set_backend();
+
+        auto x = Tensor::create(TensorData::rand({ 3, 4, 5 }));
+        auto w = Tensor::create(TensorData::rand({ 5, 2 }));
+
+        auto out = matmul(x, w);
+        out->backward();
+
+        REQUIRE(x->grad->shape() == Shape{ 3, 4, 5 });
+        REQUIRE(w->grad->shape() == Shape{ 5, 2 });
+
+        // d(sum(x @ w)) / dw[k][n] = sum of x[..., k]
+        for (size_t k = 0; k < 5; k++) {
+            double expected = 0.0;
+            for (size_t b = 0; b < 3; b++)
+                for (size_t m = 0; m < 4; m++)
+                    expected += x->data->get({ b, m, k });
+
+            REQUIRE_THAT(w->grad->data->get({ k, 0 }),
+                         WithinAbs(expected, 1e-9));
+            REQUIRE_THAT(w->grad->data->get({ k, 1 }),
+                         WithinAbs(expected, 1e-9));
+        }
+    }
+}
+
+TEST_CASE("Fused elementwise expressions", "[tensor_fusion]") {
+    Tensor::set_backend();
+
+    auto a = Tensor::create(TensorData::rand({ 3, 3, 5 }));
+    auto b = Tensor::create(TensorData::rand({ 3, 1, 5 }));
+    auto c = Tensor::create(TensorData::rand({ 5 }));
+    auto d = Tensor::create(TensorData::rand({ 3, 3, 1 }));
+    auto e = Tensor::create(TensorData::rand({ 3, 5 }));
+
+    auto expression = [&] { return a / 1.2 + b * c / d - 3 - e; };
+
+    auto eager = expression();
+
+    sptr<Tensor> fused;
+    {
+        tensor_fusion::FusionScope scope;
+        fused = expression();
+    }
+
+    SECTION("Nothing runs until the result is read") {
+        REQUIRE(fused->pending != nullptr);
+        REQUIRE(fused->data == nullptr);
+        REQUIRE(fused->shape() == Shape{ 3, 3, 5 });
+
+        require_close(fused, eager);
+        REQUIRE(fused->pending == nullptr);
+    }
+
+    SECTION("Backward matches eager execution") {
+        eager->backward();
+        auto eager_grads = std::vector{ a->grad, b->grad, c->grad, d->grad };
+
+        a->grad = b->grad = c->grad = d->grad = e->grad = nullptr;
+        fused->backward();
+
+        require_close(a->grad, eager_grads[0]);
+        require_close(b->grad, eager_grads[1]);
+        require_close(c->grad, eager_grads[2]);
+        require_close(d->grad, eager_grads[3]);
+    }
+
+    SECTION("Shared subexpressions and transposed inputs") {
+        auto t = a->permute({ 2, 1, 0 });
+
+        auto fused_expression = [&] {
+            auto sq = t * t;
+            return sq * sq + TensorFunction::apply<Exp>(t);
+        };
+
+        auto reference = fused_expression();
+
+        tensor_fusion::FusionScope scope;
+        require_close(fused_expression(), reference);
+    }
+
+    SECTION("Wide expressions are split into several kernels") {
+        std::vector<sptr<Tensor>> terms;
+        for (int i = 0; i < 20; i++)
+            terms.push_back(Tensor::create(TensorData::rand({ 3, 3, 5 })));
+
+        auto sum_all = [&] {
+            auto sum = a;
+            for (auto& term : terms)
+                sum = sum + term;
+            return sum;
+        };
+
+        auto reference = sum_all();
+
+        tensor_fusion::FusionScope scope;
+        auto sum = sum_all();
+
+        REQUIRE(sum->pending->inputs <= tensor_fusion::MAX_INPUTS);
+        require_close(sum, reference);
+    }
+}
+
+TEST_CASE("Lazy tensors", "[tensor_fusion]") {
+    Tensor::set_backend();
+
+    auto x  = Tensor::create(TensorData::rand({ 2, 4, 3 }));
+    auto w1 = Tensor::create(TensorData::rand({ 3, 5 }));
+    auto w2 = Tensor::create(TensorData::rand({ 5, 2 }));
+    auto b  = Tensor::create(TensorData::rand({ 2 }));
+
+    auto network = [&] {
+        auto hidden = TensorFunction::apply<Relu>(matmul(x, w1));
+        return matmul(hidden * 0.5, w2) + b;
+    };
+
+    auto eager = network();
+
+    SECTION("Kernels run once the value is observed") {
+        sptr<Tensor> lazy;
+        {
+            tensor_fusion::LazyScope scope;
+            lazy = network();
+        }
+
+        auto product = lazy->parents()[0];
+        REQUIRE(product->pending->op == tensor_fusion::Op::Call);
+        REQUIRE(lazy->shape() == Shape{ 2, 4, 2 });
+
+        require_close(lazy, eager);
+        REQUIRE(product->pending->op == tensor_fusion::Op::Load);
+    }
+
+    SECTION("Unobserved results are never computed") {
+        tensor_fusion::LazyScope scope;
+
+        auto product = matmul(x, w1);
+        auto used    = product + 1;
+        auto shared  = product * 2;
+        auto unused  = matmul(product, w2);
+
+        used->realize();
+        REQUIRE(product->pending->op == tensor_fusion::Op::Load);
+        REQUIRE(unused->pending->op == tensor_fusion::Op::Call);
+
+        // The kernel result is reused, not run again
+        auto result = product->pending->input;
+        shared->realize();
+        REQUIRE(product->pending->input.get() == result.get());
+        require_close(shared, result * 2);
+    }
+
+    SECTION("Backward matches eager execution") {
+        eager->backward();
+        auto eager_grads = std::vector{ x->grad, w1->grad, w2->grad, b->grad };
+
+        x->grad = w1->grad = w2->grad = b->grad = nullptr;
+        {
+            tensor_fusion::LazyScope scope;
+            network()->backward();
+        }
+
+        require_close(x->grad, eager_grads[0]);
+        require_close(w1->grad, eager_grads[1]);
+        require_close(w2->grad, eager_grads[2]);
+        require_close(b->grad, eager_grads[3]);
+    }
+
+    SECTION("Views of pending values are deferred with them") {
+        tensor_fusion::LazyScope scope;
+
+        auto product    = matmul(x, w1);
+        auto transposed = product->permute({ 0, 2, 1 });
+        auto row = transposed->select(1, 2)->contiguous()->view({ 8 });
+        REQUIRE(product->pending->op == tensor_fusion::Op::Call);
+        REQUIRE(transposed->pending->op == tensor_fusion::Op::Call);
+        REQUIRE(transposed->shape() == Shape{ 2, 5, 4 });
+        REQUIRE(row->shape() == Shape{ 8 });
+
+        // A branch through another view that is never read
+        auto unused = matmul(x, w1)->permute({ 1, 0, 2 });
+
+        // Operands of the view kernels are realized on the way
+        row->realize();
+        REQUIRE(product->pending == nullptr);
+        REQUIRE(transposed->pending == nullptr);
+        REQUIRE(unused->pending->op == tensor_fusion::Op::Call);
+        REQUIRE(unused->parents()[0]->pending->op == tensor_fusion::Op::Call);
+
+        // The permuted view shares the buffer of the kernel result
+        auto reference = matmul(x, w1);
+        reference->realize();
+        require_close(transposed, reference->permute({ 0, 2, 1 }));
+        REQUIRE(transposed->data->_storage.as<double>()
+                == product->data->_storage.as<double>());
+    }
+
+    SECTION("Shape errors are reported when recording") {
+        tensor_fusion::LazyScope scope;
+        REQUIRE_THROWS_AS(matmul(x, w2), IndexingError);
+
+        auto product = matmul(x, w1);
+        REQUIRE_THROWS_AS(product->view({ 7 }), IndexingError);
+        REQUIRE_THROWS_AS(product->select(3, 0), IndexingError);
+    }
+}
+
+TEST_CASE("Caching allocator", "[allocator]") {
+    Tensor::set_backend();
+
+    allocator::empty_cache();
+    allocator::reset_stats();
+
+    SECTION("Size classes") {
+        REQUIRE(allocator::size_class(1) == 64);
+        REQUIRE(allocator::size_class(64) == 64);
+        REQUIRE(allocator::size_class(65) == 80);
+        REQUIRE(allocator::size_class(1000) == 1024);
+        REQUIRE(allocator::size_class(4096) == 4096);
+        REQUIRE(allocator::size_class(4097) == 5120);
+    }
+
+    SECTION("Freed blocks are reused") {
+        const double* first;
+        {
+            Storage s(1000, DType::Float64);
+            first = s.data();
+            s[3]  = 5;
+
+            auto stats = allocator::stats();
+            REQUIRE(stats.misses == 1);
+            REQUIRE(stats.allocated_bytes == 8192);
+            REQUIRE(stats.cached_bytes == 0);
+        }
+        REQUIRE(allocator::stats().cached_bytes == 8192);
+
+        // Same size class, still zero filled
+        Storage s(990, DType::Float64);
+        REQUIRE(s.data() == first);
+        REQUIRE(s[3] == 0);
+
+        auto stats = allocator::stats();
+        REQUIRE(stats.hits == 1);
+        REQUIRE(stats.cached_bytes == 0);
+        REQUIRE(stats.peak_bytes == 8192);
+    }
+
+    SECTION("Steady state runs from the cache") {
+        auto a = Tensor::create(TensorData::rand({ 32, 32 }));
+        auto b = Tensor::create(TensorData::rand({ 32, 32 }));
+
+        (a + b * a)->realize();
+        allocator::reset_stats();
+
+        for (int i = 0; i < 10; i++)
+            (a + b * a)->realize();
+
+        auto stats = allocator::stats();
+        REQUIRE(stats.misses == 0);
+        REQUIRE(stats.hits == 20);
+        REQUIRE(stats.peak_bytes <= stats.allocated_bytes + 2 * 8192);
+    }
+
+    SECTION("Emptying the cache") {
+        { Storage s(100, DType::Float32); }
+        REQUIRE(allocator::stats().cached_bytes > 0);
+
+        allocator::empty_cache();
+        REQUIRE(allocator::stats().cached_bytes == 0);
+    }
+
+    SECTION("Blocks start on a cache line") {
+        for (size_t size : { 1, 3, 17, 1000 }) {
+            Storage s(size, DType::Float32);
+            auto address = reinterpret_cast<std::uintptr_t>(s.as<float>());
+            REQUIRE(address % allocator::ALIGNMENT == 0);
+            REQUIRE(s.alignment() == allocator::ALIGNMENT);
+            REQUIRE(!s.huge_pages());
+        }
+
+        Storage s(8, DType::Float32);
+        REQUIRE(s.view(1, 4).alignment() == 4);
+    }
+
+    SECTION("Large blocks go on huge pages") {
+        REQUIRE(allocator::huge_page_threshold() == allocator::HUGE_PAGE_SIZE);
+        allocator::set_huge_page_threshold(1 << 16);
+
+        Storage large(1 << 14, DType::Float64);
+        auto address = reinterpret_cast<std::uintptr_t>(large.data());
+        REQUIRE(address % allocator::HUGE_PAGE_SIZE == 0);
+        REQUIRE(large.huge_pages());
+        REQUIRE(large.view(0, 8).huge_pages());
+
+        Storage small(1 << 12, DType::Float64);
+        REQUIRE(!small.huge_pages());
+
+        allocator::set_huge_page_threshold(allocator::HUGE_PAGE_SIZE);
+    }
+}
+
+TEST_CASE("Backward through shared nodes", "[tensor_autodiff]") {
+    Tensor::set_backend();
+
+    auto x = Tensor::create(Storage{ 1, 2, 3 });
+
+    // x * x reaches the root along two paths, both gradients have to be
+    // in before it passes one on to x
+    auto square = x * x;
+    auto out    = square * 2 + square * 3;
+
+    SECTION("Every node comes after all of its consumers") {
+        auto order = topological_sort(out);
+        REQUIRE(order.size() == 4);
+        REQUIRE(order.front().get() == out.get());
+        REQUIRE(order.back().get() == square.get());
+    }
+
+    SECTION("Gradients are complete") {
+        out->backward();
+        REQUIRE(x->grad->data->_storage == Storage{ 10, 20, 30 });
+    }
+
+    SECTION("Gradients that alias each other are summed out of place") {
+        auto m = Tensor::create(std::make_unique<TensorData>(
+            Storage{ 1, 2, 3, 4 }, Shape{ 2, 2 }));
+        auto w = Tensor::create(std::make_unique<TensorData>(
+            Storage{ 1, 10, 100, 1000 }, Shape{ 2, 2 }));
+
+        // The gradient of y through the permute is a view of the one
+        // through the sum
+        auto y = m * 2.0;
+        ((y + y->permute({ 1, 0 })) * w)->backward();
+        REQUIRE(m->grad->data->_storage == Storage{ 4, 220, 220, 4000 });
+    }
+
+    SECTION("The order is kept for later calls") {
+        out->backward(true);
+        const auto* cached = out->backward_order.data();
+        REQUIRE(out->backward_order.size() == 3);
+
+        out->backward(true);
+        REQUIRE(out->backward_order.data() == cached);
+        REQUIRE(x->grad->data->_storage == Storage{ 20, 40, 60 });
+    }
+
+    SECTION("Saved tensors are freed without retain_graph") {
+        out->backward();
+        REQUIRE(x->grad->data->_storage == Storage{ 10, 20, 30 });
+
+        REQUIRE(square->history.ctx.saved_values.empty());
+        REQUIRE(square->parents().empty());
+        REQUIRE(!square->is_leaf());
+        REQUIRE(out->backward_order.empty());
+        REQUIRE(x.use_count() == 1);
+
+        REQUIRE_THROWS_AS(out->backward(), tensor_autodiff::AutodiffError);
+        REQUIRE_THROWS_AS(square->backward(), tensor_autodiff::AutodiffError);
+    }
+}
+
+TEST_CASE("Graph arena", "[tensor_autodiff]") {
+    Tensor::set_backend();
+
+    auto w = Tensor::create(Storage{ 1, 2, 3 });
+    auto x = Tensor::create(Storage{ 4, 5, 6 });
+
+    auto step = [&] {
+        auto out = (w * x + w) * x;
+        out->backward();
+        return out;
+    };
+
+    SECTION("Graph nodes live in the arena") {
+        REQUIRE(graph_resource() == std::pmr::get_default_resource());
+
+        const void* first;
+        {
+            GraphArena arena;
+            auto out = step();
+            REQUIRE(out->history.inputs.get_allocator().resource()
+                    == graph_resource());
+            REQUIRE(graph_resource() != std::pmr::get_default_resource());
+            first = out->history.inputs.data();
+        }
+        REQUIRE(graph_resource() == std::pmr::get_default_resource());
+
+        // The next step starts over at the same memory
+        {
+            GraphArena arena;
+            auto out = step();
+            REQUIRE(out->history.inputs.data() == first);
+        }
+
+        REQUIRE(w->grad->data->_storage == Storage{ 40, 60, 84 });
+    }
+
+    SECTION("Escaping tensors keep their graph") {
+        sptr<Tensor> kept;
+        {
+            GraphArena arena;
+            kept = w * x;
+        }
+        {
+            GraphArena arena;
+            auto out = w * x;
+            REQUIRE(out->history.inputs.data() != kept->history.inputs.data());
+        }
+
+        kept->backward();
+        REQUIRE(w->grad->data->_storage == Storage{ 4, 5, 6 });
+    }
+
+    SECTION("Escaping nodes don't grow the arena") {
+        sptr<Tensor> kept, metric;
+        size_t bytes = 0;
+
+        for (int i = 0; i < 2000; i++) {
+            GraphArena arena;
+            auto out = step();
+
+            // One node of the first step stays alive throughout, another
+            // is replaced every few steps
+            if (i == 0)
+                kept = w * x;
+            if (i % 10 == 0)
+                metric = out;
+            if (i == 20)
+                bytes = graph_arena_bytes();
+        }
+
+        REQUIRE(kept->history.inputs.size() == 2);
+        REQUIRE(graph_arena_bytes() == bytes);
+    }
+}
+
+TEST_CASE("Intrusive tensor handles", "[tensor]") {
+    Tensor::set_backend();
+
+    auto a = Tensor::create(Storage{ 1, 2, 3 });
+    REQUIRE(sizeof(a) == sizeof(Tensor*));
+    REQUIRE(a.use_count() == 1);
+
+    SECTION("Copies share the count, moves hand it over") {
+        auto b = a;
+        REQUIRE(a.use_count() == 2);
+        REQUIRE(b.get() == a.get());
+
+        auto c = std::move(b);
+        REQUIRE(!b);
+        REQUIRE(c.use_count() == 2);
+
+        c.reset();
+        REQUIRE(a.use_count() == 1);
+    }
+
+    SECTION("Handles from inside a tensor") {
+        auto out = a * a;
+        REQUIRE(a.use_count() > 1);  // held by the graph
+
+        auto again = out->self();
+        REQUIRE(again.get() == out.get());
+        REQUIRE(out.use_count() == 2);
+
+        out.reset();
+        again.reset();
+        REQUIRE(a.use_count() == 1);
+
+        Tensor local(Storage{ 1, 2 });
+        REQUIRE_THROWS_AS(local.self(), std::bad_weak_ptr);
+    }
+}
+
+TEST_CASE("Captured steps", "[tensor_capture]") {
+    Tensor::set_backend();
+
+    auto x = Tensor::create(TensorData::rand({ 4, 3 }));
+    auto w = Tensor::create(TensorData::rand({ 3, 2 }));
+    auto b = Tensor::create(TensorData::rand({ 2 }));
+
+    auto model = [&](const sptr<Tensor>& input) {
+        auto hidden = matmul(input, w) + b;
+        auto scaled = hidden->permute({ 1, 0 }) * 0.5;
+        return TensorFunction::apply<Sigmoid>(scaled) * scaled;
+    };
+
+    tensor_capture::Graph step;
+    sptr<Tensor> out;
+    {
+        tensor_capture::CaptureScope capture(step);
+        out = model(x);
+        out->backward();
+    }
+
+    // Five functions, one view and backward
+    REQUIRE(step.size() == 7);
+    REQUIRE(tensor_capture::capturing() == nullptr);
+
+    SECTION("Replays match eager steps on new values") {
+        for (int i = 0; i < 3; i++) {
+            x->copy_(Tensor::create(TensorData::rand({ 4, 3 })));
+            w->grad->fill_(0.0);
+            b->grad->fill_(0.0);
+
+            const auto* grad_buffer = w->grad->data->_storage.as<double>();
+            step.replay();
+            REQUIRE(w->grad->data->_storage.as<double>() == grad_buffer);
+
+            auto w_grad = w->grad, b_grad = b->grad;
+            w->grad = b->grad = nullptr;
+
+            auto eager = model(x);
+            eager->backward();
+
+            require_close(out, eager);
+            require_close(w_grad, w->grad);
+            require_close(b_grad, b->grad);
+
+            w->grad = w_grad;
+            b->grad = b_grad;
+        }
+    }
+
+    SECTION("Parameters updated in place between replays") {
+        w->add_(w->grad, -0.1);
+        REQUIRE_NOTHROW(step.replay());
+
+        auto replayed = out->data->_storage.clone();
+        auto eager    = model(x);
+        REQUIRE(eager->data->_storage == replayed);
+    }
+
+    SECTION("Replays write into the buffers of the captured nodes") {
+        // out, sigmoid, scaled, permuted, hidden and the product
+        std::vector<sptr<Tensor>> nodes{ out };
+        while (!nodes.back()->parents().empty())
+            nodes.push_back(nodes.back()->parents()[0]);
+        nodes.pop_back();
+        REQUIRE(nodes.size() == 6);
+
+        std::vector<const double*> buffers;
+        for (auto& node : nodes)
+            buffers.push_back(node->data->_storage.as<double>());
+
+        x->copy_(Tensor::create(TensorData::rand({ 4, 3 })));
+        step.replay();
+
+        for (size_t i = 0; i < nodes.size(); i++)
+            REQUIRE(nodes[i]->data->_storage.as<double>() == buffers[i]);
+
+        require_close(out, model(x));
+    }
+
+    SECTION("In-place ops inside the scope are replayed") {
+        auto v     = Tensor::create(Storage{ 1, 2 });
+        auto shift = Tensor::create(Storage{ 10, 20 });
+
+        tensor_capture::Graph inplace;
+        sptr<Tensor> y;
+        {
+            tensor_capture::CaptureScope capture(inplace);
+            y = v * 2.0;
+            y->add_(shift);
+            y->mul_(v);
+        }
+        REQUIRE(inplace.size() == 3);
+        REQUIRE(y->data->_storage == Storage{ 12, 48 });
+
+        v->fill_(3.0);
+        inplace.replay();
+        REQUIRE(y->data->_storage == Storage{ 48, 78 });
+    }
+}